@@ -1,5 +1,13 @@
 #pragma once
 
+#include "bigint.h"
+#include "heap.h"
+#include "shape.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
 #include <string>
 #undef EOF
 #include <vector>
@@ -10,9 +18,72 @@ struct Statement;
 struct Identifier;
 struct Expression;
 
+// Totals of the AST nodes allocated so far by every parser and optimizer in the
+// process. Nodes are counted when allocated with new, whatever their type.
+AllocationStats GetAstStats();
+
+// Shortest text that reads back as value, with a fraction even if it is whole so
+// that it does not read as an integer. value must be finite, as the evaluator keeps
+// every float.
+std::string FormatFloat(double value);
+
+// The one shared copy of a name. Identifiers with the same name refer to the same
+// string, so they take no space of their own and compare equal by address. Names are
+// kept for the lifetime of the process.
+const std::string& Intern(const std::string& name);
+
+// Owns the nodes of a program. They are placed one after another in large blocks in
+// the order they are created, without the header the allocator would put in front of
+// each, and all of them are released at once with the arena. Arena nodes must not be
+// deleted individually.
+class AstArena {
+public:
+    AstArena() = default;
+    ~AstArena();
+    AstArena(const AstArena&) = delete;
+    AstArena& operator=(const AstArena&) = delete;
+
+    void* Allocate(size_t size, bool statement);
+    // Takes back the latest allocation if memory is it, for a node whose constructor
+    // threw. False for anything else.
+    bool Release(void* memory, size_t size, bool statement);
+
+    // Nodes created on this thread go into arena while a Scope is alive, without one
+    // they are allocated on their own.
+    class Scope {
+    public:
+        Scope(AstArena* arena);
+        ~Scope();
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        AstArena* _previous;
+    };
+
+    static AstArena* Current();
+
+    size_t GetBytes() const { return _bytes; }
+
+private:
+    static constexpr size_t BLOCK_SIZE = 64 << 10;
+    static constexpr size_t ALIGNMENT = alignof(uint64_t);
+
+    std::vector<std::unique_ptr<std::byte[]>> _blocks;
+    std::byte* _next = nullptr;
+    std::byte* _end = nullptr;
+    size_t _bytes = 0;
+
+    // to run the destructors, which free the nodes' own vectors
+    std::vector<void*> _statements;
+    std::vector<void*> _expressions;
+};
+
 // Program
 struct Program {
     std::vector<Statement*> statements;
+    // holds the nodes, shared by whatever still refers to them
+    std::shared_ptr<AstArena> arena;
 
     friend std::ostream& operator<<(std::ostream& stream, const Program& program);
 };
@@ -23,12 +94,18 @@ struct Statement {
         LET,
         RETURN,
         EXPRESSION,
+        YIELD,
     };
 
     friend std::ostream& operator<<(std::ostream& stream, const Statement& statement);
 
     Type type;
 
+    virtual ~Statement() = default;
+
+    static void* operator new(size_t size);
+    static void operator delete(void* pointer, size_t size);
+
 protected:
     Statement(Type type) : type(type) {}
 
@@ -57,6 +134,16 @@ private:
     virtual void Print(std::ostream& stream) const override;
 };
 
+// yield <EXPRESSION>;
+struct YieldStatement : Statement {
+    YieldStatement(Expression* value) : Statement(Type::YIELD), value(value) {}
+
+    Expression* value;
+
+private:
+    virtual void Print(std::ostream& stream) const override;
+};
+
 // <EXPRESSION>;
 struct ExpressionStatement : Statement {
     ExpressionStatement(Expression* expression) : Statement(Type::EXPRESSION), expression(expression) {}
@@ -72,6 +159,7 @@ struct Expression {
     enum Type {
         IDENT,
         INT,
+        STRING,
         BOOLEAN,
         PREFIX,
         INFIX,
@@ -79,12 +167,25 @@ struct Expression {
         IF_ELSE,
         CALL,
         FUNCTION,
+        STRUCT,
+        FIELD,
+        ASSIGN,
+        WHILE,
+        FOR,
+        MAP,
+        FLOAT,
+        BIG_INT,
     };
 
     friend std::ostream& operator<<(std::ostream& stream, const Expression& expression);
 
     Type type;
 
+    virtual ~Expression() = default;
+
+    static void* operator new(size_t size);
+    static void operator delete(void* pointer, size_t size);
+
 protected:
     Expression(Type type) : type(type) {}
 
@@ -93,9 +194,10 @@ protected:
 
 // <IDENT>
 struct Identifier : Expression {
-    Identifier(std::string value) : Expression(Type::IDENT), value(value) {}
+    Identifier(const std::string& value) : Expression(Type::IDENT), value(Intern(value)) {}
 
-    std::string value;
+    // interned
+    const std::string& value;
 
 private:
     virtual void Print(std::ostream& stream) const override;
@@ -103,9 +205,39 @@ private:
 
 // <0-9_>*
 struct IntegerLiteral : Expression {
-    IntegerLiteral(int value) : Expression(Type::INT), value(value) {}
+    IntegerLiteral(int64_t value) : Expression(Type::INT), value(value) {}
 
-    int value;
+    int64_t value;
+
+private:
+    virtual void Print(std::ostream& stream) const override;
+};
+
+// <0-9>* too large for an int64_t
+struct BigIntLiteral : Expression {
+    BigIntLiteral(BigInt value) : Expression(Type::BIG_INT), value(std::move(value)) {}
+
+    BigInt value;
+
+private:
+    virtual void Print(std::ostream& stream) const override;
+};
+
+// <0-9>*.<0-9>*
+struct FloatLiteral : Expression {
+    FloatLiteral(double value) : Expression(Type::FLOAT), value(value) {}
+
+    double value;
+
+private:
+    virtual void Print(std::ostream& stream) const override;
+};
+
+// "<CHARACTER>*"
+struct StringLiteral : Expression {
+    StringLiteral(std::string value) : Expression(Type::STRING), value(std::move(value)) {}
+
+    std::string value;
 
 private:
     virtual void Print(std::ostream& stream) const override;
@@ -156,6 +288,19 @@ struct InfixExpression : Expression {
         OR,
     };
 
+    // Operand types observed on the first evaluation select a specialized form that is
+    // guarded by a type check, a failing guard rewrites the node back to GENERIC.
+    // Atomic since programs are shared between isolates running on other threads.
+    enum Specialization {
+        UNINITIALIZED,
+        GENERIC,
+        INT_INT,
+        BOOL_BOOL,
+        FLOAT_FLOAT,
+        // <IDENT> <OPERATOR> <INT>, fused into a single lookup and integer operation
+        INT_CONSTANT,
+    };
+
     InfixExpression(Operation op, Expression* left, Expression* right)
         : Expression(Type::INFIX), op(op), left(left), right(right) {}
 
@@ -165,6 +310,8 @@ struct InfixExpression : Expression {
     Expression* left;
     Expression* right;
 
+    mutable std::atomic<Specialization> specialization{Specialization::UNINITIALIZED};
+
 private:
     virtual void Print(std::ostream& stream) const override;
 };
@@ -195,24 +342,234 @@ private:
 
 // fn(<IDENT>,*) <BLOCK>
 struct FunctionExpression : Expression {
-    FunctionExpression(std::vector<Identifier*> parameters, BlockExpression* body)
-        : Expression(Type::FUNCTION), parameters(parameters), body(body) {}
+    FunctionExpression(std::vector<Identifier*> parameters, BlockExpression* body,
+                       bool generator = false)
+        : Expression(Type::FUNCTION), parameters(parameters), body(body),
+          generator(generator) {}
 
     std::vector<Identifier*> parameters;
     BlockExpression* body;
+    // the body yields, calls return a Generator instead of running it
+    bool generator;
+
+    // for profiles, the name of the let it is bound to if any and the line of the fn
+    std::string name;
+    uint32_t line = 0;
+
+    // Every name used in the literal, interned, which are all the bindings a closure
+    // can look up. Collected on first use, once the optimizer is done with the body.
+    const std::vector<const std::string*>& GetNames() const;
 
 private:
+    mutable std::once_flag _names_collected;
+    mutable std::vector<const std::string*> _names;
+
     virtual void Print(std::ostream& stream) const override;
 };
 
 // <EXPRESSION>(<EXPRESSION>,*)
 struct CallExpression : Expression {
+    enum Specialization {
+        UNINITIALIZED,
+        GENERIC,
+        // <IDENT>(...) that last called a function of matching arity, fused into a
+        // direct lookup and call
+        KNOWN_ARITY,
+    };
+
     CallExpression(Expression* function, std::vector<Expression*> arguments)
         : Expression(Type::CALL), function(function), arguments(arguments) {}
 
     Expression* function;
     std::vector<Expression*> arguments;
 
+    mutable std::atomic<Specialization> specialization{Specialization::UNINITIALIZED};
+
+private:
+    virtual void Print(std::ostream& stream) const override;
+};
+
+// struct { <IDENT>,* }
+struct StructExpression : Expression {
+    StructExpression(std::vector<Identifier*> fields, std::vector<std::string> names)
+        : Expression(Type::STRUCT), fields(fields), shape(std::move(names)) {}
+
+    std::vector<Identifier*> fields;
+    // shared by all instances, whichever isolate evaluates the declaration
+    Shape shape;
+
+private:
+    virtual void Print(std::ostream& stream) const override;
+};
+
+// <EXPRESSION>.<IDENT>
+struct FieldExpression : Expression {
+    FieldExpression(Expression* object, Identifier* field)
+        : Expression(Type::FIELD), object(object), field(field) {}
+
+    Expression* object;
+    Identifier* field;
+
+    // Shape id in the upper and field offset in the lower half for the last instance
+    // read through this site, packed into one word so that threads sharing the program
+    // never see an id with another shape's offset.
+    mutable std::atomic<uint64_t> cache{0};
+
+private:
+    virtual void Print(std::ostream& stream) const override;
+};
+
+// <IDENT> = <EXPRESSION>, rebinds the nearest existing binding
+struct AssignExpression : Expression {
+    AssignExpression(Identifier* name, Expression* value)
+        : Expression(Type::ASSIGN), name(name), value(value) {}
+
+    Identifier* name;
+    Expression* value;
+
 private:
     virtual void Print(std::ostream& stream) const override;
 };
+
+// while <EXPRESSION> <BLOCK>
+struct WhileExpression : Expression {
+    WhileExpression(Expression* condition, BlockExpression* body)
+        : Expression(Type::WHILE), condition(condition), body(body) {}
+
+    Expression* condition;
+    BlockExpression* body;
+
+private:
+    virtual void Print(std::ostream& stream) const override;
+};
+
+// for <STATEMENT> <EXPRESSION>; <EXPRESSION> <BLOCK>
+struct ForExpression : Expression {
+    ForExpression(Statement* initializer, Expression* condition, Expression* update,
+                  BlockExpression* body)
+        : Expression(Type::FOR), initializer(initializer), condition(condition),
+          update(update), body(body) {}
+
+    Statement* initializer;
+    Expression* condition;
+    Expression* update;
+    BlockExpression* body;
+
+private:
+    virtual void Print(std::ostream& stream) const override;
+};
+
+// { <EXPRESSION>: <EXPRESSION>,* }
+struct MapExpression : Expression {
+    MapExpression(std::vector<std::pair<Expression*, Expression*>> entries)
+        : Expression(Type::MAP), entries(std::move(entries)) {}
+
+    std::vector<std::pair<Expression*, Expression*>> entries;
+
+private:
+    virtual void Print(std::ostream& stream) const override;
+};
+
+// Calls visit(child) for every node directly below node, in evaluation order: the
+// statements of a block and the initializer of a for are visited as statements,
+// everything else as expressions. The names a let or an assignment binds and the
+// parameters of a function literal are not children. Passes that only read the tree
+// recurse through this, so a new kind of node only has to be added here.
+template <typename Visit>
+void ForEachChild(const Statement* node, Visit&& visit) {
+    switch (node->type) {
+    case Statement::Type::LET:
+        visit(static_cast<const Expression*>(static_cast<const LetStatement*>(node)->value));
+        break;
+    case Statement::Type::RETURN:
+        visit(static_cast<const Expression*>(static_cast<const ReturnStatement*>(node)->value));
+        break;
+    case Statement::Type::YIELD:
+        visit(static_cast<const Expression*>(static_cast<const YieldStatement*>(node)->value));
+        break;
+    case Statement::Type::EXPRESSION:
+        visit(static_cast<const Expression*>(
+            static_cast<const ExpressionStatement*>(node)->expression));
+        break;
+    }
+}
+
+template <typename Visit>
+void ForEachChild(const Expression* node, Visit&& visit) {
+    switch (node->type) {
+    case Expression::Type::IDENT:
+    case Expression::Type::INT:
+    case Expression::Type::BIG_INT:
+    case Expression::Type::FLOAT:
+    case Expression::Type::STRING:
+    case Expression::Type::BOOLEAN:
+    case Expression::Type::STRUCT:
+        break;
+    case Expression::Type::PREFIX:
+        visit(static_cast<const Expression*>(static_cast<const PrefixExpression*>(node)->right));
+        break;
+    case Expression::Type::INFIX: {
+        const InfixExpression* infix = static_cast<const InfixExpression*>(node);
+        visit(static_cast<const Expression*>(infix->left));
+        visit(static_cast<const Expression*>(infix->right));
+        break;
+    }
+    case Expression::Type::BLOCK:
+        for (const Statement* statement : static_cast<const BlockExpression*>(node)->statements) {
+            visit(statement);
+        }
+        break;
+    case Expression::Type::IF_ELSE: {
+        const IfElseExpression* if_else = static_cast<const IfElseExpression*>(node);
+        visit(static_cast<const Expression*>(if_else->condition));
+        visit(static_cast<const Expression*>(if_else->consequence));
+        if (if_else->alternative != nullptr) {
+            visit(static_cast<const Expression*>(if_else->alternative));
+        }
+        break;
+    }
+    case Expression::Type::FUNCTION:
+        visit(static_cast<const Expression*>(static_cast<const FunctionExpression*>(node)->body));
+        break;
+    case Expression::Type::CALL: {
+        const CallExpression* call = static_cast<const CallExpression*>(node);
+        visit(static_cast<const Expression*>(call->function));
+        for (const Expression* argument : call->arguments) {
+            visit(argument);
+        }
+        break;
+    }
+    case Expression::Type::FIELD:
+        visit(static_cast<const Expression*>(static_cast<const FieldExpression*>(node)->object));
+        break;
+    case Expression::Type::ASSIGN:
+        visit(static_cast<const Expression*>(static_cast<const AssignExpression*>(node)->value));
+        break;
+    case Expression::Type::WHILE: {
+        const WhileExpression* loop = static_cast<const WhileExpression*>(node);
+        visit(static_cast<const Expression*>(loop->condition));
+        visit(static_cast<const Expression*>(loop->body));
+        break;
+    }
+    case Expression::Type::FOR: {
+        const ForExpression* loop = static_cast<const ForExpression*>(node);
+        if (loop->initializer != nullptr) {
+            visit(static_cast<const Statement*>(loop->initializer));
+        }
+        visit(static_cast<const Expression*>(loop->condition));
+        visit(static_cast<const Expression*>(loop->update));
+        visit(static_cast<const Expression*>(loop->body));
+        break;
+    }
+    case Expression::Type::MAP:
+        for (const auto& [key, value] : static_cast<const MapExpression*>(node)->entries) {
+            visit(static_cast<const Expression*>(key));
+            visit(static_cast<const Expression*>(value));
+        }
+        break;
+    }
+}
+
+// The names the lets of a function body bind, wherever they are in it but not in
+// nested function literals, which bind their own. Interned, in order.
+void CollectLets(const Expression* node, std::vector<const std::string*>& names);
@@ -0,0 +1,114 @@
+#pragma once
+
+// Batch evaluation: calls one function over columns of int64 arguments, evaluating
+// its body once per chunk of rows instead of once per row.
+
+#include "ast.h"
+#include "evaluator.h"
+#include "object.h"
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Functions made of integer and boolean arithmetic, comparisons, lets, if/else and
+// returns are evaluated column-wise: every value is a column of int64 for the rows of
+// a chunk, if/else runs both branches under 0/1 masks and blends the results, so the
+// operations compile down to branch-free loops. Anything else (calls, closures,
+// bignums) falls back to calling the function once per row, either for the whole
+// batch when the body uses unsupported constructs, or for a single chunk when one of
+// its active rows overflows or divides by zero.
+//
+// The vectorized path neither allocates nor loops, so only the per-row fallback is
+// charged to the evaluator's limits.
+class BatchEvaluator {
+public:
+    static constexpr size_t CHUNK_SIZE = 1024;
+
+    BatchEvaluator(Evaluator& evaluator) : _evaluator(evaluator) {}
+
+    // arguments holds one column per parameter, all of the same length. Results are
+    // one per row, booleans as 0 or 1. Returns nil on success, otherwise the Error of
+    // the first row that failed.
+    ObjectPtr Run(const ObjectPtr& function,
+                  const std::vector<std::vector<int64_t>>& arguments,
+                  std::vector<int64_t>& results);
+
+    // whether the last Run evaluated the function column-wise
+    bool IsVectorized() const { return _vectorized; }
+
+private:
+    // static type of a column, MIXED for branches of different types whose value
+    // must not be used
+    enum Kind {
+        UNSUPPORTED,
+        INT,
+        BOOL,
+        NIL,
+        NEVER,
+        MIXED,
+    };
+
+    // identifiers resolve either to a slot of the frame or to a closed over constant
+    struct Reference {
+        bool constant;
+        size_t slot;
+        int64_t value;
+    };
+
+    Evaluator& _evaluator;
+    bool _vectorized = false;
+
+    // filled by the checker
+    const Function* _function = nullptr;
+    std::unordered_map<std::string, size_t> _names;
+    std::unordered_set<std::string> _poisoned;
+    std::vector<Kind> _kinds;
+    std::unordered_map<const Identifier*, Reference> _references;
+    std::unordered_map<const LetStatement*, size_t> _lets;
+    std::unordered_set<const Statement*> _returning;
+    Kind _returned_kind = NEVER;
+
+    Kind Check(const Function* function);
+    Kind CheckStatement(const Statement* node);
+    Kind CheckExpression(const Expression* node);
+    Kind CheckBlock(const BlockExpression* node);
+    Kind CheckIdentifier(const Identifier* node);
+    Kind CheckInfix(const InfixExpression* node);
+    Kind CheckIfElse(const IfElseExpression* node);
+    static Kind Combine(Kind left, Kind right);
+    static bool IsValue(Kind kind) { return kind == INT || kind == BOOL; }
+
+    // per chunk state, columns are handed out from buffers reused across chunks
+    size_t _count = 0;
+    std::vector<std::unique_ptr<int64_t[]>> _buffers;
+    size_t _used = 0;
+    std::vector<const int64_t*> _slots;
+    const int64_t* _zeros = nullptr;
+    int64_t* _result = nullptr;
+    int64_t* _returned = nullptr;
+    // set when an active row needs the exact semantics of a per-row call
+    bool _fallback = false;
+
+    int64_t* Allocate();
+    bool RunChunk(const std::vector<std::vector<int64_t>>& arguments,
+                  size_t offset,
+                  int64_t* results);
+    const int64_t* EvalStatement(const Statement* node, const int64_t* active);
+    const int64_t* EvalExpression(const Expression* node, const int64_t* active);
+    const int64_t* EvalBlock(const BlockExpression* node, const int64_t* active);
+    const int64_t* EvalPrefix(const PrefixExpression* node, const int64_t* active);
+    const int64_t* EvalInfix(const InfixExpression* node, const int64_t* active);
+    const int64_t* EvalIfElse(const IfElseExpression* node, const int64_t* active);
+    int64_t* Fill(int64_t value);
+    const int64_t* Select(const int64_t* mask, const int64_t* left, const int64_t* right);
+    bool Any(const int64_t* mask) const;
+
+    ObjectPtr CallRows(const std::vector<std::vector<int64_t>>& arguments,
+                       const ObjectPtr& function,
+                       size_t begin,
+                       size_t end,
+                       std::vector<int64_t>& results);
+};
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <ostream>
+
+// Arbitrary precision signed integer, stored as sign and magnitude in 32-bit limbs
+// (least significant first, no leading zero limbs). Multiplication switches from
+// schoolbook to Karatsuba once both operands are large.
+class BigInt {
+public:
+    BigInt() = default;
+    BigInt(int64_t value);
+    // digits must be a nonempty run of decimal digits, without a sign
+    static BigInt FromDecimal(const std::string& digits);
+
+    bool IsZero() const { return _limbs.empty(); }
+    bool IsNegative() const { return _negative; }
+    bool FitsInt64() const;
+    int64_t ToInt64() const;
+
+    int Compare(const BigInt& other) const;
+    // equal values hash alike, not mixed any further
+    uint64_t Hash() const;
+    std::string ToString() const;
+
+    BigInt operator-() const;
+
+    friend BigInt operator+(const BigInt& left, const BigInt& right);
+    friend BigInt operator-(const BigInt& left, const BigInt& right);
+    friend BigInt operator*(const BigInt& left, const BigInt& right);
+    // truncates towards zero like the builtin integer division, right must be nonzero
+    friend BigInt operator/(const BigInt& left, const BigInt& right);
+
+    friend std::ostream& operator<<(std::ostream& stream, const BigInt& value);
+
+private:
+    bool _negative = false;
+    std::vector<uint32_t> _limbs;
+};
@@ -0,0 +1,27 @@
+#pragma once
+
+// Functions available to every program without being bound by the host.
+
+#include "environment.h"
+
+class Evaluator;
+
+// range(start, end), take(iterator, n), sum(iterator or array) and fold(iterator,
+// initial, f).
+// Ranges and take are lazy, sum and fold pull one value at a time, so a pipeline over
+// any number of values runs in constant memory.
+//
+// get(map, key), set(map, key, value), has(map, key), len(map or string) and
+// keys(map), an iterator over the keys in insertion order.
+//
+// floats(iterator) collects numbers into an array of floats, which get(array, index)
+// and len(array) read. sqrt(x), exp(x), log(x), floor(x) and pow(x, y) take numbers
+// and return floats, or apply to each element of array arguments, see ApplyMath.
+//
+// read_file_async(path) and write_file_async(path, contents) start the operation and
+// return a future right away, await(future) waits for its result, see IoLoop.
+void InstallBuiltins(Evaluator& evaluator, Environment& environment);
+
+// Whether builtin is one of the above that neither does I/O nor changes its arguments,
+// which rules out set and the ones that pull from an iterator.
+bool IsPureBuiltin(const Builtin& builtin);
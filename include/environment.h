@@ -1,23 +1,62 @@
 #pragma once
 
+#include "heap.h"
 #include "object.h"
 #include <memory>
 #include <unordered_map>
+#include <vector>
 #include <ostream>
 
 struct Object;
 
+// A named slot of a call frame, stored contiguously on the evaluator's frame stack.
+struct Binding {
+    const std::string* name;
+    std::shared_ptr<Object> value;
+};
+
+using FrameStack = std::vector<Binding>;
+
 struct Environment {
     Environment() = default;
     Environment(const Environment&) = default;
     Environment(std::shared_ptr<Environment> outer) : outer(outer) {}
 
+    // Call frame whose slots are the bindings [base, end) of the frame stack. Frames
+    // only ever live on the C++ stack; Capture() promotes one to the heap.
+    Environment(std::shared_ptr<Environment> outer, FrameStack* stack, size_t base)
+        : outer(outer), stack(stack), base(base), end(stack->size()) {}
+
     std::shared_ptr<Object> Get(const std::string& name) const;
     void Set(const std::string& name, std::shared_ptr<Object> value);
     void Remove(const std::string& name);
+    // Rebinds the nearest existing binding, false if there is none. Closures hold a
+    // copy of what they capture, which is why the parser only lets a function assign
+    // names it binds itself.
+    bool Assign(const std::string& name, std::shared_ptr<Object> value);
+
+    // Heap copy of the bindings of names in this environment that shares its outer
+    // chain, used for closures. A self binding further out that names refers to is
+    // copied as well, so the closure keeps that function alive.
+    std::shared_ptr<Environment> Capture(Heap& heap,
+                                         const std::vector<const std::string*>& names) const;
+
+    // Binds the function a let binds to name in the environment it closes over. The
+    // binding is weak, the function owns the environment and would otherwise never be
+    // freed. Rebinding name turns it into an ordinary binding. name must be interned,
+    // like the name of the let.
+    void SetSelf(const std::string& name, const std::shared_ptr<Object>& function);
 
     std::shared_ptr<Environment> outer = nullptr;
     std::unordered_map<std::string, std::shared_ptr<Object>> store;
 
+    // interned, nullptr without a self binding
+    const std::string* self_name = nullptr;
+    std::weak_ptr<Object> self;
+
+    FrameStack* stack = nullptr;
+    size_t base = 0;
+    size_t end = 0;
+
     friend std::ostream& operator<<(std::ostream& stream, const Environment& environment);
 };
@@ -2,38 +2,250 @@
 
 #include "ast.h"
 #include "environment.h"
+#include "heap.h"
+#include "io.h"
 #include "object.h"
+#include "profiler.h"
+#include "trace.h"
 
+#include <chrono>
 #include <memory>
 #include <unordered_map>
 
 using ObjectPtr = std::shared_ptr<Object>;
 using EnvironmentPtr = std::shared_ptr<Environment>;
 
+class ForkJoinPool;
+struct ForkedCall;
+
+// an integer of any size or a float
+bool IsNumber(const ObjectPtr& object);
+// the nearest double to a number, integers beyond 2^53 lose their low bits
+double ToDouble(const ObjectPtr& object);
+
+// Budget for a single call to Evaluator::Evaluate, zero means unlimited. Exceeding a
+// limit makes the evaluation result in an Error.
+struct Limits {
+    // calls plus statements executed in blocks
+    uint64_t steps = 0;
+    // live objects and bytes allocated by this evaluator
+    size_t objects = 0;
+    size_t bytes = 0;
+    std::chrono::milliseconds time{0};
+    // native stack used by nested calls, guards against runaway recursion
+    size_t stack = 6 << 20;
+};
+
+// Globals a top-level statement used, see Evaluator::EvaluateStatement. Names are
+// interned and listed once each in the order first seen.
+struct Dependencies {
+    // read before the statement bound them itself, including names that were not
+    // found and the names a closure created by the statement captured
+    std::vector<const std::string*> reads;
+    // bound by a let or assigned
+    std::vector<const std::string*> writes;
+
+    void Read(const std::string* name);
+    void Write(const std::string* name);
+};
+
 class Evaluator {
 public:
-    Evaluator() = default;
+    Evaluator();
+    Evaluator(const Evaluator&) = delete;
+    Evaluator& operator=(const Evaluator&) = delete;
 
     ObjectPtr Evaluate(const Program& node, EnvironmentPtr environment);
 
+    // Evaluates just the top-level statement of program at index, recording the
+    // globals of environment it reads and binds. Limits apply to each statement on its
+    // own.
+    ObjectPtr EvaluateStatement(const Program& program,
+                                size_t index,
+                                Environment& environment,
+                                Dependencies& dependencies);
+
+    // Calls a function or builtin with already evaluated arguments, either from the
+    // host or from inside a builtin.
+    ObjectPtr Call(const ObjectPtr& function, const ObjectPtr* arguments, size_t count);
+
+    // Pulls the next value of an iterator, nullptr once it is exhausted. An error
+    // raised by a generator's body is returned and ends the generator. Only for
+    // builtins, each value is charged a step.
+    ObjectPtr Next(const ObjectPtr& iterator);
+
+    void SetLimits(const Limits& limits) { _limits = limits; }
+    const Limits& GetLimits() const { return _limits; }
+    const Heap& GetHeap() const { return _heap; }
+    // started on first use, evaluators that never do I/O have no ring or threads
+    IoLoop& GetIo();
+    // maintains the profiler's shadow stack while set, the profiler must sample the
+    // thread this evaluator runs on
+    void SetProfiler(Profiler* profiler) { _profiler = profiler; }
+    // While set, the two calls of an infix expression run in parallel on the pool when
+    // both call pure functions with arguments that are free of calls, see IsPure.
+    // Steps, objects and memory are counted per evaluator, so nothing is forked while
+    // any limit but the stack is set. queue is this evaluator's queue of the pool.
+    void SetPool(ForkJoinPool* pool, size_t queue = 0) {
+        _pool = pool;
+        _queue = queue;
+    }
+    // Runs a call forked by another evaluator and copies out its result.
+    void RunForked(ForkedCall& call);
+
+    // Object construction for native functions, charged to this evaluator's heap
+    template <typename T, typename... Args>
+    std::shared_ptr<T> New(Args&&... args) {
+        return std::allocate_shared<T>(HeapAllocator<T>(&_heap, TypeOf<T>()),
+                                       std::forward<Args>(args)...);
+    }
+
+    ObjectPtr NewInteger(int64_t value);
+    ObjectPtr NewInteger(BigInt value);
+    // an error for NaN and the infinities, which no literal could read back
+    ObjectPtr NewFloat(double value);
+    // array itself if all its values are finite, the error NewFloat gives if not
+    ObjectPtr Finite(std::shared_ptr<FloatArray> array);
+    // fields start out empty and must all be set before the instance is used, arena
+    // owns the shape
+    std::shared_ptr<Instance> NewInstance(const Shape* shape, std::shared_ptr<AstArena> arena);
+    std::shared_ptr<Map> NewMap() { return New<Map>(&_heap); }
+    std::shared_ptr<FloatArray> NewArray() { return New<FloatArray>(&_heap); }
+    // empty heap environment, as a closure would capture
+    EnvironmentPtr NewEnvironment();
+    ObjectPtr NewBoolean(bool value) const { return value ? _true : _false; }
+    ObjectPtr GetNil() const { return _nil; }
+
+    // most arguments a builtin can be called with
+    static constexpr size_t MAX_NATIVE_ARGUMENTS = 8;
+
 private:
-    ObjectPtr EvalStatement(Statement const* node, EnvironmentPtr environment);
-    ObjectPtr EvalExpression(Expression const* node, EnvironmentPtr environment);
-    ObjectPtr EvalLet(LetStatement const* node, EnvironmentPtr environment);
-    ObjectPtr EvalReturn(ReturnStatement const* node, EnvironmentPtr environment);
+    // first member so it outlives everything the evaluator itself still holds
+    Heap _heap;
+    Limits _limits;
+
+    // Per evaluator constants, sharing them between isolates would make every thread
+    // contend on the same reference counts. Small integers are preallocated for the
+    // values that counters and literals hit most.
+    static constexpr int64_t SMALL_INT_MIN = -128;
+    static constexpr int64_t SMALL_INT_MAX = 1023;
+
+    ObjectPtr _true;
+    ObjectPtr _false;
+    ObjectPtr _nil;
+    std::vector<ObjectPtr> _small_ints;
+
+    std::unique_ptr<IoLoop> _io;
+    Profiler* _profiler = nullptr;
+
+    ForkJoinPool* _pool = nullptr;
+    size_t _queue = 0;
+    // forks the evaluation currently running is nested in
+    size_t _fork_depth = 0;
+
+    // Owner of the nodes being evaluated, that of the program or of the function or
+    // generator running, which the functions and struct types created from them share.
+    const std::shared_ptr<AstArena>* _arena = nullptr;
+
+    // Out-of-band control flow. A return statement sets the signal next to its value
+    // instead of wrapping it, enclosing blocks stop as soon as it is set and the
+    // call that owns the block clears it again.
+    enum Signal {
+        NONE,
+        RETURN,
+    };
+
+    Signal _signal = Signal::NONE;
+
+    // Arguments and locals of active calls. Reserved up front and never reallocated,
+    // so frames can refer to their slots by index and a call costs a pointer bump.
+    static constexpr size_t FRAME_STACK_SIZE = 1 << 16;
+
+    FrameStack _stack;
+
+    // set by EvaluateStatement, the globals being tracked and what was used of them
+    Environment* _tracked = nullptr;
+    Dependencies* _dependencies = nullptr;
+
+    void TrackRead(const std::string& name, const Environment& environment) {
+        if (&environment == _tracked) {
+            _dependencies->Read(&name);
+        }
+    }
+    void TrackWrite(const std::string& name, const Environment& environment) {
+        if (&environment == _tracked) {
+            _dependencies->Write(&name);
+        }
+    }
+
+    bool IsAbrupt(const ObjectPtr& result) const {
+        return _signal != Signal::NONE || result->type == Object::Type::ERROR;
+    }
+
+    // Steps are charged by counting _fuel down, the limits themselves are only looked
+    // at when it runs out, at least every CHECK_INTERVAL steps.
+    static constexpr uint64_t CHECK_INTERVAL = 1024;
+
+    uint64_t _fuel = 0;
+    uint64_t _batch = 0;
+    uint64_t _steps = 0;
+    std::chrono::steady_clock::time_point _deadline;
+    const char* _stack_base = nullptr;
+    ObjectPtr _exhausted;
+    bool _running = false;
+
+    // resets the budgets when entering from the host
+    void Start(const char* stack_base);
+
+    bool Step() { return _fuel-- != 0 || Refuel(); }
+    bool Refuel();
+
+    ObjectPtr EvalStatement(Statement const* node, Environment& environment);
+    ObjectPtr EvalExpression(Expression const* node, Environment& environment);
+    ObjectPtr EvalLet(LetStatement const* node, Environment& environment);
+    ObjectPtr EvalReturn(ReturnStatement const* node, Environment& environment);
     ObjectPtr EvalExpressionStatement(ExpressionStatement const* node,
-                                      EnvironmentPtr environment);
+                                      Environment& environment);
     ObjectPtr EvalIntLiteral(IntegerLiteral const* node);
     ObjectPtr EvalBoolLiteral(BooleanLiteral const* node);
-    ObjectPtr EvalIdentifier(Identifier const* node, EnvironmentPtr environment);
-    ObjectPtr EvalPrefix(PrefixExpression const* node, EnvironmentPtr environment);
-    ObjectPtr EvalInfix(InfixExpression const* node, EnvironmentPtr environment);
-    ObjectPtr
-    EvalIntInfix(ObjectPtr left, ObjectPtr right, InfixExpression::Operation op);
+    ObjectPtr EvalIdentifier(Identifier const* node, Environment& environment);
+    ObjectPtr EvalPrefix(PrefixExpression const* node, Environment& environment);
+    ObjectPtr EvalInfix(InfixExpression const* node, Environment& environment);
+    ObjectPtr Fork(InfixExpression const* node, Environment& environment);
+    ObjectPtr Forkable(CallExpression const* node, Environment& environment);
+    ObjectPtr RunHere(ForkedCall& call);
+    ObjectPtr Joined(ForkedCall& call);
+    void Join(ForkedCall& call);
+    ObjectPtr EvalInfixValues(const ObjectPtr& left,
+                              const ObjectPtr& right,
+                              InfixExpression::Operation op);
+    ObjectPtr EvalIntInfix(int64_t left, int64_t right, InfixExpression::Operation op);
+    ObjectPtr EvalBigIntInfix(const BigInt& left,
+                              const BigInt& right,
+                              InfixExpression::Operation op);
     ObjectPtr
     EvalBoolInfix(ObjectPtr left, ObjectPtr right, InfixExpression::Operation op);
-    ObjectPtr EvalBlock(BlockExpression const* node, EnvironmentPtr environment);
-    ObjectPtr EvalIfElse(IfElseExpression const* node, EnvironmentPtr environment);
-    ObjectPtr EvalFunction(FunctionExpression const* node, EnvironmentPtr environment);
-    ObjectPtr EvalCall(CallExpression const* node, EnvironmentPtr environment);
+    ObjectPtr EvalFloatInfix(double left, double right, InfixExpression::Operation op);
+    ObjectPtr EvalBlock(BlockExpression const* node, Environment& environment);
+    ObjectPtr EvalIfElse(IfElseExpression const* node, Environment& environment);
+    ObjectPtr EvalFunction(FunctionExpression const* node, Environment& environment);
+    ObjectPtr EvalField(FieldExpression const* node, Environment& environment);
+    ObjectPtr EvalAssign(AssignExpression const* node, Environment& environment);
+    ObjectPtr EvalWhile(WhileExpression const* node, Environment& environment);
+    ObjectPtr EvalFor(ForExpression const* node, Environment& environment);
+    ObjectPtr EvalMap(MapExpression const* node, Environment& environment);
+    ObjectPtr EvalCall(CallExpression const* node, Environment& environment);
+    ObjectPtr CallFunction(Function* function,
+                           const std::vector<Expression*>& arguments,
+                           Environment& environment);
+    ObjectPtr Invoke(const ObjectPtr& function, const ObjectPtr* arguments, size_t count);
+    ObjectPtr CheckCall(size_t count);
+    ObjectPtr EnterFrame(Function* function, size_t base);
+    ObjectPtr Resume(Generator* generator);
+    ObjectPtr CallBuiltin(Builtin* builtin,
+                          const std::vector<Expression*>& arguments,
+                          Environment& environment);
+    ObjectPtr Construct(StructType* type,
+                        const std::vector<Expression*>& arguments,
+                        Environment& environment);
 };
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+// Allocations of one kind over the lifetime of a heap
+struct AllocationStats {
+    uint64_t allocations = 0;
+    uint64_t frees = 0;
+    // held by live allocations, and the most that ever was
+    size_t bytes = 0;
+    size_t peak_bytes = 0;
+
+    uint64_t Live() const { return allocations - frees; }
+};
+
+// Running totals of the objects an evaluator currently keeps alive. Everything that
+// is allocated through a HeapAllocator must be released before its Heap goes away.
+struct Heap {
+    // Allocations are also counted by kind. Objects are counted under their
+    // Object::Type, the kinds that are not objects come last.
+    static constexpr size_t KINDS = 24;
+    static constexpr size_t ARRAY_STORAGE = KINDS - 3;
+    static constexpr size_t ENVIRONMENT = KINDS - 2;
+    static constexpr size_t MAP_STORAGE = KINDS - 1;
+
+    size_t objects = 0;
+    size_t bytes = 0;
+    size_t peak_bytes = 0;
+
+    AllocationStats kinds[KINDS];
+};
+
+// Allocator for std::allocate_shared that charges the object and its control block
+// to a Heap.
+template <typename T>
+struct HeapAllocator {
+    using value_type = T;
+
+    HeapAllocator(Heap* heap, size_t kind) : heap(heap), kind(kind) {}
+
+    template <typename U>
+    HeapAllocator(const HeapAllocator<U>& other) : heap(other.heap), kind(other.kind) {}
+
+    T* allocate(size_t count) {
+        size_t size = count * sizeof(T);
+        heap->objects++;
+        heap->bytes += size;
+        heap->peak_bytes = std::max(heap->peak_bytes, heap->bytes);
+
+        AllocationStats& stats = heap->kinds[kind];
+        stats.allocations++;
+        stats.bytes += size;
+        stats.peak_bytes = std::max(stats.peak_bytes, stats.bytes);
+
+        return static_cast<T*>(::operator new(size));
+    }
+
+    void deallocate(T* pointer, size_t count) {
+        size_t size = count * sizeof(T);
+        heap->objects--;
+        heap->bytes -= size;
+
+        AllocationStats& stats = heap->kinds[kind];
+        stats.frees++;
+        stats.bytes -= size;
+
+        ::operator delete(pointer);
+    }
+
+    template <typename U>
+    bool operator==(const HeapAllocator<U>& other) const {
+        return heap == other.heap && kind == other.kind;
+    }
+
+    template <typename U>
+    bool operator!=(const HeapAllocator<U>& other) const {
+        return heap != other.heap || kind != other.kind;
+    }
+
+    Heap* heap;
+    size_t kind;
+};
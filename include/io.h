@@ -0,0 +1,101 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// One asynchronous whole-file read or write, shared between the script's handle and
+// the backend carrying it out. Only safe to look at once IoLoop::Wait returned.
+struct IoRequest {
+    enum Kind {
+        READ,
+        WRITE,
+    };
+
+    IoRequest(Kind kind, std::string path, std::string data = "")
+        : kind(kind), path(std::move(path)), data(std::move(data)) {}
+
+    Kind kind;
+    std::string path;
+    // contents read, or to be written
+    std::string data;
+    // errno of the step that failed, 0 on success
+    int error = 0;
+    bool done = false;
+
+    // progress, owned by the backend
+    int fd = -1;
+    size_t offset = 0;
+    // known size of a regular file being read, 0 reads until end of file
+    size_t size = 0;
+};
+
+// Carries out file I/O for one evaluator without blocking it. Requests go to an
+// io_uring when the kernel has one, otherwise to a few threads doing blocking reads
+// and writes. Either way any number of requests are in flight at once and the
+// evaluator only waits when it needs a result that is not complete yet.
+class IoLoop {
+public:
+    // without use_ring the thread pool is used even if io_uring is available
+    IoLoop(bool use_ring = true);
+    ~IoLoop();
+    IoLoop(const IoLoop&) = delete;
+    IoLoop& operator=(const IoLoop&) = delete;
+
+    void Submit(std::shared_ptr<IoRequest> request);
+    // blocks until request is done
+    void Wait(IoRequest& request);
+
+    bool UsesRing() const { return _ring_fd >= 0; }
+
+private:
+    // threads of the fallback, they mostly sit in system calls
+    static constexpr size_t WORKERS = 8;
+    static constexpr unsigned RING_ENTRIES = 64;
+
+    // io_uring, single threaded: only the evaluator's thread touches the ring
+    bool SetupRing();
+    void Queue(IoRequest* request);
+    void Reap(bool wait);
+    void Complete(IoRequest* request, int32_t result);
+    void Finish(IoRequest* request, int error);
+
+    int _ring_fd = -1;
+    void* _ring = nullptr;
+    size_t _ring_size = 0;
+    void* _cq_ring = nullptr;
+    size_t _cq_ring_size = 0;
+    void* _sqes = nullptr;
+    size_t _sqes_size = 0;
+
+    unsigned* _sq_head = nullptr;
+    unsigned* _sq_tail = nullptr;
+    unsigned _sq_mask = 0;
+    unsigned* _sq_array = nullptr;
+    unsigned* _cq_head = nullptr;
+    unsigned* _cq_tail = nullptr;
+    unsigned _cq_mask = 0;
+    unsigned _cq_entries = 0;
+    void* _cqes = nullptr;
+    // operations submitted whose completion was not reaped yet
+    unsigned _submitted = 0;
+
+    // requests the kernel may still write into, by their address
+    std::unordered_map<uint64_t, std::shared_ptr<IoRequest>> _in_flight;
+
+    // thread pool
+    void Work();
+
+    std::vector<std::thread> _workers;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _done;
+    std::deque<std::shared_ptr<IoRequest>> _queue;
+    bool _stopping = false;
+};
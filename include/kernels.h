@@ -0,0 +1,28 @@
+#pragma once
+
+// Elementwise math over packed doubles, behind the math builtins.
+
+#include <cstddef>
+
+enum class MathFunction {
+    SQRT,
+    EXP,
+    LOG,
+    FLOOR,
+};
+
+// out[i] = function(in[i]) for every i below count, out may be in. sqrt and floor are
+// exact, so they run on AVX or SSE2 vectors as the CPU allows and give the same
+// results as one element at a time. exp and log have no such instructions and call
+// libm per element, an approximating vector kernel would not match the scalar
+// builtins bit for bit.
+void ApplyMath(MathFunction function, const double* in, double* out, size_t count);
+
+// out[i] = pow(base[i * base_step], exponent[i * exponent_step]), a step of 0 repeats
+// a single value for every element.
+void ApplyPow(const double* base,
+              size_t base_step,
+              const double* exponent,
+              size_t exponent_step,
+              double* out,
+              size_t count);
@@ -5,21 +5,35 @@
 
 #include "token.h"
 
+enum class CharClass;
+struct CharRun;
+
 class Lexer {
 public:
     Lexer(const std::string& input);
 
     Token NextToken();
 
+    // time spent in NextToken and tokens returned, only measured while tracing
+    uint64_t GetTracedTime() const { return _traced_time; }
+    uint64_t GetTracedTokens() const { return _traced_tokens; }
+
 private:
+    Token Scan();
+
     void Advance();
     char Peek();
 
     Token CreateToken(Token::Type type, std::string literal);
 
+    // the run of type starting at the current character, and moving past it
+    CharRun ScanRun(CharClass type) const;
+    void Skip(const CharRun& run);
+
     void SkipWhitespace();
     Token ReadIdentifier();
     Token ReadNumber();
+    Token ReadString();
 
     std::string _input;
     uint _position;
@@ -28,9 +42,12 @@ private:
 
     uint _line;
     uint _column;
+
+    uint64_t _traced_time = 0;
+    uint64_t _traced_tokens = 0;
 };
 
-inline std::unordered_map<std::string, Token::Type> keywords = {
+inline const std::unordered_map<std::string, Token::Type> keywords = {
     {"fn", Token::Type::FUNCTION},
     {"let", Token::Type::LET},
     {"if", Token::Type::IF},
@@ -40,5 +57,11 @@ inline std::unordered_map<std::string, Token::Type> keywords = {
     {"false", Token::Type::FALSE},
     {"or", Token::Type::OR},
     {"and", Token::Type::AND},
+    {"struct", Token::Type::STRUCT},
+    {"while", Token::Type::WHILE},
+    {"for", Token::Type::FOR},
+    {"yield", Token::Type::YIELD},
 };
 
+// longest of the keywords above
+inline constexpr size_t MAX_KEYWORD_LENGTH = 6;
@@ -0,0 +1,120 @@
+#pragma once
+
+#include "evaluator.h"
+#include "object.h"
+
+#include <cstdint>
+#include <limits>
+#include <sstream>
+#include <type_traits>
+#include <utility>
+
+// Conversion between C++ values and objects, specialized per supported type.
+template <typename T>
+struct Convert;
+
+template <>
+struct Convert<int64_t> {
+    static constexpr Object::Type type = Object::Type::INT;
+
+    static bool Is(const ObjectPtr& object) { return object->type == type; }
+    static int64_t FromObject(const ObjectPtr& object) {
+        return static_cast<Integer*>(object.get())->value;
+    }
+    static ObjectPtr ToObject(Evaluator& evaluator, int64_t value) {
+        return evaluator.NewInteger(value);
+    }
+};
+
+// only integers in range of an int, anything else is a mismatch rather than wrapping
+template <>
+struct Convert<int> : Convert<int64_t> {
+    static bool Is(const ObjectPtr& object) {
+        if (object->type != type) {
+            return false;
+        }
+        int64_t value = static_cast<Integer*>(object.get())->value;
+        return value >= std::numeric_limits<int>::min() &&
+               value <= std::numeric_limits<int>::max();
+    }
+    static int FromObject(const ObjectPtr& object) {
+        return static_cast<int>(static_cast<Integer*>(object.get())->value);
+    }
+};
+
+template <>
+struct Convert<bool> {
+    static constexpr Object::Type type = Object::Type::BOOL;
+
+    static bool Is(const ObjectPtr& object) { return object->type == type; }
+    static bool FromObject(const ObjectPtr& object) {
+        return static_cast<Boolean*>(object.get())->value;
+    }
+    static ObjectPtr ToObject(Evaluator& evaluator, bool value) {
+        return evaluator.NewBoolean(value);
+    }
+};
+
+// passes objects through untouched, for natives that inspect types themselves
+template <>
+struct Convert<ObjectPtr> {
+    static constexpr Object::Type type = Object::Type::NIL;
+
+    static bool Is(const ObjectPtr&) { return true; }
+    static ObjectPtr FromObject(const ObjectPtr& object) { return object; }
+    static ObjectPtr ToObject(Evaluator&, ObjectPtr value) { return value; }
+};
+
+// Adapts a plain C++ function to a NativeFunction. Argument and return conversions
+// are resolved at compile time, so a call costs the type checks plus the call itself.
+template <auto F>
+struct Native;
+
+template <typename R, typename... Args, R (*F)(Args...)>
+struct Native<F> {
+    static_assert(sizeof...(Args) <= Evaluator::MAX_NATIVE_ARGUMENTS,
+                  "too many arguments for a native function");
+
+    static constexpr size_t arity = sizeof...(Args);
+
+    static ObjectPtr Call(Evaluator& evaluator, const ObjectPtr* arguments, size_t) {
+        return Invoke(evaluator, arguments, std::index_sequence_for<Args...>{});
+    }
+
+private:
+    template <typename T>
+    using Converter = Convert<std::remove_cv_t<std::remove_reference_t<T>>>;
+
+    template <size_t... I>
+    static ObjectPtr
+    Invoke(Evaluator& evaluator, const ObjectPtr* arguments, std::index_sequence<I...>) {
+        if constexpr (sizeof...(Args) > 0) {
+            size_t mismatch = 0;
+            ((mismatch == 0 && !Converter<Args>::Is(arguments[I]) ? mismatch = I + 1 : 0),
+             ...);
+            if (mismatch != 0) {
+                static constexpr Object::Type expected[] = {Converter<Args>::type...};
+                const ObjectPtr& argument = arguments[mismatch - 1];
+                std::stringstream stream;
+                stream << "argument " << mismatch;
+                if (argument->type == expected[mismatch - 1]) {
+                    stream << " is out of range";
+                } else {
+                    stream << " has type " << argument->type << ", expected "
+                           << expected[mismatch - 1];
+                }
+                return evaluator.New<Error>(stream.str());
+            }
+        } else {
+            (void)arguments;
+        }
+
+        if constexpr (std::is_void_v<R>) {
+            F(Converter<Args>::FromObject(arguments[I])...);
+            return evaluator.GetNil();
+        } else {
+            return Convert<R>::ToObject(evaluator,
+                                        F(Converter<Args>::FromObject(arguments[I])...));
+        }
+    }
+};
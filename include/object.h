@@ -1,20 +1,35 @@
 #pragma once
 
 #include "ast.h"
+#include "bigint.h"
 #include "environment.h"
+#include "table.h"
 
+#include <atomic>
 #include <memory>
+#include <type_traits>
 
 struct Environment;
+struct IoRequest;
+class Evaluator;
 
 struct Object {
     enum Type {
         INT,
+        BIG_INT,
         BOOL,
+        STRING,
         NIL,
-        RETURN,
         FUNCTION,
+        BUILTIN,
+        STRUCT,
+        INSTANCE,
+        ITERATOR,
+        MAP,
+        FUTURE,
         ERROR,
+        FLOAT,
+        ARRAY,
     };
 
     Type type;
@@ -29,9 +44,29 @@ protected:
 };
 
 struct Integer : Object {
-    Integer(int value) : Object(Type::INT), value(value) {}
+    Integer(int64_t value) : Object(Type::INT), value(value) {}
 
-    int value;
+    int64_t value;
+
+protected:
+    virtual void Print(std::ostream& stream) const override;
+};
+
+// IEEE double. Arithmetic with an integer converts the integer.
+struct Float : Object {
+    Float(double value) : Object(Type::FLOAT), value(value) {}
+
+    double value;
+
+protected:
+    virtual void Print(std::ostream& stream) const override;
+};
+
+// Integer that no longer fits in 64 bits, arithmetic falls back to it on overflow
+struct BigInteger : Object {
+    BigInteger(BigInt value) : Object(Type::BIG_INT), value(std::move(value)) {}
+
+    BigInt value;
 
 protected:
     virtual void Print(std::ostream& stream) const override;
@@ -46,17 +81,17 @@ protected:
     virtual void Print(std::ostream& stream) const override;
 };
 
-struct Nil : Object {
-    Nil() : Object(Type::NIL) {}
+struct String : Object {
+    String(std::string value) : Object(Type::STRING), value(std::move(value)) {}
+
+    std::string value;
 
 protected:
     virtual void Print(std::ostream& stream) const override;
 };
 
-struct Return : Object {
-    Return(std::shared_ptr<Object> value) : Object(Type::RETURN), value(value) {}
-
-    std::shared_ptr<Object> value;
+struct Nil : Object {
+    Nil() : Object(Type::NIL) {}
 
 protected:
     virtual void Print(std::ostream& stream) const override;
@@ -65,13 +100,205 @@ protected:
 struct Function : Object {
     Function(std::vector<Identifier*> parameters,
              BlockExpression* body,
-             std::shared_ptr<Environment> environment)
+             std::shared_ptr<Environment> environment,
+             bool generator = false,
+             const FunctionExpression* definition = nullptr,
+             std::shared_ptr<AstArena> arena = nullptr)
         : Object(Type::FUNCTION), parameters(parameters), body(body),
-          environment(std::move(environment)) {}
+          environment(std::move(environment)), generator(generator),
+          definition(definition), arena(std::move(arena)) {}
 
     std::vector<Identifier*> parameters;
     BlockExpression* body;
     std::shared_ptr<Environment> environment;
+    bool generator;
+    // the literal it was created from, names the function in profiles
+    const FunctionExpression* definition;
+    // owns the nodes above, the program they came from is freed with its last function
+    std::shared_ptr<AstArena> arena;
+
+    // whether calls have no effect besides their result, see IsPure
+    enum Purity : uint8_t {
+        UNKNOWN,
+        PURE,
+        IMPURE,
+    };
+
+    mutable std::atomic<Purity> purity{Purity::UNKNOWN};
+
+protected:
+    virtual void Print(std::ostream& stream) const override;
+};
+
+// Native function, called with its already evaluated arguments
+using NativeFunction = std::shared_ptr<Object> (*)(Evaluator& evaluator,
+                                                   const std::shared_ptr<Object>* arguments,
+                                                   size_t count);
+
+struct Builtin : Object {
+    Builtin(std::string name, size_t arity, NativeFunction function)
+        : Object(Type::BUILTIN), name(std::move(name)), arity(arity), function(function) {}
+
+    std::string name;
+    size_t arity;
+    NativeFunction function;
+
+protected:
+    virtual void Print(std::ostream& stream) const override;
+};
+
+// Value of a struct declaration, calling it with one argument per field creates an
+// instance.
+struct StructType : Object {
+    StructType(const Shape* shape, std::shared_ptr<AstArena> arena)
+        : Object(Type::STRUCT), shape(shape), arena(std::move(arena)) {}
+
+    const Shape* shape;
+    // owns the declaration the shape belongs to
+    std::shared_ptr<AstArena> arena;
+
+protected:
+    virtual void Print(std::ostream& stream) const override;
+};
+
+// Struct instance whose fields are stored right behind the object, in the same
+// allocation, at the offsets given by its shape. Only created through
+// Evaluator::NewInstance, which reserves the room for them.
+struct Instance : Object {
+    Instance(const Shape* shape, std::shared_ptr<AstArena> arena)
+        : Object(Type::INSTANCE), shape(shape), arena(std::move(arena)) {
+        for (size_t i = 0; i < shape->fields.size(); i++) {
+            new (&Fields()[i]) std::shared_ptr<Object>();
+        }
+    }
+
+    ~Instance() {
+        for (size_t i = 0; i < shape->fields.size(); i++) {
+            Fields()[i].~shared_ptr();
+        }
+    }
+
+    std::shared_ptr<Object>* Fields() {
+        return reinterpret_cast<std::shared_ptr<Object>*>(this + 1);
+    }
+    const std::shared_ptr<Object>* Fields() const {
+        return reinterpret_cast<const std::shared_ptr<Object>*>(this + 1);
+    }
+
+    const Shape* shape;
+    // owns the declaration, instances can outlive their struct type
+    std::shared_ptr<AstArena> arena;
+
+protected:
+    virtual void Print(std::ostream& stream) const override;
+};
+
+// Lazy sequence that produces one value per Evaluator::Next. Iterators are single
+// pass, consuming one leaves it exhausted.
+struct Iterator : Object {
+    enum Kind {
+        RANGE,
+        GENERATOR,
+        TAKE,
+        KEYS,
+    };
+
+    Kind kind;
+
+protected:
+    Iterator(Kind kind) : Object(Type::ITERATOR), kind(kind) {}
+};
+
+// integers from next up to but excluding end
+struct Range : Iterator {
+    Range(int64_t next, int64_t end) : Iterator(Kind::RANGE), next(next), end(end) {}
+
+    int64_t next;
+    int64_t end;
+
+protected:
+    virtual void Print(std::ostream& stream) const override;
+};
+
+// Suspended call of a function that yields. Its locals live in a heap environment
+// and the position in the body is kept as a stack of the blocks, loops and
+// conditionals entered so far, so resuming continues right after the last yield
+// without any native stack of its own.
+struct Generator : Iterator {
+    struct Activation {
+        const Expression* node;
+        // next statement of a block, or which part of a loop runs next
+        size_t position;
+    };
+
+    Generator(BlockExpression* body, std::shared_ptr<Environment> environment,
+              std::shared_ptr<AstArena> arena)
+        : Iterator(Kind::GENERATOR), environment(std::move(environment)),
+          activations{{body, 0}}, arena(std::move(arena)) {}
+
+    std::shared_ptr<Environment> environment;
+    std::vector<Activation> activations;
+    // owns the nodes of the activations
+    std::shared_ptr<AstArena> arena;
+    bool running = false;
+
+protected:
+    virtual void Print(std::ostream& stream) const override;
+};
+
+// at most remaining values of source
+struct Take : Iterator {
+    Take(std::shared_ptr<Object> source, int64_t remaining)
+        : Iterator(Kind::TAKE), source(std::move(source)), remaining(remaining) {}
+
+    std::shared_ptr<Object> source;
+    int64_t remaining;
+
+protected:
+    virtual void Print(std::ostream& stream) const override;
+};
+
+// Mutable, insertion ordered map, see HashTable.
+struct Map : Object {
+    Map(Heap* heap) : Object(Type::MAP), table(heap) {}
+
+    HashTable table;
+
+protected:
+    virtual void Print(std::ostream& stream) const override;
+};
+
+// Packed doubles, which the math builtins apply to elementwise. The values are not
+// objects of their own, a kernel runs over them directly.
+struct FloatArray : Object {
+    FloatArray(Heap* heap)
+        : Object(Type::ARRAY), values(HeapAllocator<double>(heap, Heap::ARRAY_STORAGE)) {}
+
+    std::vector<double, HeapAllocator<double>> values;
+
+protected:
+    virtual void Print(std::ostream& stream) const override;
+};
+
+// keys of a map in insertion order, including those added while iterating
+struct Keys : Iterator {
+    Keys(std::shared_ptr<Object> map) : Iterator(Kind::KEYS), map(std::move(map)) {}
+
+    std::shared_ptr<Object> map;
+    size_t position = 0;
+
+protected:
+    virtual void Print(std::ostream& stream) const override;
+};
+
+// Handle of an asynchronous file operation, await turns it into its result.
+struct Future : Object {
+    Future(std::shared_ptr<IoRequest> request)
+        : Object(Type::FUTURE), request(std::move(request)) {}
+
+    std::shared_ptr<IoRequest> request;
+    // set by the first await
+    std::shared_ptr<Object> result;
 
 protected:
     virtual void Print(std::ostream& stream) const override;
@@ -85,3 +312,45 @@ struct Error : Object {
 protected:
     virtual void Print(std::ostream& stream) const override;
 };
+
+// Type of the objects of class T, known before one is constructed
+template <typename T>
+constexpr Object::Type TypeOf() {
+    if constexpr (std::is_same_v<T, Integer>) {
+        return Object::Type::INT;
+    } else if constexpr (std::is_same_v<T, BigInteger>) {
+        return Object::Type::BIG_INT;
+    } else if constexpr (std::is_same_v<T, Boolean>) {
+        return Object::Type::BOOL;
+    } else if constexpr (std::is_same_v<T, String>) {
+        return Object::Type::STRING;
+    } else if constexpr (std::is_same_v<T, Nil>) {
+        return Object::Type::NIL;
+    } else if constexpr (std::is_same_v<T, Function>) {
+        return Object::Type::FUNCTION;
+    } else if constexpr (std::is_same_v<T, Builtin>) {
+        return Object::Type::BUILTIN;
+    } else if constexpr (std::is_same_v<T, StructType>) {
+        return Object::Type::STRUCT;
+    } else if constexpr (std::is_same_v<T, Instance>) {
+        return Object::Type::INSTANCE;
+    } else if constexpr (std::is_base_of_v<Iterator, T>) {
+        return Object::Type::ITERATOR;
+    } else if constexpr (std::is_same_v<T, Map>) {
+        return Object::Type::MAP;
+    } else if constexpr (std::is_same_v<T, Future>) {
+        return Object::Type::FUTURE;
+    } else if constexpr (std::is_same_v<T, Float>) {
+        return Object::Type::FLOAT;
+    } else if constexpr (std::is_same_v<T, FloatArray>) {
+        return Object::Type::ARRAY;
+    } else {
+        static_assert(std::is_same_v<T, Error>, "not an object");
+        return Object::Type::ERROR;
+    }
+}
+
+static_assert(Object::Type::ERROR < Heap::ENVIRONMENT, "object kinds overlap the others");
+
+// Name of a Heap::kinds entry, nullptr for those that are not used
+const char* AllocationKindName(size_t kind);
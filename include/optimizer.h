@@ -0,0 +1,114 @@
+#pragma once
+
+#include "ast.h"
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// AST rewrites run between parsing and evaluation.
+//
+// Calls to small let-bound functions are inlined when the function body has no
+// returns, closures, loops or recursion and every name it closes over still refers to
+// the same binding at the call site. Names that are assigned to anywhere are never
+// looked up in place of the closure's own copy. Arguments are bound to renamed lets (`x#1`) unless
+// they are literals, so they are still evaluated exactly once and in order.
+//
+// Calls that are not inlined but pass literals to a let-bound function call a copy of
+// it instead, specialized for those literals: the parameters are substituted and the
+// operators and conditionals they make constant are folded. The copy is bound by a
+// renamed let (`f#2`) right after the function's own, so it closes over the same
+// bindings, and call sites passing the same literals share it. Copies are limited by
+// the size of the function and by a budget for the whole program.
+//
+// Afterwards unused lets and expression statements without side effects are removed,
+// and blocks left with a single expression are replaced by that expression.
+class Optimizer {
+public:
+    // With keep_globals, lets outside of any function are never removed since the host
+    // or a later REPL line may look them up.
+    Optimizer(bool keep_globals) : _keep_globals(keep_globals) {}
+
+    void Optimize(Program& program);
+
+    // one line per change, for --verbose
+    const std::vector<std::string>& GetChanges() const { return _changes; }
+
+private:
+    // largest function body, in nodes, that is inlined
+    static constexpr size_t INLINE_BUDGET = 32;
+    // largest function body that is specialized, and the most nodes all copies of one
+    // program may add together
+    static constexpr size_t SPECIALIZE_BUDGET = 256;
+    static constexpr size_t PROGRAM_SPECIALIZE_BUDGET = 4096;
+
+    struct Scope;
+
+    struct Specializable {
+        LetStatement* let;
+        // the statements the let is part of, its copies are added right after it
+        std::vector<Statement*>* statements;
+        size_t size;
+        // parameters that are never rebound in the body, and can be substituted
+        std::vector<bool> substitutable;
+        // names of the copies by the literals they were made for
+        std::unordered_map<std::string, std::string> copies;
+        std::vector<Statement*> added;
+    };
+
+    struct Candidate {
+        const FunctionExpression* function;
+        // names the body closes over and the scope each of them must resolve to
+        std::vector<std::pair<std::string, const Scope*>> free;
+    };
+
+    // The names bound in a function body (or the program), which all share one
+    // environment regardless of the block they appear in.
+    struct Scope {
+        Scope* parent;
+        // parameters and lets anywhere in the scope
+        std::unordered_map<std::string, size_t> bindings;
+        // parameters and statement level lets evaluated so far
+        std::unordered_set<std::string> defined;
+        std::unordered_map<std::string, Candidate> candidates;
+        // index in _specializable
+        std::unordered_map<std::string, size_t> specializable;
+    };
+
+    bool _keep_globals;
+    std::vector<std::string> _changes;
+    size_t _inlined = 0;
+    // targets of assignments anywhere in the program
+    std::unordered_set<std::string> _assigned;
+    std::vector<Specializable> _specializable;
+    size_t _specialized_size = 0;
+
+    // inlining
+    void Collect(const Statement* node, Scope& scope);
+    void Collect(const Expression* node, Scope& scope);
+    void InlineStatements(std::vector<Statement*>& statements, Scope& scope, bool top);
+    Expression* InlineExpression(Expression* node, Scope& scope);
+    Expression* InlineCall(CallExpression* node, Scope& scope);
+    bool MakeCandidate(const std::string& name,
+                       const FunctionExpression* function,
+                       Scope& scope,
+                       Candidate& candidate);
+    static const Scope* Resolve(const std::string& name, const Scope* scope);
+
+    // specialization
+    void MakeSpecializable(LetStatement* let, std::vector<Statement*>& statements, Scope& scope);
+    Expression* Specialize(CallExpression* node, Scope& scope);
+    void AddSpecializations();
+
+    // cleanup
+    bool Cleanup(std::vector<Statement*>& statements, bool global);
+    bool CleanupStatements(std::vector<Statement*>& statements,
+                           const std::unordered_map<std::string, size_t>& references,
+                           bool global);
+    Expression* CleanupExpression(Expression* node,
+                                  const std::unordered_map<std::string, size_t>& references,
+                                  bool global,
+                                  bool& changed);
+    static bool IsPure(const Expression* node);
+};
@@ -0,0 +1,105 @@
+#pragma once
+
+// Fork-join evaluation: the two calls of an infix expression such as
+// fib(n - 1) + fib(n - 2) run in parallel when neither can have side effects.
+
+#include "bigint.h"
+#include "evaluator.h"
+#include "object.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Whether calling function has no effect besides its result: its body, and the
+// bodies of the functions it calls, only assign their own locals and only call
+// functions, struct types and builtins of the same kind, see IsPureBuiltin. Callees
+// are looked up in the environment the function closed over, a call through a
+// parameter or local makes it impure. Worked out once per function.
+bool IsPure(const Function& function);
+
+// A call forked off by the evaluator of an infix expression. It lives on the forking
+// thread's stack, which keeps the function and arguments alive until it is joined.
+struct ForkedCall {
+    ObjectPtr function;
+    ObjectPtr arguments[Evaluator::MAX_NATIVE_ARGUMENTS];
+    size_t count = 0;
+    // fork depth the call runs at
+    size_t depth = 0;
+
+    // Set once the result is filled in by the thread that took the call. Objects must
+    // be freed by the evaluator that allocated them, so it is copied out as a plain
+    // value, which is only possible for numbers, booleans, nil, strings and errors.
+    std::atomic<bool> done{false};
+    bool copied = false;
+    Object::Type type = Object::Type::NIL;
+    int64_t integer = 0;
+    double number = 0;
+    BigInt big;
+    std::string text;
+};
+
+// Work-stealing pool for forked calls. Every thread forking calls owns a queue: it
+// pushes and pops its calls at the back, while idle threads steal the oldest ones,
+// which are the largest, from the front of the others. Each worker runs the calls it
+// steals on an evaluator of its own, queue 0 belongs to the evaluator the pool was
+// given to.
+//
+// Once a process has a second thread, libstdc++ updates every reference count with
+// atomic instructions, which makes evaluation on any one thread markedly slower. The
+// workers are therefore only started by the first fork.
+class ForkJoinPool {
+public:
+    // workers threads besides the one of the evaluator using the pool
+    ForkJoinPool(size_t workers);
+    ~ForkJoinPool();
+    ForkJoinPool(const ForkJoinPool&) = delete;
+    ForkJoinPool& operator=(const ForkJoinPool&) = delete;
+
+    // Forks below this depth only, deeper calls run where they are. Both operands of
+    // a fork go one level deeper, so there are at most 2^depth calls in flight, enough
+    // for every thread to find work when the calls are uneven.
+    size_t GetMaxDepth() const { return _max_depth; }
+
+    void Push(size_t queue, ForkedCall* call);
+    // takes call back unless another thread stole it
+    bool Pop(size_t queue, ForkedCall* call);
+    // the oldest call of any queue but this one, nullptr if there is none
+    ForkedCall* Steal(size_t queue);
+
+    // Blocks until call is done or, when stealing, until there is a call to steal.
+    // Waiting threads spin for a while first, as most waits are short.
+    void Wait(const ForkedCall& call, bool stealing);
+    // marks call as done and wakes the thread joining it
+    void Done(ForkedCall& call);
+
+    static constexpr int SPINS = 64;
+
+private:
+    struct alignas(64) Queue {
+        std::mutex mutex;
+        std::deque<ForkedCall*> calls;
+    };
+
+    void Work(size_t queue);
+
+    size_t _max_depth;
+    std::once_flag _started;
+    std::vector<std::unique_ptr<Queue>> _queues;
+    // one per worker, worker i owns queue i + 1
+    std::vector<std::unique_ptr<Evaluator>> _evaluators;
+    std::vector<std::thread> _threads;
+
+    // Calls waiting in all queues. Idle workers sleep while there are none, joining
+    // threads while they have nothing to steal either.
+    std::atomic<size_t> _queued{0};
+    std::atomic<size_t> _sleeping{0};
+    bool _stopping = false;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+};
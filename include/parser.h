@@ -32,11 +32,19 @@ private:
     Token _peek_token;
 
     bool _in_function = false;
+    // a yield was parsed in the innermost function literal
+    bool _yields = false;
+    // Parameters of the innermost function literal and the lets that have certainly
+    // run at this point of it: a let in a block is dropped when the block closes, as
+    // it may not have run. Closures capture by copy, so a function may only assign
+    // the names it binds itself.
+    std::vector<std::string> _locals;
 
     std::vector<ParseError> _errors;
 
     enum Precedence {
         LOWEST,
+        ASSIGN,
         AND_OR,
         EQUAL,
         LESS_GREATER,
@@ -52,10 +60,13 @@ private:
     Statement* ParseStatement();
     LetStatement* ParseLetStatement();
     ReturnStatement* ParseReturnStatement();
+    YieldStatement* ParseYieldStatement();
     ExpressionStatement* ParseExpressionStatement();
     Expression* ParseExpression(Precedence precedence);
     Identifier* ParseIdentifier();
-    IntegerLiteral* ParseIntegerLiteral();
+    Expression* ParseIntegerLiteral();
+    FloatLiteral* ParseFloatLiteral();
+    StringLiteral* ParseStringLiteral();
     BooleanLiteral* ParseBooleanLiteral(bool value);
     PrefixExpression* ParsePrefixExpression(PrefixExpression::Operation op);
     Expression* ParseInfixExpression(Expression* left);
@@ -66,6 +77,12 @@ private:
     BlockExpression* ParseBlockExpression();
     IfElseExpression* ParseIfElseExpression();
     FunctionExpression* ParseFunctionLiteral();
+    StructExpression* ParseStructLiteral();
+    MapExpression* ParseMapLiteral();
+    FieldExpression* ParseFieldExpression(Expression* left);
+    AssignExpression* ParseAssignExpression(Expression* left);
+    WhileExpression* ParseWhileExpression();
+    ForExpression* ParseForExpression();
 
     void Error(const std::string& message, const Token& token);
     void ExpectedError(Token::Type expected, const Token& found);
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct FunctionExpression;
+
+// Statistical profiler. A SIGPROF timer interrupts the process every interval of CPU
+// time and the handler copies the language level call stack of the thread that
+// started the profiler. The evaluator keeps that stack as a shadow stack of function
+// definitions, pushing one pointer per call, so nothing is measured per call and
+// short functions keep their real timing.
+//
+// setitimer is per process, only one profiler can run at a time.
+class Profiler {
+public:
+    Profiler(std::chrono::microseconds interval = std::chrono::milliseconds(1));
+    ~Profiler();
+    Profiler(const Profiler&) = delete;
+    Profiler& operator=(const Profiler&) = delete;
+
+    // false if another profiler is running or the timer could not be set up
+    bool Start();
+    void Stop();
+
+    // shadow stack, maintained by the evaluator around calls
+    void Enter(const FunctionExpression* function) {
+        if (_depth < MAX_DEPTH) {
+            _frames[_depth] = function;
+        }
+        // the handler may interrupt between the two stores and must see the frame first
+        std::atomic_signal_fence(std::memory_order_release);
+        _depth = _depth + 1;
+    }
+    void Leave() { _depth = _depth - 1; }
+
+    // Folds the samples taken so far into per stack counts. Samples only hold pointers
+    // to the definitions, so this must run while the programs they belong to are alive.
+    void Drain();
+    bool Pending() const { return _written > SAMPLE_BUFFER_SIZE / 2; }
+
+    // one "frame;frame;frame count" line per stack, as consumed by flamegraph.pl
+    void WriteFolded(std::ostream& stream);
+
+    uint64_t GetSamples() const { return _samples; }
+    // taken while the sample buffer was full
+    uint64_t GetDropped() const { return _dropped; }
+
+private:
+    // deeper frames are counted but not recorded, their samples end at this depth
+    static constexpr size_t MAX_DEPTH = 512;
+    static constexpr size_t SAMPLE_BUFFER_SIZE = 1 << 18;
+
+    static void Handle(int signal);
+    void Sample();
+
+    std::chrono::microseconds _interval;
+    bool _running = false;
+
+    const FunctionExpression* _frames[MAX_DEPTH];
+    volatile size_t _depth = 0;
+
+    // Samples one after another, each its depth followed by its frames from the
+    // outermost call. Only written by the handler and only read by Drain with the
+    // signal blocked, both on the profiled thread.
+    std::vector<uintptr_t> _buffer;
+    volatile size_t _written = 0;
+    volatile uint64_t _dropped = 0;
+
+    uint64_t _samples = 0;
+    std::unordered_map<std::string, uint64_t> _folded;
+};
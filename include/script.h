@@ -0,0 +1,220 @@
+#pragma once
+
+// Embedding interface: compile a script once, then run it any number of times with
+// host values and native functions bound as globals.
+
+#include "ast.h"
+#include "batch.h"
+#include "evaluator.h"
+#include "native.h"
+#include "parser.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+class CompileError : public std::exception {
+public:
+    CompileError(std::vector<ParseError> errors);
+
+    const char* what() const noexcept override { return _message.c_str(); }
+    const std::vector<ParseError>& GetErrors() const { return _errors; }
+
+private:
+    std::vector<ParseError> _errors;
+    std::string _message;
+};
+
+// Globals installed before each run. Values are converted to objects by the
+// evaluator that runs the script, so they are charged to its heap.
+class Bindings {
+public:
+    template <typename T>
+    Bindings& Set(const std::string& name, T value) {
+        _values.emplace_back(name, [value](Evaluator& evaluator) {
+            return Convert<T>::ToObject(evaluator, value);
+        });
+        return *this;
+    }
+
+    // registers a plain C++ function, e.g. bindings.Function<&Clamp>("clamp")
+    template <auto F>
+    Bindings& Function(const std::string& name) {
+        _values.emplace_back(name, [name](Evaluator& evaluator) -> ObjectPtr {
+            return evaluator.New<Builtin>(name, Native<F>::arity, &Native<F>::Call);
+        });
+        return *this;
+    }
+
+    void Install(Evaluator& evaluator, Environment& environment) const;
+
+private:
+    std::vector<std::pair<std::string, std::function<ObjectPtr(Evaluator&)>>> _values;
+};
+
+class Script;
+
+// Independent interpreter instance with its own heap, globals and limits. An isolate
+// is used by one thread at a time, while scripts can be shared between any number of
+// isolates. Results are owned by the isolate and stay valid for as long as it does.
+class Isolate {
+public:
+    Isolate() : _evaluator(std::make_unique<Evaluator>()) {}
+
+    ObjectPtr Run(const Script& script, const Bindings& bindings = Bindings());
+
+    // Runs the script, then calls the function it bound to name once per row of the
+    // argument columns, see BatchEvaluator. Returns nil once results are filled in.
+    ObjectPtr RunBatch(const Script& script,
+                       const std::string& name,
+                       const std::vector<std::vector<int64_t>>& arguments,
+                       std::vector<int64_t>& results,
+                       const Bindings& bindings = Bindings());
+
+    void SetLimits(const Limits& limits) { _evaluator->SetLimits(limits); }
+    Evaluator& GetEvaluator() { return *_evaluator; }
+
+private:
+    // kept at a fixed address, objects it allocated point back at its heap
+    std::unique_ptr<Evaluator> _evaluator;
+};
+
+// A parsed program, read-only once compiled. Run evaluates it on an isolate owned by
+// the script, whose results stay valid for as long as the script does.
+class Script {
+public:
+    Script(std::shared_ptr<const Program> program)
+        : _program(std::move(program)), _isolate(std::make_unique<Isolate>()) {}
+
+    ObjectPtr Run(const Bindings& bindings = Bindings()) {
+        return _isolate->Run(*this, bindings);
+    }
+
+    ObjectPtr RunBatch(const std::string& name,
+                       const std::vector<std::vector<int64_t>>& arguments,
+                       std::vector<int64_t>& results,
+                       const Bindings& bindings = Bindings()) {
+        return _isolate->RunBatch(*this, name, arguments, results, bindings);
+    }
+
+    void SetLimits(const Limits& limits) { _isolate->SetLimits(limits); }
+    const Program& GetProgram() const { return *_program; }
+
+private:
+    std::shared_ptr<const Program> _program;
+    std::unique_ptr<Isolate> _isolate;
+};
+
+// throws CompileError with every syntax error found
+Script Compile(const std::string& source);
+
+// Runs a script once and keeps its globals, after which rebinding some of its inputs
+// re-evaluates only the top-level statements they affect. Each statement is a node
+// of a dependency graph recorded while it runs: it depends on the statements that
+// bound the globals it read. An update re-evaluates the statements that read a
+// rebound input, then those that read what a re-evaluated statement bound, in
+// program order, which is a topological order of the graph as a global must be bound
+// before it is read. A statement that binds the same object again, such as the same
+// small integer or boolean, does not affect its readers.
+//
+// Statements must be deterministic and leave the objects bound by other statements
+// unchanged. A program that binds a global in more than one statement, or reads one
+// before the statement that binds it, is run in full on every update instead, as is
+// the update after a statement failed. The script must outlive this.
+class ReactiveScript {
+public:
+    ReactiveScript(const Script& script) : _program(script.GetProgram()) {}
+
+    // Evaluates every statement with only inputs bound, returns the result of the
+    // last one or the first Error.
+    ObjectPtr Run(const Bindings& inputs = Bindings());
+    // Rebinds inputs, keeping the other inputs of the last run, and re-evaluates what
+    // they affect. Returns the result of the last statement or the first Error.
+    ObjectPtr Update(const Bindings& inputs);
+
+    // value of a global, nullptr if there is none
+    ObjectPtr Get(const std::string& name) const;
+    // statements evaluated by the last Run or Update
+    size_t GetEvaluated() const { return _evaluated; }
+
+    void SetLimits(const Limits& limits) { _isolate.SetLimits(limits); }
+
+private:
+    struct Node {
+        Dependencies dependencies;
+        ObjectPtr result;
+    };
+
+    // statement indices in increasing order, keyed by interned name
+    using Index = std::unordered_map<const std::string*, std::vector<size_t>>;
+
+    const Program& _program;
+    Isolate _isolate;
+    EnvironmentPtr _environment;
+    std::unordered_map<std::string, ObjectPtr> _inputs;
+
+    std::vector<Node> _nodes;
+    Index _readers;
+    Index _writers;
+    // false until a run completes, or when the graph cannot be updated in place
+    bool _incremental = false;
+    size_t _evaluated = 0;
+
+    // statements waiting to be re-evaluated, the smallest index first
+    std::priority_queue<size_t, std::vector<size_t>, std::greater<size_t>> _pending;
+    std::vector<bool> _queued;
+
+    ObjectPtr RunAll();
+    ObjectPtr Evaluate(size_t index);
+    void Schedule(const Index& index, const std::string* name, size_t after);
+    // adds the reads of a statement to the index, false if one of them was bound by
+    // a later statement or by the statement itself
+    bool AddReads(size_t index);
+    void RemoveReads(size_t index);
+    ObjectPtr Result() const;
+};
+
+struct Job {
+    const Script* script;
+    Bindings input;
+};
+
+// Worker threads with one isolate each that run batches of jobs, handing out jobs one
+// at a time so uneven jobs still spread over all workers. Results belong to the
+// workers' isolates, release them before the next Run or destroying the pool.
+class IsolatePool {
+public:
+    IsolatePool(size_t threads = std::thread::hardware_concurrency());
+    ~IsolatePool();
+
+    std::vector<ObjectPtr> Run(const std::vector<Job>& jobs);
+
+    // only while no batch is running
+    void SetLimits(const Limits& limits);
+    size_t GetSize() const { return _threads.size(); }
+
+private:
+    void Work(Isolate& isolate);
+
+    std::vector<std::unique_ptr<Isolate>> _isolates;
+    std::vector<std::thread> _threads;
+
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _done;
+    uint64_t _generation = 0;
+    size_t _running = 0;
+    bool _stopping = false;
+
+    const std::vector<Job>* _jobs = nullptr;
+    std::vector<ObjectPtr>* _results = nullptr;
+    std::atomic<size_t> _next{0};
+};
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Field layout shared by every instance of one struct declaration: field i lives at
+// offset i of the instance. The parser creates one shape per declaration, so its id
+// names the layout in every isolate running the program.
+struct Shape {
+    static constexpr size_t NOT_FOUND = SIZE_MAX;
+
+    Shape(std::vector<std::string> fields) : fields(std::move(fields)), id(_next_id++) {}
+
+    // offset of field, or NOT_FOUND
+    size_t Find(const std::string& field) const {
+        for (size_t i = 0; i < fields.size(); i++) {
+            if (fields[i] == field) {
+                return i;
+            }
+        }
+        return NOT_FOUND;
+    }
+
+    // set by the parser from the let the declaration is bound to
+    std::string name = "struct";
+    std::vector<std::string> fields;
+    // never 0, which stands for an empty inline cache
+    uint32_t id;
+
+private:
+    static inline std::atomic<uint32_t> _next_id{1};
+};
@@ -0,0 +1,38 @@
+#pragma once
+
+// Snapshots of the globals of a program, so that a process can start from the state
+// a prelude left behind instead of lexing, parsing and evaluating it again.
+
+#include "ast.h"
+#include "environment.h"
+#include "evaluator.h"
+
+#include <exception>
+#include <memory>
+#include <ostream>
+#include <string>
+
+class SnapshotError : public std::exception {
+public:
+    SnapshotError(const std::string& message) : _message(message) {}
+
+    const char* what() const noexcept override { return _message.c_str(); }
+
+private:
+    std::string _message;
+};
+
+// Writes the bindings of globals together with every object, environment and AST
+// node reachable from them, each once however often it is referred to. Builtins are
+// saved by name. Generators and futures belong to a running evaluation and cannot be
+// saved, reaching one throws a SnapshotError.
+void SaveSnapshot(std::ostream& stream, const Environment& globals);
+
+// Binds the saved globals in globals, creating the objects on the evaluator's heap.
+// Builtins are looked up by name in globals, so they must be installed first, and
+// closures that referred to the saved globals refer to these. The restored functions
+// point into the nodes of the returned arena, which must outlive them. Throws a
+// SnapshotError if data is not a snapshot of this version.
+std::shared_ptr<AstArena> LoadSnapshot(const std::string& data,
+                                       Evaluator& evaluator,
+                                       const EnvironmentPtr& globals);
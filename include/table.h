@@ -0,0 +1,58 @@
+#pragma once
+
+#include "heap.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+struct Object;
+
+// Hash table from int (bignums included), bool and string keys to objects, used by
+// maps.
+//
+// Entries are kept densely in insertion order, so iteration walks a single array.
+// Lookups go through an open addressing index with linear probing: each slot holds
+// a control byte, zero when empty and otherwise the top 7 bits of the key's hash,
+// next to the number of its entry. A probe compares control bytes and only looks at
+// an entry when they match, and nothing is allocated except when the table grows.
+// Memory is charged to the heap of the evaluator that created the table.
+class HashTable {
+public:
+    struct Entry {
+        uint64_t hash;
+        std::shared_ptr<Object> key;
+        std::shared_ptr<Object> value;
+    };
+
+    HashTable(Heap* heap)
+        : _entries(HeapAllocator<Entry>(heap, Heap::MAP_STORAGE)),
+          _control(HeapAllocator<uint8_t>(heap, Heap::MAP_STORAGE)),
+          _slots(HeapAllocator<uint32_t>(heap, Heap::MAP_STORAGE)) {}
+
+    static bool IsKey(const Object& key);
+
+    // value bound to key, or nullptr
+    const std::shared_ptr<Object>* Find(const Object& key) const;
+    void Set(std::shared_ptr<Object> key, std::shared_ptr<Object> value);
+
+    size_t Size() const { return _entries.size(); }
+    const std::vector<Entry, HeapAllocator<Entry>>& Entries() const { return _entries; }
+
+private:
+    // at most 7 of 8 slots in use
+    static constexpr size_t MIN_CAPACITY = 8;
+
+    static uint64_t Hash(const Object& key);
+    static bool Equal(const Object& left, const Object& right);
+    static uint8_t Control(uint64_t hash) { return 0x80 | (hash >> 57); }
+
+    // slot holding key, or the empty slot where it would go
+    size_t Probe(const Object& key, uint64_t hash) const;
+    void Grow();
+
+    std::vector<Entry, HeapAllocator<Entry>> _entries;
+    std::vector<uint8_t, HeapAllocator<uint8_t>> _control;
+    std::vector<uint32_t, HeapAllocator<uint32_t>> _slots;
+};
@@ -13,6 +13,8 @@ struct Token {
         IDENT,
         // Literals
         INT,
+        FLOAT,
+        STRING,
         TRUE,
         FALSE,
         // Operators
@@ -31,6 +33,8 @@ struct Token {
         // Delimiters
         COMMA,
         SEMICOLON,
+        COLON,
+        DOT,
         LPAREN,
         RPAREN,
         LBRACE,
@@ -43,6 +47,10 @@ struct Token {
         RETURN,
         OR,
         AND,
+        STRUCT,
+        WHILE,
+        FOR,
+        YIELD,
     };
 
     Token(Type type, std::string literal, uint line, uint column);
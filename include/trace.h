@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+// Timeline of spans in Chrome's trace_event format, for chrome://tracing and Perfetto.
+// Each thread records into a ring buffer of its own that keeps the latest events, so
+// recording never takes a lock or does I/O. Nothing is recorded until Start, and every
+// hook first checks IsOn, which is all tracing costs while it is off.
+class Trace {
+public:
+    // events kept per thread, older ones are overwritten
+    static constexpr size_t CAPACITY = 1 << 16;
+
+    // calls are only recorded when they take at least call_threshold
+    static void Start(std::chrono::nanoseconds call_threshold);
+    static bool IsOn() { return _on.load(std::memory_order_relaxed); }
+    static std::chrono::nanoseconds GetCallThreshold() { return _call_threshold; }
+
+    // nanoseconds on a monotonic clock
+    static uint64_t Now();
+    static void Record(std::string name, const char* category, uint64_t start, uint64_t end,
+                       std::string detail = "");
+
+    // Writes the events of every thread as a JSON trace. Stops recording, the threads
+    // must be done with their spans.
+    static void Write(std::ostream& stream);
+
+private:
+    inline static std::atomic<bool> _on{false};
+    inline static std::chrono::nanoseconds _call_threshold{0};
+};
+
+// Records the time from its construction to its destruction as one span
+class TraceSpan {
+public:
+    TraceSpan(const char* name, const char* category)
+        : _name(name), _category(category), _start(Trace::IsOn() ? Trace::Now() : 0) {}
+    ~TraceSpan() {
+        if (_start != 0) {
+            Trace::Record(_name, _category, _start, Trace::Now(), std::move(detail));
+        }
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+    bool IsActive() const { return _start != 0; }
+    uint64_t GetStart() const { return _start; }
+
+    // shown with the span, only worth building while it is active
+    std::string detail;
+
+private:
+    const char* _name;
+    const char* _category;
+    uint64_t _start;
+};
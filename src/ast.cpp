@@ -1,5 +1,232 @@
 #include "ast.h"
 
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <deque>
+#include <mutex>
+
+// shared by the parsers of all threads
+static std::atomic<uint64_t> ast_allocations{0};
+static std::atomic<uint64_t> ast_frees{0};
+static std::atomic<size_t> ast_bytes{0};
+static std::atomic<size_t> ast_peak_bytes{0};
+
+static thread_local AstArena* current_arena = nullptr;
+
+static void CountAllocation(size_t size) {
+    ast_allocations.fetch_add(1, std::memory_order_relaxed);
+    size_t bytes = ast_bytes.fetch_add(size, std::memory_order_relaxed) + size;
+    size_t peak = ast_peak_bytes.load(std::memory_order_relaxed);
+    while (bytes > peak &&
+           !ast_peak_bytes.compare_exchange_weak(peak, bytes, std::memory_order_relaxed)) {
+    }
+}
+
+static void* AllocateNode(size_t size, bool statement) {
+    CountAllocation(size);
+    if (current_arena != nullptr) {
+        return current_arena->Allocate(size, statement);
+    }
+    return ::operator new(size);
+}
+
+static void FreeNode(void* pointer, size_t size, bool statement) {
+    ast_frees.fetch_add(1, std::memory_order_relaxed);
+    ast_bytes.fetch_sub(size, std::memory_order_relaxed);
+    if (current_arena != nullptr && current_arena->Release(pointer, size, statement)) {
+        return;
+    }
+    ::operator delete(pointer);
+}
+
+void* AstArena::Allocate(size_t size, bool statement) {
+    size_t rounded = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    if (static_cast<size_t>(_end - _next) < rounded) {
+        size_t block = std::max(rounded, BLOCK_SIZE);
+        _blocks.emplace_back(new std::byte[block]);
+        _next = _blocks.back().get();
+        _end = _next + block;
+    }
+
+    void* memory = _next;
+    _next += rounded;
+    _bytes += size;
+    (statement ? _statements : _expressions).push_back(memory);
+    return memory;
+}
+
+bool AstArena::Release(void* memory, size_t size, bool statement) {
+    std::vector<void*>& nodes = statement ? _statements : _expressions;
+    if (nodes.empty() || nodes.back() != memory) {
+        return false;
+    }
+
+    nodes.pop_back();
+    _bytes -= size;
+    size_t rounded = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    if (_next - rounded == memory) {
+        _next -= rounded;
+    }
+    return true;
+}
+
+AstArena::~AstArena() {
+    // Statement and Expression are the first and only base of every node, so each
+    // node starts with its base
+    for (void* node : _statements) {
+        static_cast<Statement*>(node)->~Statement();
+    }
+    for (void* node : _expressions) {
+        static_cast<Expression*>(node)->~Expression();
+    }
+
+    size_t count = _statements.size() + _expressions.size();
+    ast_frees.fetch_add(count, std::memory_order_relaxed);
+    ast_bytes.fetch_sub(_bytes, std::memory_order_relaxed);
+}
+
+AstArena::Scope::Scope(AstArena* arena) : _previous(current_arena) {
+    current_arena = arena;
+}
+
+AstArena::Scope::~Scope() {
+    current_arena = _previous;
+}
+
+AstArena* AstArena::Current() {
+    return current_arena;
+}
+
+// Open addressing on the hashes, kept next to the names they lead to, so that a
+// lookup reads one slot and only compares text when the hashes agree. The names are
+// in a deque, which never moves them.
+const std::string& Intern(const std::string& name) {
+    struct Slot {
+        size_t hash;
+        const std::string* name;
+    };
+    static std::mutex mutex;
+    static std::deque<std::string> names;
+    static std::vector<Slot> slots(1024);
+
+    size_t hash = std::hash<std::string>()(name);
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t mask = slots.size() - 1;
+    size_t index = hash & mask;
+    for (; slots[index].name != nullptr; index = (index + 1) & mask) {
+        if (slots[index].hash == hash && *slots[index].name == name) {
+            return *slots[index].name;
+        }
+    }
+
+    names.push_back(name);
+    slots[index] = {hash, &names.back()};
+    // at most half full, so that probes stay short
+    if (names.size() * 2 > slots.size()) {
+        std::vector<Slot> grown(slots.size() * 2);
+        mask = grown.size() - 1;
+        for (const Slot& slot : slots) {
+            if (slot.name != nullptr) {
+                index = slot.hash & mask;
+                while (grown[index].name != nullptr) {
+                    index = (index + 1) & mask;
+                }
+                grown[index] = slot;
+            }
+        }
+        slots = std::move(grown);
+    }
+    return names.back();
+}
+
+std::string FormatFloat(double value) {
+    char buffer[32];
+    std::string text(buffer, std::to_chars(buffer, buffer + sizeof(buffer), value).ptr);
+    // an exponent already tells it apart, NaN and the infinities never get this far
+    if (text.find_first_of(".e") == std::string::npos) {
+        text += ".0";
+    }
+    return text;
+}
+
+static void CollectNames(const Expression* node, std::vector<const std::string*>& names);
+
+static void CollectNames(const Statement* node, std::vector<const std::string*>& names) {
+    if (node->type == Statement::Type::LET) {
+        names.push_back(&static_cast<const LetStatement*>(node)->name->value);
+    }
+    ForEachChild(node, [&names](auto child) { CollectNames(child, names); });
+}
+
+static void CollectNames(const Expression* node, std::vector<const std::string*>& names) {
+    switch (node->type) {
+    case Expression::Type::IDENT:
+        names.push_back(&static_cast<const Identifier*>(node)->value);
+        break;
+    case Expression::Type::FUNCTION:
+        for (const Identifier* parameter : static_cast<const FunctionExpression*>(node)->parameters) {
+            names.push_back(&parameter->value);
+        }
+        break;
+    case Expression::Type::ASSIGN:
+        names.push_back(&static_cast<const AssignExpression*>(node)->name->value);
+        break;
+    default:
+        break;
+    }
+    ForEachChild(node, [&names](auto child) { CollectNames(child, names); });
+}
+
+static void CollectLets(const Statement* node, std::vector<const std::string*>& names) {
+    if (node->type == Statement::Type::LET) {
+        names.push_back(&static_cast<const LetStatement*>(node)->name->value);
+    }
+    ForEachChild(node, [&names](auto child) { CollectLets(child, names); });
+}
+
+void CollectLets(const Expression* node, std::vector<const std::string*>& names) {
+    if (node->type != Expression::Type::FUNCTION) {
+        ForEachChild(node, [&names](auto child) { CollectLets(child, names); });
+    }
+}
+
+const std::vector<const std::string*>& FunctionExpression::GetNames() const {
+    // programs are shared between isolates, the first call collects for all of them
+    std::call_once(_names_collected, [this]() {
+        CollectNames(body, _names);
+        // interned, so equal names are the same string
+        std::sort(_names.begin(), _names.end());
+        _names.erase(std::unique(_names.begin(), _names.end()), _names.end());
+    });
+    return _names;
+}
+
+AllocationStats GetAstStats() {
+    AllocationStats stats;
+    stats.allocations = ast_allocations.load(std::memory_order_relaxed);
+    stats.frees = ast_frees.load(std::memory_order_relaxed);
+    stats.bytes = ast_bytes.load(std::memory_order_relaxed);
+    stats.peak_bytes = ast_peak_bytes.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void* Statement::operator new(size_t size) {
+    return AllocateNode(size, true);
+}
+
+void Statement::operator delete(void* pointer, size_t size) {
+    FreeNode(pointer, size, true);
+}
+
+void* Expression::operator new(size_t size) {
+    return AllocateNode(size, false);
+}
+
+void Expression::operator delete(void* pointer, size_t size) {
+    FreeNode(pointer, size, false);
+}
+
 std::ostream& operator<<(std::ostream& stream, const Statement& statement) {
     statement.Print(stream);
     return stream;
@@ -25,6 +252,10 @@ void ReturnStatement::Print(std::ostream& stream) const {
     stream << "return " << *value << ";";
 }
 
+void YieldStatement::Print(std::ostream& stream) const {
+    stream << "yield " << *value << ";";
+}
+
 void ExpressionStatement::Print(std::ostream& stream) const {
     stream << *expression << ";";
 }
@@ -37,6 +268,18 @@ void IntegerLiteral::Print(std::ostream& stream) const {
     stream << value;
 }
 
+void BigIntLiteral::Print(std::ostream& stream) const {
+    stream << value;
+}
+
+void FloatLiteral::Print(std::ostream& stream) const {
+    stream << FormatFloat(value);
+}
+
+void StringLiteral::Print(std::ostream& stream) const {
+    stream << "\"" << value << "\"";
+}
+
 void BooleanLiteral::Print(std::ostream& stream) const {
     stream << (value ? "true" : "false");
 }
@@ -188,3 +431,41 @@ void CallExpression::Print(std::ostream& stream) const {
     }
     stream << ")";
 }
+
+void StructExpression::Print(std::ostream& stream) const {
+    stream << "struct { ";
+    for (size_t i = 0; i < fields.size(); ++i) {
+        stream << *fields[i];
+        if (i != fields.size() - 1) {
+            stream << ", ";
+        }
+    }
+    stream << " }";
+}
+
+void FieldExpression::Print(std::ostream& stream) const {
+    stream << *object << "." << *field;
+}
+
+void AssignExpression::Print(std::ostream& stream) const {
+    stream << *name << " = " << *value;
+}
+
+void WhileExpression::Print(std::ostream& stream) const {
+    stream << "while " << *condition << " " << *body;
+}
+
+void ForExpression::Print(std::ostream& stream) const {
+    stream << "for " << *initializer << " " << *condition << "; " << *update << " " << *body;
+}
+
+void MapExpression::Print(std::ostream& stream) const {
+    stream << "{";
+    for (size_t i = 0; i < entries.size(); i++) {
+        stream << *entries[i].first << ": " << *entries[i].second;
+        if (i != entries.size() - 1) {
+            stream << ", ";
+        }
+    }
+    stream << "}";
+}
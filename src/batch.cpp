@@ -0,0 +1,564 @@
+#include "batch.h"
+
+#include <algorithm>
+#include <sstream>
+
+ObjectPtr BatchEvaluator::Run(const ObjectPtr& function,
+                              const std::vector<std::vector<int64_t>>& arguments,
+                              std::vector<int64_t>& results) {
+    size_t rows = arguments.empty() ? 0 : arguments[0].size();
+    for (const std::vector<int64_t>& column : arguments) {
+        if (column.size() != rows) {
+            return _evaluator.New<Error>("argument columns differ in length");
+        }
+    }
+    results.resize(rows);
+
+    _vectorized = false;
+    if (function->type == Object::Type::FUNCTION) {
+        const Function* function_object = static_cast<const Function*>(function.get());
+        _vectorized = function_object->parameters.size() == arguments.size() &&
+                      Check(function_object) != Kind::UNSUPPORTED;
+    }
+    if (!_vectorized) {
+        return CallRows(arguments, function, 0, rows, results);
+    }
+
+    for (size_t offset = 0; offset < rows; offset += CHUNK_SIZE) {
+        _count = std::min(CHUNK_SIZE, rows - offset);
+        if (RunChunk(arguments, offset, results.data() + offset)) {
+            continue;
+        }
+
+        ObjectPtr error = CallRows(arguments, function, offset, offset + _count, results);
+        if (error->type == Object::Type::ERROR) {
+            return error;
+        }
+    }
+
+    return _evaluator.GetNil();
+}
+
+ObjectPtr BatchEvaluator::CallRows(const std::vector<std::vector<int64_t>>& arguments,
+                                   const ObjectPtr& function,
+                                   size_t begin,
+                                   size_t end,
+                                   std::vector<int64_t>& results) {
+    std::vector<ObjectPtr> values(arguments.size());
+    for (size_t row = begin; row < end; row++) {
+        for (size_t i = 0; i < arguments.size(); i++) {
+            values[i] = _evaluator.NewInteger(arguments[i][row]);
+        }
+
+        ObjectPtr result = _evaluator.Call(function, values.data(), values.size());
+        switch (result->type) {
+        case Object::Type::INT:
+            results[row] = static_cast<Integer*>(result.get())->value;
+            continue;
+        case Object::Type::BOOL:
+            results[row] = static_cast<Boolean*>(result.get())->value;
+            continue;
+        default:
+            break;
+        }
+
+        std::stringstream stream;
+        stream << "row " << row << ": ";
+        if (result->type == Object::Type::ERROR) {
+            stream << static_cast<Error*>(result.get())->message;
+        } else if (result->type == Object::Type::BIG_INT) {
+            stream << "result does not fit in 64 bits";
+        } else {
+            stream << "result has type " << result->type << ", expected INT or BOOL";
+        }
+        return _evaluator.New<Error>(stream.str());
+    }
+
+    return _evaluator.GetNil();
+}
+
+// Checking
+
+BatchEvaluator::Kind BatchEvaluator::Combine(Kind left, Kind right) {
+    if (left == Kind::UNSUPPORTED || right == Kind::UNSUPPORTED) {
+        return Kind::UNSUPPORTED;
+    }
+    if (left == Kind::NEVER) {
+        return right;
+    }
+    if (right == Kind::NEVER || left == right) {
+        return left;
+    }
+
+    return Kind::MIXED;
+}
+
+BatchEvaluator::Kind BatchEvaluator::Check(const Function* function) {
+    _function = function;
+    _names.clear();
+    _poisoned.clear();
+    _kinds.clear();
+    _references.clear();
+    _lets.clear();
+    _returning.clear();
+    _returned_kind = Kind::NEVER;
+
+    for (const Identifier* parameter : function->parameters) {
+        if (!_names.emplace(parameter->value, _kinds.size()).second) {
+            return Kind::UNSUPPORTED;
+        }
+        _kinds.push_back(Kind::INT);
+    }
+
+    Kind kind = Combine(CheckBlock(function->body), _returned_kind);
+    return IsValue(kind) ? kind : Kind::UNSUPPORTED;
+}
+
+BatchEvaluator::Kind BatchEvaluator::CheckStatement(const Statement* node) {
+    switch (node->type) {
+    case Statement::Type::LET: {
+        const LetStatement* let = static_cast<const LetStatement*>(node);
+        size_t returning = _returning.size();
+        Kind kind = CheckExpression(let->value);
+        if (!IsValue(kind)) {
+            return Kind::UNSUPPORTED;
+        }
+        if (_returning.size() != returning) {
+            _returning.insert(node);
+        }
+
+        auto [name, inserted] = _names.emplace(let->name->value, _kinds.size());
+        if (inserted) {
+            _kinds.push_back(kind);
+        } else if (_kinds[name->second] != kind) {
+            return Kind::UNSUPPORTED;
+        }
+
+        _lets[let] = name->second;
+        _poisoned.erase(let->name->value);
+        return Kind::NIL;
+    }
+    case Statement::Type::RETURN: {
+        Kind kind = CheckExpression(static_cast<const ReturnStatement*>(node)->value);
+        _returned_kind = Combine(_returned_kind, kind);
+        if (!IsValue(kind) || !IsValue(_returned_kind)) {
+            return Kind::UNSUPPORTED;
+        }
+
+        _returning.insert(node);
+        return Kind::NEVER;
+    }
+    case Statement::Type::YIELD:
+        return Kind::UNSUPPORTED;
+    case Statement::Type::EXPRESSION: {
+        size_t returning = _returning.size();
+        Kind kind = CheckExpression(static_cast<const ExpressionStatement*>(node)->expression);
+        if (_returning.size() != returning) {
+            _returning.insert(node);
+        }
+        return kind;
+    }
+    }
+
+    return Kind::UNSUPPORTED;
+}
+
+BatchEvaluator::Kind BatchEvaluator::CheckExpression(const Expression* node) {
+    switch (node->type) {
+    case Expression::Type::INT:
+        return Kind::INT;
+    case Expression::Type::BOOLEAN:
+        return Kind::BOOL;
+    case Expression::Type::IDENT:
+        return CheckIdentifier(static_cast<const Identifier*>(node));
+    case Expression::Type::PREFIX: {
+        const PrefixExpression* prefix = static_cast<const PrefixExpression*>(node);
+        Kind kind = CheckExpression(prefix->right);
+        if (prefix->op == PrefixExpression::Operation::NEGATE) {
+            return kind == Kind::INT ? Kind::INT : Kind::UNSUPPORTED;
+        }
+        return IsValue(kind) ? Kind::BOOL : Kind::UNSUPPORTED;
+    }
+    case Expression::Type::INFIX:
+        return CheckInfix(static_cast<const InfixExpression*>(node));
+    case Expression::Type::BLOCK:
+        return CheckBlock(static_cast<const BlockExpression*>(node));
+    case Expression::Type::IF_ELSE:
+        return CheckIfElse(static_cast<const IfElseExpression*>(node));
+    default:
+        return Kind::UNSUPPORTED;
+    }
+}
+
+BatchEvaluator::Kind BatchEvaluator::CheckBlock(const BlockExpression* node) {
+    Kind kind = Kind::NIL;
+    for (const Statement* statement : node->statements) {
+        kind = CheckStatement(statement);
+        if (kind == Kind::UNSUPPORTED) {
+            return kind;
+        }
+    }
+
+    return kind;
+}
+
+BatchEvaluator::Kind BatchEvaluator::CheckIdentifier(const Identifier* node) {
+    if (_poisoned.count(node->value) != 0) {
+        return Kind::UNSUPPORTED;
+    }
+
+    auto slot = _names.find(node->value);
+    if (slot != _names.end()) {
+        _references[node] = {false, slot->second, 0};
+        return _kinds[slot->second];
+    }
+
+    // closed over values are fixed for the whole batch
+    ObjectPtr value = _function->environment->Get(node->value);
+    if (value == nullptr) {
+        return Kind::UNSUPPORTED;
+    }
+    if (value->type == Object::Type::INT) {
+        _references[node] = {true, 0, static_cast<Integer*>(value.get())->value};
+        return Kind::INT;
+    }
+    if (value->type == Object::Type::BOOL) {
+        _references[node] = {true, 0, static_cast<Boolean*>(value.get())->value};
+        return Kind::BOOL;
+    }
+
+    return Kind::UNSUPPORTED;
+}
+
+BatchEvaluator::Kind BatchEvaluator::CheckInfix(const InfixExpression* node) {
+    Kind left = CheckExpression(node->left);
+    Kind right = CheckExpression(node->right);
+
+    if (left == Kind::INT && right == Kind::INT) {
+        switch (node->op) {
+        case InfixExpression::Operation::ADD:
+        case InfixExpression::Operation::SUBTRACT:
+        case InfixExpression::Operation::MULTIPLY:
+        case InfixExpression::Operation::DIVIDE:
+            return Kind::INT;
+        default:
+            return Kind::BOOL;
+        }
+    }
+
+    if (left == Kind::BOOL && right == Kind::BOOL) {
+        switch (node->op) {
+        case InfixExpression::Operation::EQUAL:
+        case InfixExpression::Operation::NOT_EQUAL:
+        case InfixExpression::Operation::AND:
+        case InfixExpression::Operation::OR:
+            return Kind::BOOL;
+        default:
+            return Kind::UNSUPPORTED;
+        }
+    }
+
+    return Kind::UNSUPPORTED;
+}
+
+BatchEvaluator::Kind BatchEvaluator::CheckIfElse(const IfElseExpression* node) {
+    if (!IsValue(CheckExpression(node->condition))) {
+        return Kind::UNSUPPORTED;
+    }
+
+    // Blocks share the frame, so a let in a branch only binds the name for the rows
+    // that took it. Later uses of such names are left to per-row calls.
+    std::unordered_map<std::string, size_t> names = _names;
+    auto restore = [&] {
+        for (const auto& [name, slot] : _names) {
+            if (names.count(name) == 0) {
+                _poisoned.insert(name);
+            }
+        }
+        _names = names;
+    };
+
+    Kind consequence = CheckBlock(node->consequence);
+    restore();
+    Kind alternative =
+        node->alternative != nullptr ? CheckExpression(node->alternative) : Kind::NIL;
+    restore();
+
+    return Combine(consequence, alternative);
+}
+
+// Evaluation
+
+int64_t* BatchEvaluator::Allocate() {
+    if (_used == _buffers.size()) {
+        _buffers.push_back(std::make_unique<int64_t[]>(CHUNK_SIZE));
+    }
+
+    return _buffers[_used++].get();
+}
+
+bool BatchEvaluator::RunChunk(const std::vector<std::vector<int64_t>>& arguments,
+                              size_t offset,
+                              int64_t* results) {
+    _used = 0;
+    _fallback = false;
+    _slots.assign(_kinds.size(), nullptr);
+    for (size_t i = 0; i < arguments.size(); i++) {
+        _slots[i] = arguments[i].data() + offset;
+    }
+
+    _zeros = Fill(0);
+    const int64_t* active = Fill(1);
+    _result = Fill(0);
+    _returned = Fill(0);
+
+    const int64_t* value = EvalBlock(_function->body, active);
+    if (_fallback) {
+        return false;
+    }
+
+    const int64_t* returned = _returned;
+    const int64_t* result = _result;
+    for (size_t i = 0; i < _count; i++) {
+        results[i] = returned[i] ? result[i] : value[i];
+    }
+
+    return true;
+}
+
+int64_t* BatchEvaluator::Fill(int64_t value) {
+    int64_t* out = Allocate();
+    std::fill(out, out + _count, value);
+    return out;
+}
+
+// masks are 0 or 1, negating one gives a bit mask to blend with
+const int64_t*
+BatchEvaluator::Select(const int64_t* mask, const int64_t* left, const int64_t* right) {
+    int64_t* __restrict out = Allocate();
+    for (size_t i = 0; i < _count; i++) {
+        out[i] = right[i] ^ ((left[i] ^ right[i]) & -mask[i]);
+    }
+
+    return out;
+}
+
+bool BatchEvaluator::Any(const int64_t* mask) const {
+    int64_t any = 0;
+    for (size_t i = 0; i < _count; i++) {
+        any |= mask[i];
+    }
+
+    return any != 0;
+}
+
+const int64_t* BatchEvaluator::EvalStatement(const Statement* node,
+                                             const int64_t* active) {
+    switch (node->type) {
+    case Statement::Type::LET: {
+        const LetStatement* let = static_cast<const LetStatement*>(node);
+        const int64_t* value = EvalExpression(let->value, active);
+        const int64_t*& slot = _slots[_lets[let]];
+        slot = slot != nullptr ? Select(active, value, slot) : value;
+        return _zeros;
+    }
+    case Statement::Type::RETURN: {
+        const int64_t* value =
+            EvalExpression(static_cast<const ReturnStatement*>(node)->value, active);
+        int64_t* __restrict result = _result;
+        int64_t* __restrict returned = _returned;
+        for (size_t i = 0; i < _count; i++) {
+            result[i] = result[i] ^ ((value[i] ^ result[i]) & -active[i]);
+            returned[i] |= active[i];
+        }
+        return _zeros;
+    }
+    case Statement::Type::EXPRESSION:
+        return EvalExpression(static_cast<const ExpressionStatement*>(node)->expression,
+                              active);
+    case Statement::Type::YIELD:
+        break;
+    }
+
+    return _zeros;
+}
+
+const int64_t* BatchEvaluator::EvalExpression(const Expression* node,
+                                              const int64_t* active) {
+    switch (node->type) {
+    case Expression::Type::INT:
+        return Fill(static_cast<const IntegerLiteral*>(node)->value);
+    case Expression::Type::BOOLEAN:
+        return Fill(static_cast<const BooleanLiteral*>(node)->value);
+    case Expression::Type::IDENT: {
+        const Reference& reference = _references[static_cast<const Identifier*>(node)];
+        if (reference.constant) {
+            return Fill(reference.value);
+        }
+        return _slots[reference.slot] != nullptr ? _slots[reference.slot] : _zeros;
+    }
+    case Expression::Type::PREFIX:
+        return EvalPrefix(static_cast<const PrefixExpression*>(node), active);
+    case Expression::Type::INFIX:
+        return EvalInfix(static_cast<const InfixExpression*>(node), active);
+    case Expression::Type::BLOCK:
+        return EvalBlock(static_cast<const BlockExpression*>(node), active);
+    case Expression::Type::IF_ELSE:
+        return EvalIfElse(static_cast<const IfElseExpression*>(node), active);
+    default:
+        return _zeros;
+    }
+}
+
+const int64_t* BatchEvaluator::EvalBlock(const BlockExpression* node,
+                                         const int64_t* active) {
+    const int64_t* value = _zeros;
+    for (const Statement* statement : node->statements) {
+        value = EvalStatement(statement, active);
+        if (_returning.count(statement) == 0) {
+            continue;
+        }
+
+        // rows that returned sit out the rest of the block
+        int64_t* __restrict remaining = Allocate();
+        for (size_t i = 0; i < _count; i++) {
+            remaining[i] = active[i] & ~_returned[i];
+        }
+        active = remaining;
+        if (!Any(active)) {
+            return _zeros;
+        }
+    }
+
+    return value;
+}
+
+const int64_t* BatchEvaluator::EvalPrefix(const PrefixExpression* node,
+                                          const int64_t* active) {
+    const int64_t* right = EvalExpression(node->right, active);
+    int64_t* __restrict out = Allocate();
+
+    if (node->op == PrefixExpression::Operation::NOT) {
+        for (size_t i = 0; i < _count; i++) {
+            out[i] = right[i] == 0;
+        }
+        return out;
+    }
+
+    int64_t overflow = 0;
+    for (size_t i = 0; i < _count; i++) {
+        out[i] = static_cast<int64_t>(0 - static_cast<uint64_t>(right[i]));
+        overflow |= (right[i] == INT64_MIN) & active[i];
+    }
+    _fallback |= overflow != 0;
+
+    return out;
+}
+
+// Operands are INT columns or BOOL columns of 0 and 1, so comparisons and logic work
+// the same on both. Overflow is detected on the wrapped result rather than per
+// operation, which keeps the loops free of branches.
+const int64_t* BatchEvaluator::EvalInfix(const InfixExpression* node,
+                                         const int64_t* active) {
+    const int64_t* left = EvalExpression(node->left, active);
+    const int64_t* right = EvalExpression(node->right, active);
+    int64_t* __restrict out = Allocate();
+    int64_t overflow = 0;
+
+    switch (node->op) {
+    case InfixExpression::Operation::ADD:
+        for (size_t i = 0; i < _count; i++) {
+            int64_t sum = static_cast<int64_t>(static_cast<uint64_t>(left[i]) +
+                                               static_cast<uint64_t>(right[i]));
+            out[i] = sum;
+            overflow |= (((left[i] ^ sum) & (right[i] ^ sum)) < 0) & active[i];
+        }
+        break;
+    case InfixExpression::Operation::SUBTRACT:
+        for (size_t i = 0; i < _count; i++) {
+            int64_t difference = static_cast<int64_t>(static_cast<uint64_t>(left[i]) -
+                                                      static_cast<uint64_t>(right[i]));
+            out[i] = difference;
+            overflow |= (((left[i] ^ right[i]) & (left[i] ^ difference)) < 0) & active[i];
+        }
+        break;
+    case InfixExpression::Operation::MULTIPLY:
+        for (size_t i = 0; i < _count; i++) {
+            int64_t product;
+            overflow |= __builtin_mul_overflow(left[i], right[i], &product) & active[i];
+            out[i] = product;
+        }
+        break;
+    case InfixExpression::Operation::DIVIDE:
+        // inactive rows still divide, by one whenever their divisor would trap
+        for (size_t i = 0; i < _count; i++) {
+            int64_t invalid = (right[i] == 0) | ((left[i] == INT64_MIN) & (right[i] == -1));
+            out[i] = left[i] / (invalid ? 1 : right[i]);
+            overflow |= invalid & active[i];
+        }
+        break;
+    case InfixExpression::Operation::EQUAL:
+        for (size_t i = 0; i < _count; i++) {
+            out[i] = left[i] == right[i];
+        }
+        break;
+    case InfixExpression::Operation::NOT_EQUAL:
+        for (size_t i = 0; i < _count; i++) {
+            out[i] = left[i] != right[i];
+        }
+        break;
+    case InfixExpression::Operation::LESS:
+        for (size_t i = 0; i < _count; i++) {
+            out[i] = left[i] < right[i];
+        }
+        break;
+    case InfixExpression::Operation::GREATER:
+        for (size_t i = 0; i < _count; i++) {
+            out[i] = left[i] > right[i];
+        }
+        break;
+    case InfixExpression::Operation::LESS_EQUAL:
+        for (size_t i = 0; i < _count; i++) {
+            out[i] = left[i] <= right[i];
+        }
+        break;
+    case InfixExpression::Operation::GREATER_EQUAL:
+        for (size_t i = 0; i < _count; i++) {
+            out[i] = left[i] >= right[i];
+        }
+        break;
+    case InfixExpression::Operation::AND:
+        for (size_t i = 0; i < _count; i++) {
+            out[i] = (left[i] != 0) & (right[i] != 0);
+        }
+        break;
+    case InfixExpression::Operation::OR:
+        for (size_t i = 0; i < _count; i++) {
+            out[i] = (left[i] != 0) | (right[i] != 0);
+        }
+        break;
+    }
+    _fallback |= overflow != 0;
+
+    return out;
+}
+
+const int64_t* BatchEvaluator::EvalIfElse(const IfElseExpression* node,
+                                          const int64_t* active) {
+    const int64_t* condition = EvalExpression(node->condition, active);
+    int64_t* __restrict taken = Allocate();
+    int64_t* __restrict skipped = Allocate();
+    for (size_t i = 0; i < _count; i++) {
+        int64_t truthy = condition[i] != 0;
+        taken[i] = active[i] & truthy;
+        skipped[i] = active[i] & (truthy ^ 1);
+    }
+
+    const int64_t* consequence =
+        Any(taken) ? EvalBlock(node->consequence, taken) : _zeros;
+    const int64_t* alternative = node->alternative != nullptr && Any(skipped)
+                                     ? EvalExpression(node->alternative, skipped)
+                                     : _zeros;
+
+    return Select(taken, consequence, alternative);
+}
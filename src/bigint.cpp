@@ -0,0 +1,351 @@
+#include "bigint.h"
+
+#include <algorithm>
+
+using Limbs = std::vector<uint32_t>;
+
+// below this many limbs Karatsuba loses to the plain quadratic loop
+static constexpr size_t KARATSUBA_THRESHOLD = 32;
+
+static void Trim(Limbs& limbs) {
+    while (!limbs.empty() && limbs.back() == 0) {
+        limbs.pop_back();
+    }
+}
+
+static int CompareMagnitude(const Limbs& left, const Limbs& right) {
+    if (left.size() != right.size()) {
+        return left.size() < right.size() ? -1 : 1;
+    }
+
+    for (size_t i = left.size(); i-- > 0;) {
+        if (left[i] != right[i]) {
+            return left[i] < right[i] ? -1 : 1;
+        }
+    }
+
+    return 0;
+}
+
+static Limbs AddMagnitude(const Limbs& left, const Limbs& right) {
+    const Limbs& longer = left.size() >= right.size() ? left : right;
+    const Limbs& shorter = left.size() >= right.size() ? right : left;
+
+    Limbs result(longer.size() + 1);
+    uint64_t carry = 0;
+    for (size_t i = 0; i < longer.size(); i++) {
+        uint64_t sum = carry + longer[i] + (i < shorter.size() ? shorter[i] : 0);
+        result[i] = static_cast<uint32_t>(sum);
+        carry = sum >> 32;
+    }
+    result[longer.size()] = static_cast<uint32_t>(carry);
+
+    Trim(result);
+    return result;
+}
+
+// requires left >= right
+static Limbs SubtractMagnitude(const Limbs& left, const Limbs& right) {
+    Limbs result(left.size());
+    int64_t borrow = 0;
+    for (size_t i = 0; i < left.size(); i++) {
+        int64_t difference = static_cast<int64_t>(left[i]) - borrow -
+                             (i < right.size() ? right[i] : 0);
+        borrow = difference < 0;
+        result[i] = static_cast<uint32_t>(difference + (borrow << 32));
+    }
+
+    Trim(result);
+    return result;
+}
+
+static Limbs SchoolbookMultiply(const Limbs& left, const Limbs& right) {
+    if (left.empty() || right.empty()) {
+        return {};
+    }
+
+    Limbs result(left.size() + right.size());
+    for (size_t i = 0; i < left.size(); i++) {
+        uint64_t carry = 0;
+        for (size_t j = 0; j < right.size(); j++) {
+            uint64_t current =
+                static_cast<uint64_t>(left[i]) * right[j] + result[i + j] + carry;
+            result[i + j] = static_cast<uint32_t>(current);
+            carry = current >> 32;
+        }
+        result[i + right.size()] = static_cast<uint32_t>(carry);
+    }
+
+    Trim(result);
+    return result;
+}
+
+static Limbs Slice(const Limbs& limbs, size_t from, size_t to) {
+    from = std::min(from, limbs.size());
+    to = std::min(to, limbs.size());
+
+    Limbs result(limbs.begin() + from, limbs.begin() + to);
+    Trim(result);
+    return result;
+}
+
+static void AddShifted(Limbs& target, const Limbs& value, size_t shift) {
+    uint64_t carry = 0;
+    size_t i = 0;
+    for (; i < value.size(); i++) {
+        uint64_t sum = carry + target[i + shift] + value[i];
+        target[i + shift] = static_cast<uint32_t>(sum);
+        carry = sum >> 32;
+    }
+
+    for (i += shift; carry != 0; i++) {
+        uint64_t sum = carry + target[i];
+        target[i] = static_cast<uint32_t>(sum);
+        carry = sum >> 32;
+    }
+}
+
+static Limbs MultiplyMagnitude(const Limbs& left, const Limbs& right) {
+    if (left.size() < KARATSUBA_THRESHOLD || right.size() < KARATSUBA_THRESHOLD) {
+        return SchoolbookMultiply(left, right);
+    }
+
+    // (l1 B + l0)(r1 B + r0) = z2 B^2 + z1 B + z0 with a single extra multiplication
+    size_t half = std::max(left.size(), right.size()) / 2;
+    Limbs left_low = Slice(left, 0, half);
+    Limbs left_high = Slice(left, half, left.size());
+    Limbs right_low = Slice(right, 0, half);
+    Limbs right_high = Slice(right, half, right.size());
+
+    Limbs z0 = MultiplyMagnitude(left_low, right_low);
+    Limbs z2 = MultiplyMagnitude(left_high, right_high);
+    Limbs z1 = MultiplyMagnitude(AddMagnitude(left_low, left_high),
+                                 AddMagnitude(right_low, right_high));
+    z1 = SubtractMagnitude(SubtractMagnitude(z1, z0), z2);
+
+    Limbs result(left.size() + right.size() + 1);
+    AddShifted(result, z0, 0);
+    AddShifted(result, z1, half);
+    AddShifted(result, z2, 2 * half);
+
+    Trim(result);
+    return result;
+}
+
+static uint32_t DivideSmall(Limbs& limbs, uint32_t divisor) {
+    uint64_t remainder = 0;
+    for (size_t i = limbs.size(); i-- > 0;) {
+        uint64_t current = (remainder << 32) | limbs[i];
+        limbs[i] = static_cast<uint32_t>(current / divisor);
+        remainder = current % divisor;
+    }
+
+    Trim(limbs);
+    return static_cast<uint32_t>(remainder);
+}
+
+// Knuth's algorithm D, divisor must be nonzero
+static Limbs DivideMagnitude(const Limbs& dividend, const Limbs& divisor) {
+    if (CompareMagnitude(dividend, divisor) < 0) {
+        return {};
+    }
+
+    if (divisor.size() == 1) {
+        Limbs quotient = dividend;
+        DivideSmall(quotient, divisor[0]);
+        return quotient;
+    }
+
+    const uint64_t base = uint64_t(1) << 32;
+    size_t n = divisor.size();
+    size_t m = dividend.size();
+
+    // normalize so the top bit of the divisor is set
+    int shift = __builtin_clz(divisor[n - 1]);
+    Limbs v(n);
+    Limbs u(m + 1);
+    for (size_t i = n - 1; i > 0; i--) {
+        v[i] = (divisor[i] << shift) |
+               (shift ? divisor[i - 1] >> (32 - shift) : 0);
+    }
+    v[0] = divisor[0] << shift;
+    u[m] = shift ? dividend[m - 1] >> (32 - shift) : 0;
+    for (size_t i = m - 1; i > 0; i--) {
+        u[i] = (dividend[i] << shift) | (shift ? dividend[i - 1] >> (32 - shift) : 0);
+    }
+    u[0] = dividend[0] << shift;
+
+    Limbs quotient(m - n + 1);
+    for (size_t j = m - n + 1; j-- > 0;) {
+        uint64_t numerator = (static_cast<uint64_t>(u[j + n]) << 32) | u[j + n - 1];
+        uint64_t qhat = numerator / v[n - 1];
+        uint64_t rhat = numerator % v[n - 1];
+
+        while (qhat >= base || qhat * v[n - 2] > ((rhat << 32) | u[j + n - 2])) {
+            qhat--;
+            rhat += v[n - 1];
+            if (rhat >= base) {
+                break;
+            }
+        }
+
+        // multiply and subtract qhat * v from the current window of u
+        int64_t borrow = 0;
+        for (size_t i = 0; i < n; i++) {
+            uint64_t product = qhat * v[i];
+            int64_t t = static_cast<int64_t>(u[i + j]) - borrow -
+                        static_cast<int64_t>(product & 0xFFFFFFFF);
+            u[i + j] = static_cast<uint32_t>(t);
+            borrow = static_cast<int64_t>(product >> 32) - (t >> 32);
+        }
+        int64_t t = static_cast<int64_t>(u[j + n]) - borrow;
+        u[j + n] = static_cast<uint32_t>(t);
+
+        // qhat was one too large, add the divisor back
+        if (t < 0) {
+            qhat--;
+            uint64_t carry = 0;
+            for (size_t i = 0; i < n; i++) {
+                uint64_t sum = static_cast<uint64_t>(u[i + j]) + v[i] + carry;
+                u[i + j] = static_cast<uint32_t>(sum);
+                carry = sum >> 32;
+            }
+            u[j + n] = static_cast<uint32_t>(u[j + n] + carry);
+        }
+
+        quotient[j] = static_cast<uint32_t>(qhat);
+    }
+
+    Trim(quotient);
+    return quotient;
+}
+
+BigInt::BigInt(int64_t value) {
+    _negative = value < 0;
+    uint64_t magnitude = _negative ? 0 - static_cast<uint64_t>(value) : value;
+    while (magnitude != 0) {
+        _limbs.push_back(static_cast<uint32_t>(magnitude));
+        magnitude >>= 32;
+    }
+}
+
+BigInt BigInt::FromDecimal(const std::string& digits) {
+    // up to 18 digits at a time, which always fit in an int64_t
+    BigInt value;
+    for (size_t i = 0; i < digits.size(); i += 18) {
+        int64_t chunk = 0;
+        int64_t scale = 1;
+        for (size_t j = i; j < std::min(i + 18, digits.size()); j++) {
+            chunk = chunk * 10 + (digits[j] - '0');
+            scale *= 10;
+        }
+        value = value * BigInt(scale) + BigInt(chunk);
+    }
+    return value;
+}
+
+bool BigInt::FitsInt64() const {
+    if (_limbs.size() > 2) {
+        return false;
+    }
+
+    uint64_t magnitude = 0;
+    for (size_t i = _limbs.size(); i-- > 0;) {
+        magnitude = (magnitude << 32) | _limbs[i];
+    }
+
+    uint64_t limit = uint64_t(1) << 63;
+    return _negative ? magnitude <= limit : magnitude < limit;
+}
+
+int64_t BigInt::ToInt64() const {
+    uint64_t magnitude = 0;
+    for (size_t i = _limbs.size(); i-- > 0;) {
+        magnitude = (magnitude << 32) | _limbs[i];
+    }
+
+    return static_cast<int64_t>(_negative ? 0 - magnitude : magnitude);
+}
+
+int BigInt::Compare(const BigInt& other) const {
+    if (_negative != other._negative) {
+        return _negative ? -1 : 1;
+    }
+
+    int magnitude = CompareMagnitude(_limbs, other._limbs);
+    return _negative ? -magnitude : magnitude;
+}
+
+uint64_t BigInt::Hash() const {
+    uint64_t hash = _negative;
+    for (uint32_t limb : _limbs) {
+        hash = (hash << 32 | hash >> 32) ^ limb;
+        hash *= 0x9e3779b97f4a7c15;
+    }
+    return hash;
+}
+
+std::string BigInt::ToString() const {
+    if (IsZero()) {
+        return "0";
+    }
+
+    // peel off nine decimal digits at a time
+    Limbs magnitude = _limbs;
+    std::vector<uint32_t> chunks;
+    while (!magnitude.empty()) {
+        chunks.push_back(DivideSmall(magnitude, 1000000000));
+    }
+
+    std::string result = _negative ? "-" : "";
+    result += std::to_string(chunks.back());
+    for (size_t i = chunks.size() - 1; i-- > 0;) {
+        std::string chunk = std::to_string(chunks[i]);
+        result += std::string(9 - chunk.size(), '0') + chunk;
+    }
+
+    return result;
+}
+
+BigInt BigInt::operator-() const {
+    BigInt result = *this;
+    result._negative = !result.IsZero() && !_negative;
+    return result;
+}
+
+BigInt operator+(const BigInt& left, const BigInt& right) {
+    BigInt result;
+    if (left._negative == right._negative) {
+        result._limbs = AddMagnitude(left._limbs, right._limbs);
+        result._negative = left._negative;
+    } else if (CompareMagnitude(left._limbs, right._limbs) >= 0) {
+        result._limbs = SubtractMagnitude(left._limbs, right._limbs);
+        result._negative = left._negative;
+    } else {
+        result._limbs = SubtractMagnitude(right._limbs, left._limbs);
+        result._negative = right._negative;
+    }
+
+    result._negative = result._negative && !result.IsZero();
+    return result;
+}
+
+BigInt operator-(const BigInt& left, const BigInt& right) { return left + -right; }
+
+BigInt operator*(const BigInt& left, const BigInt& right) {
+    BigInt result;
+    result._limbs = MultiplyMagnitude(left._limbs, right._limbs);
+    result._negative = (left._negative != right._negative) && !result.IsZero();
+    return result;
+}
+
+BigInt operator/(const BigInt& left, const BigInt& right) {
+    BigInt result;
+    result._limbs = DivideMagnitude(left._limbs, right._limbs);
+    result._negative = (left._negative != right._negative) && !result.IsZero();
+    return result;
+}
+
+std::ostream& operator<<(std::ostream& stream, const BigInt& value) {
+    return stream << value.ToString();
+}
@@ -0,0 +1,378 @@
+#include "builtins.h"
+
+#include "evaluator.h"
+#include "kernels.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <sstream>
+
+static ObjectPtr Mismatch(Evaluator& evaluator,
+                          const ObjectPtr* arguments,
+                          size_t argument,
+                          Object::Type expected) {
+    std::stringstream stream;
+    stream << "argument " << argument + 1 << " has type " << arguments[argument]->type
+           << ", expected " << expected;
+    return evaluator.New<Error>(stream.str());
+}
+
+static ObjectPtr BuiltinRange(Evaluator& evaluator, const ObjectPtr* arguments, size_t) {
+    for (size_t i = 0; i < 2; i++) {
+        if (arguments[i]->type != Object::Type::INT) {
+            return Mismatch(evaluator, arguments, i, Object::Type::INT);
+        }
+    }
+
+    return evaluator.New<Range>(static_cast<Integer*>(arguments[0].get())->value,
+                                static_cast<Integer*>(arguments[1].get())->value);
+}
+
+static ObjectPtr BuiltinTake(Evaluator& evaluator, const ObjectPtr* arguments, size_t) {
+    if (arguments[0]->type != Object::Type::ITERATOR) {
+        return Mismatch(evaluator, arguments, 0, Object::Type::ITERATOR);
+    }
+    if (arguments[1]->type != Object::Type::INT) {
+        return Mismatch(evaluator, arguments, 1, Object::Type::INT);
+    }
+
+    return evaluator.New<Take>(arguments[0],
+                               static_cast<Integer*>(arguments[1].get())->value);
+}
+
+// Stays on 64 bits until the total overflows, and exact until the first float, from
+// which on it is a float.
+static ObjectPtr BuiltinSum(Evaluator& evaluator, const ObjectPtr* arguments, size_t) {
+    if (arguments[0]->type == Object::Type::ARRAY) {
+        double total = 0;
+        for (double value : static_cast<FloatArray*>(arguments[0].get())->values) {
+            total += value;
+        }
+        return evaluator.NewFloat(total);
+    }
+    if (arguments[0]->type != Object::Type::ITERATOR) {
+        return Mismatch(evaluator, arguments, 0, Object::Type::ITERATOR);
+    }
+
+    int64_t total = 0;
+    int64_t sum;
+    BigInt big_total;
+    bool big = false;
+    double float_total = 0;
+    bool floating = false;
+    while (ObjectPtr value = evaluator.Next(arguments[0])) {
+        if (value->type == Object::Type::ERROR) {
+            return value;
+        }
+
+        if (value->type == Object::Type::FLOAT && !floating) {
+            float_total = big ? std::strtod(big_total.ToString().c_str(), nullptr)
+                              : static_cast<double>(total);
+            floating = true;
+        }
+
+        if (floating && IsNumber(value)) {
+            float_total += ToDouble(value);
+        } else if (value->type == Object::Type::INT) {
+            int64_t addend = static_cast<Integer*>(value.get())->value;
+            if (big) {
+                big_total = big_total + BigInt(addend);
+            } else if (__builtin_add_overflow(total, addend, &sum)) {
+                big_total = BigInt(total) + BigInt(addend);
+                big = true;
+            } else {
+                total = sum;
+            }
+        } else if (value->type == Object::Type::BIG_INT) {
+            big_total = (big ? big_total : BigInt(total)) +
+                        static_cast<BigInteger*>(value.get())->value;
+            big = true;
+        } else {
+            std::stringstream stream;
+            stream << "cannot sum a value of type " << value->type;
+            return evaluator.New<Error>(stream.str());
+        }
+    }
+
+    if (floating) {
+        return evaluator.NewFloat(float_total);
+    }
+    return big ? evaluator.NewInteger(std::move(big_total)) : evaluator.NewInteger(total);
+}
+
+static ObjectPtr BuiltinFold(Evaluator& evaluator, const ObjectPtr* arguments, size_t) {
+    if (arguments[0]->type != Object::Type::ITERATOR) {
+        return Mismatch(evaluator, arguments, 0, Object::Type::ITERATOR);
+    }
+
+    ObjectPtr step[2] = {arguments[1], nullptr};
+    while (ObjectPtr value = evaluator.Next(arguments[0])) {
+        if (value->type == Object::Type::ERROR) {
+            return value;
+        }
+
+        step[1] = std::move(value);
+        step[0] = evaluator.Call(arguments[2], step, 2);
+        if (step[0]->type == Object::Type::ERROR) {
+            return step[0];
+        }
+    }
+
+    return step[0];
+}
+
+static ObjectPtr NotAKey(Evaluator& evaluator, const ObjectPtr& key) {
+    std::stringstream stream;
+    stream << "unusable as map key: " << key->type;
+    return evaluator.New<Error>(stream.str());
+}
+
+// nil for a missing key or an index outside the array, has tells them apart from a
+// stored nil
+static ObjectPtr BuiltinGet(Evaluator& evaluator, const ObjectPtr* arguments, size_t) {
+    if (arguments[0]->type == Object::Type::ARRAY) {
+        if (arguments[1]->type != Object::Type::INT) {
+            return Mismatch(evaluator, arguments, 1, Object::Type::INT);
+        }
+
+        const auto& values = static_cast<FloatArray*>(arguments[0].get())->values;
+        int64_t index = static_cast<Integer*>(arguments[1].get())->value;
+        if (index < 0 || static_cast<uint64_t>(index) >= values.size()) {
+            return evaluator.GetNil();
+        }
+        return evaluator.New<Float>(values[index]);
+    }
+    if (arguments[0]->type != Object::Type::MAP) {
+        return Mismatch(evaluator, arguments, 0, Object::Type::MAP);
+    }
+    if (!HashTable::IsKey(*arguments[1])) {
+        return NotAKey(evaluator, arguments[1]);
+    }
+
+    const ObjectPtr* value = static_cast<Map*>(arguments[0].get())->table.Find(*arguments[1]);
+    return value != nullptr ? *value : evaluator.GetNil();
+}
+
+static ObjectPtr BuiltinSet(Evaluator& evaluator, const ObjectPtr* arguments, size_t) {
+    if (arguments[0]->type != Object::Type::MAP) {
+        return Mismatch(evaluator, arguments, 0, Object::Type::MAP);
+    }
+    if (!HashTable::IsKey(*arguments[1])) {
+        return NotAKey(evaluator, arguments[1]);
+    }
+
+    static_cast<Map*>(arguments[0].get())->table.Set(arguments[1], arguments[2]);
+    return arguments[2];
+}
+
+static ObjectPtr BuiltinHas(Evaluator& evaluator, const ObjectPtr* arguments, size_t) {
+    if (arguments[0]->type != Object::Type::MAP) {
+        return Mismatch(evaluator, arguments, 0, Object::Type::MAP);
+    }
+    if (!HashTable::IsKey(*arguments[1])) {
+        return NotAKey(evaluator, arguments[1]);
+    }
+
+    return evaluator.NewBoolean(
+        static_cast<Map*>(arguments[0].get())->table.Find(*arguments[1]) != nullptr);
+}
+
+static ObjectPtr BuiltinLen(Evaluator& evaluator, const ObjectPtr* arguments, size_t) {
+    if (arguments[0]->type == Object::Type::STRING) {
+        return evaluator.NewInteger(
+            static_cast<int64_t>(static_cast<String*>(arguments[0].get())->value.size()));
+    }
+    if (arguments[0]->type == Object::Type::ARRAY) {
+        return evaluator.NewInteger(static_cast<int64_t>(
+            static_cast<FloatArray*>(arguments[0].get())->values.size()));
+    }
+    if (arguments[0]->type != Object::Type::MAP) {
+        return Mismatch(evaluator, arguments, 0, Object::Type::MAP);
+    }
+
+    return evaluator.NewInteger(
+        static_cast<int64_t>(static_cast<Map*>(arguments[0].get())->table.Size()));
+}
+
+static ObjectPtr BuiltinKeys(Evaluator& evaluator, const ObjectPtr* arguments, size_t) {
+    if (arguments[0]->type != Object::Type::MAP) {
+        return Mismatch(evaluator, arguments, 0, Object::Type::MAP);
+    }
+
+    return evaluator.New<Keys>(arguments[0]);
+}
+
+// the numbers of an iterator, as floats
+static ObjectPtr BuiltinFloats(Evaluator& evaluator, const ObjectPtr* arguments, size_t) {
+    if (arguments[0]->type != Object::Type::ITERATOR) {
+        return Mismatch(evaluator, arguments, 0, Object::Type::ITERATOR);
+    }
+
+    std::shared_ptr<FloatArray> array = evaluator.NewArray();
+    while (ObjectPtr value = evaluator.Next(arguments[0])) {
+        if (value->type == Object::Type::ERROR) {
+            return value;
+        }
+        if (!IsNumber(value)) {
+            std::stringstream stream;
+            stream << "cannot store a value of type " << value->type << " in an array";
+            return evaluator.New<Error>(stream.str());
+        }
+
+        array->values.push_back(ToDouble(value));
+    }
+
+    return array;
+}
+
+// A float for a number, an array of the results for each element of an array, which
+// the kernel runs over without boxing them.
+template <MathFunction F>
+static ObjectPtr BuiltinMath(Evaluator& evaluator, const ObjectPtr* arguments, size_t) {
+    if (arguments[0]->type == Object::Type::ARRAY) {
+        const auto& values = static_cast<FloatArray*>(arguments[0].get())->values;
+        std::shared_ptr<FloatArray> result = evaluator.NewArray();
+        result->values.resize(values.size());
+        ApplyMath(F, values.data(), result->values.data(), values.size());
+        return evaluator.Finite(std::move(result));
+    }
+    if (!IsNumber(arguments[0])) {
+        return Mismatch(evaluator, arguments, 0, Object::Type::FLOAT);
+    }
+
+    double value = ToDouble(arguments[0]);
+    ApplyMath(F, &value, &value, 1);
+    return evaluator.NewFloat(value);
+}
+
+// elementwise for arrays of the same length, a number is used for every element
+static ObjectPtr BuiltinPow(Evaluator& evaluator, const ObjectPtr* arguments, size_t) {
+    const double* operands[2];
+    size_t steps[2];
+    double numbers[2];
+    const FloatArray* array = nullptr;
+    for (size_t i = 0; i < 2; i++) {
+        if (arguments[i]->type == Object::Type::ARRAY) {
+            const FloatArray* operand = static_cast<FloatArray*>(arguments[i].get());
+            if (array != nullptr && operand->values.size() != array->values.size()) {
+                return evaluator.New<Error>("arrays differ in length");
+            }
+            array = operand;
+            operands[i] = operand->values.data();
+            steps[i] = 1;
+        } else if (IsNumber(arguments[i])) {
+            numbers[i] = ToDouble(arguments[i]);
+            operands[i] = &numbers[i];
+            steps[i] = 0;
+        } else {
+            return Mismatch(evaluator, arguments, i, Object::Type::FLOAT);
+        }
+    }
+
+    if (array == nullptr) {
+        double value;
+        ApplyPow(operands[0], 0, operands[1], 0, &value, 1);
+        return evaluator.NewFloat(value);
+    }
+
+    std::shared_ptr<FloatArray> result = evaluator.NewArray();
+    result->values.resize(array->values.size());
+    ApplyPow(operands[0], steps[0], operands[1], steps[1], result->values.data(),
+             result->values.size());
+    return evaluator.Finite(std::move(result));
+}
+
+static ObjectPtr BuiltinReadFileAsync(Evaluator& evaluator, const ObjectPtr* arguments, size_t) {
+    if (arguments[0]->type != Object::Type::STRING) {
+        return Mismatch(evaluator, arguments, 0, Object::Type::STRING);
+    }
+
+    auto request = std::make_shared<IoRequest>(IoRequest::Kind::READ,
+                                               static_cast<String*>(arguments[0].get())->value);
+    evaluator.GetIo().Submit(request);
+    return evaluator.New<Future>(std::move(request));
+}
+
+static ObjectPtr BuiltinWriteFileAsync(Evaluator& evaluator, const ObjectPtr* arguments, size_t) {
+    for (size_t i = 0; i < 2; i++) {
+        if (arguments[i]->type != Object::Type::STRING) {
+            return Mismatch(evaluator, arguments, i, Object::Type::STRING);
+        }
+    }
+
+    auto request = std::make_shared<IoRequest>(IoRequest::Kind::WRITE,
+                                               static_cast<String*>(arguments[0].get())->value,
+                                               static_cast<String*>(arguments[1].get())->value);
+    evaluator.GetIo().Submit(request);
+    return evaluator.New<Future>(std::move(request));
+}
+
+// the contents read or the number of bytes written, waiting if they are not there yet
+static ObjectPtr BuiltinAwait(Evaluator& evaluator, const ObjectPtr* arguments, size_t) {
+    if (arguments[0]->type != Object::Type::FUTURE) {
+        return Mismatch(evaluator, arguments, 0, Object::Type::FUTURE);
+    }
+
+    Future* future = static_cast<Future*>(arguments[0].get());
+    if (future->result != nullptr) {
+        return future->result;
+    }
+
+    IoRequest& request = *future->request;
+    evaluator.GetIo().Wait(request);
+    if (request.error != 0) {
+        future->result = evaluator.New<Error>(
+            std::string(request.kind == IoRequest::Kind::READ ? "cannot read " : "cannot write ") +
+            request.path + ": " + std::strerror(request.error));
+    } else if (request.kind == IoRequest::Kind::READ) {
+        future->result = evaluator.New<String>(std::move(request.data));
+    } else {
+        future->result = evaluator.NewInteger(static_cast<int64_t>(request.offset));
+    }
+
+    return future->result;
+}
+
+void InstallBuiltins(Evaluator& evaluator, Environment& environment) {
+    environment.Set("range", evaluator.New<Builtin>("range", 2, &BuiltinRange));
+    environment.Set("take", evaluator.New<Builtin>("take", 2, &BuiltinTake));
+    environment.Set("sum", evaluator.New<Builtin>("sum", 1, &BuiltinSum));
+    environment.Set("fold", evaluator.New<Builtin>("fold", 3, &BuiltinFold));
+    environment.Set("get", evaluator.New<Builtin>("get", 2, &BuiltinGet));
+    environment.Set("set", evaluator.New<Builtin>("set", 3, &BuiltinSet));
+    environment.Set("has", evaluator.New<Builtin>("has", 2, &BuiltinHas));
+    environment.Set("len", evaluator.New<Builtin>("len", 1, &BuiltinLen));
+    environment.Set("keys", evaluator.New<Builtin>("keys", 1, &BuiltinKeys));
+    environment.Set("floats", evaluator.New<Builtin>("floats", 1, &BuiltinFloats));
+    environment.Set("sqrt",
+                    evaluator.New<Builtin>("sqrt", 1, &BuiltinMath<MathFunction::SQRT>));
+    environment.Set("exp", evaluator.New<Builtin>("exp", 1, &BuiltinMath<MathFunction::EXP>));
+    environment.Set("log", evaluator.New<Builtin>("log", 1, &BuiltinMath<MathFunction::LOG>));
+    environment.Set("floor",
+                    evaluator.New<Builtin>("floor", 1, &BuiltinMath<MathFunction::FLOOR>));
+    environment.Set("pow", evaluator.New<Builtin>("pow", 2, &BuiltinPow));
+    environment.Set("read_file_async",
+                    evaluator.New<Builtin>("read_file_async", 1, &BuiltinReadFileAsync));
+    environment.Set("write_file_async",
+                    evaluator.New<Builtin>("write_file_async", 2, &BuiltinWriteFileAsync));
+    environment.Set("await", evaluator.New<Builtin>("await", 1, &BuiltinAwait));
+}
+
+bool IsPureBuiltin(const Builtin& builtin) {
+    static const NativeFunction pure[] = {
+        &BuiltinRange,
+        &BuiltinGet,
+        &BuiltinHas,
+        &BuiltinLen,
+        &BuiltinKeys,
+        &BuiltinMath<MathFunction::SQRT>,
+        &BuiltinMath<MathFunction::EXP>,
+        &BuiltinMath<MathFunction::LOG>,
+        &BuiltinMath<MathFunction::FLOOR>,
+        &BuiltinPow,
+    };
+
+    return std::find(std::begin(pure), std::end(pure), builtin.function) != std::end(pure);
+}
@@ -2,6 +2,19 @@
 
 
 std::shared_ptr<Object> Environment::Get(const std::string& name) const {
+    if (stack != nullptr) {
+        for (size_t i = base; i < end; i++) {
+            const Binding& binding = (*stack)[i];
+            if (*binding.name == name && binding.value != nullptr) {
+                return binding.value;
+            }
+        }
+    }
+
+    if (self_name != nullptr && *self_name == name) {
+        return self.lock();
+    }
+
     auto it = store.find(name);
     if (it != store.end()) {
         return it->second;
@@ -15,20 +28,156 @@ std::shared_ptr<Object> Environment::Get(const std::string& name) const {
 }
 
 void Environment::Set(const std::string& name, std::shared_ptr<Object> value) {
+    if (stack != nullptr) {
+        for (size_t i = base; i < end; i++) {
+            Binding& binding = (*stack)[i];
+            if (*binding.name == name) {
+                binding.value = std::move(value);
+                return;
+            }
+        }
+
+        // new locals are pushed as long as this frame is still the top of the stack,
+        // otherwise (a let nested in an argument of a pending call) they spill
+        if (end == stack->size() && stack->size() < stack->capacity()) {
+            stack->push_back({&name, std::move(value)});
+            end++;
+            return;
+        }
+    }
+
+    if (self_name != nullptr && *self_name == name) {
+        self_name = nullptr;
+        self.reset();
+    }
     store[name] = value;
 }
 
+void Environment::SetSelf(const std::string& name, const std::shared_ptr<Object>& function) {
+    // function may belong to the binding that is replaced
+    self = function;
+    self_name = &name;
+    store.erase(name);
+}
+
 void Environment::Remove(const std::string& name) {
+    if (stack != nullptr) {
+        for (size_t i = base; i < end; i++) {
+            Binding& binding = (*stack)[i];
+            if (*binding.name == name) {
+                binding.value = nullptr;
+            }
+        }
+    }
+
+    if (self_name != nullptr && *self_name == name) {
+        self_name = nullptr;
+        self.reset();
+    }
     store.erase(name);
 }
 
+bool Environment::Assign(const std::string& name, std::shared_ptr<Object> value) {
+    if (stack != nullptr) {
+        for (size_t i = base; i < end; i++) {
+            Binding& binding = (*stack)[i];
+            if (*binding.name == name && binding.value != nullptr) {
+                binding.value = std::move(value);
+                return true;
+            }
+        }
+    }
+
+    if (self_name != nullptr && *self_name == name) {
+        self_name = nullptr;
+        self.reset();
+        store[name] = std::move(value);
+        return true;
+    }
+
+    auto it = store.find(name);
+    if (it != store.end()) {
+        it->second = std::move(value);
+        return true;
+    }
+
+    if (outer != nullptr) {
+        return outer->Assign(name, std::move(value));
+    }
+
+    return false;
+}
+
+std::shared_ptr<Environment> Environment::Capture(
+    Heap& heap, const std::vector<const std::string*>& names) const {
+    std::shared_ptr<Environment> captured =
+        std::allocate_shared<Environment>(HeapAllocator<Environment>(&heap, Heap::ENVIRONMENT),
+                                          outer);
+    captured->store.reserve(names.size());
+
+    for (const std::string* name : names) {
+        // a frame's slot shadows a spilled binding of the same name
+        const std::shared_ptr<Object>* value = nullptr;
+        if (stack != nullptr) {
+            for (size_t i = base; i < end && value == nullptr; i++) {
+                const Binding& binding = (*stack)[i];
+                if (*binding.name == *name && binding.value != nullptr) {
+                    value = &binding.value;
+                }
+            }
+        }
+        if (value == nullptr) {
+            auto it = store.find(*name);
+            if (it != store.end()) {
+                value = &it->second;
+            }
+        }
+
+        if (value != nullptr) {
+            captured->store.emplace(*name, *value);
+            continue;
+        }
+
+        // the closure may outlive the function that names it, unlike its own frames
+        for (const Environment* environment = this; environment != nullptr;
+             environment = environment->outer.get()) {
+            if (environment->self_name != nullptr && *environment->self_name == *name) {
+                if (std::shared_ptr<Object> function = environment->self.lock()) {
+                    captured->store.emplace(*name, std::move(function));
+                }
+                break;
+            }
+            if (environment != this && environment->store.count(*name) != 0) {
+                break;
+            }
+        }
+    }
+
+    return captured;
+}
+
 std::ostream& operator<<(std::ostream& stream, const Environment& environment) {
     stream << "Environment(";
+    bool first = true;
+    if (environment.stack != nullptr) {
+        for (size_t i = environment.base; i < environment.end; i++) {
+            const Binding& binding = (*environment.stack)[i];
+            if (binding.value == nullptr) {
+                continue;
+            }
+            if (!first) {
+                stream << ", ";
+            }
+            stream << *binding.name << ": " << *binding.value;
+            first = false;
+        }
+    }
     for (auto it = environment.store.begin(); it != environment.store.end(); it++) {
-        stream << it->first << ": " << *it->second;
-        if (std::next(it) != environment.store.end()) {
+        if (!first) {
             stream << ", ";
         }
+        stream << it->first << ": " << *it->second;
+        first = false;
     }
     stream << ")";
     return stream;
@@ -1,41 +1,286 @@
 #include "evaluator.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
 #include <sstream>
+#include <thread>
 
-std::shared_ptr TRUE = std::make_shared<Boolean>(true);
-std::shared_ptr FALSE = std::make_shared<Boolean>(false);
-std::shared_ptr NIL = std::make_shared<Nil>();
+BigInt ToBigInt(const ObjectPtr& object) {
+    if (object->type == Object::Type::INT) {
+        return BigInt(static_cast<Integer*>(object.get())->value);
+    }
+    return static_cast<BigInteger*>(object.get())->value;
+}
 
-bool IsTruthy(ObjectPtr object) {
-    if (object == TRUE) {
-        return true;
+bool IsInteger(const ObjectPtr& object) {
+    return object->type == Object::Type::INT || object->type == Object::Type::BIG_INT;
+}
+
+bool IsNumber(const ObjectPtr& object) {
+    return IsInteger(object) || object->type == Object::Type::FLOAT;
+}
+
+double ToDouble(const ObjectPtr& object) {
+    switch (object->type) {
+    case Object::Type::INT:
+        return static_cast<double>(static_cast<Integer*>(object.get())->value);
+    case Object::Type::BIG_INT:
+        return std::strtod(static_cast<BigInteger*>(object.get())->value.ToString().c_str(),
+                           nullptr);
+    default:
+        return static_cast<Float*>(object.get())->value;
     }
-    if (object == FALSE) {
-        return false;
+}
+
+ObjectPtr Evaluator::NewInteger(int64_t value) {
+    if (SMALL_INT_MIN <= value && value <= SMALL_INT_MAX) {
+        return _small_ints[value - SMALL_INT_MIN];
     }
-    if (object == NIL) {
-        return false;
+    return New<Integer>(value);
+}
+
+// results that fit in 64 bits again are always demoted, so a BigInteger never
+// holds a value an Integer could
+ObjectPtr Evaluator::NewInteger(BigInt value) {
+    if (value.FitsInt64()) {
+        return NewInteger(value.ToInt64());
     }
-    if (object->type == Object::Type::INT) {
+    return New<BigInteger>(std::move(value));
+}
+
+ObjectPtr Evaluator::NewFloat(double value) {
+    if (!std::isfinite(value)) {
+        return New<Error>("float result is not a finite number");
+    }
+    return New<Float>(value);
+}
+
+ObjectPtr Evaluator::Finite(std::shared_ptr<FloatArray> array) {
+    for (double value : array->values) {
+        if (!std::isfinite(value)) {
+            return NewFloat(value);
+        }
+    }
+    return array;
+}
+
+std::shared_ptr<Instance> Evaluator::NewInstance(const Shape* shape,
+                                                 std::shared_ptr<AstArena> arena) {
+    // one allocation for the object and its fields, the control block comes on top
+    size_t size = sizeof(Instance) + shape->fields.size() * sizeof(ObjectPtr);
+    std::byte* memory = HeapAllocator<std::byte>(&_heap, Object::Type::INSTANCE).allocate(size);
+    Instance* instance = new (memory) Instance(shape, std::move(arena));
+
+    Heap* heap = &_heap;
+    return std::shared_ptr<Instance>(
+        instance,
+        [heap, size](Instance* instance) {
+            instance->~Instance();
+            HeapAllocator<std::byte>(heap, Object::Type::INSTANCE)
+                .deallocate(reinterpret_cast<std::byte*>(instance), size);
+        },
+        HeapAllocator<Instance>(&_heap, Object::Type::INSTANCE));
+}
+
+EnvironmentPtr Evaluator::NewEnvironment() {
+    return std::allocate_shared<Environment>(
+        HeapAllocator<Environment>(&_heap, Heap::ENVIRONMENT));
+}
+
+bool IsTruthy(const ObjectPtr& object) {
+    switch (object->type) {
+    case Object::Type::BOOL:
+        return static_cast<Boolean*>(object.get())->value;
+    case Object::Type::NIL:
+        return false;
+    case Object::Type::INT:
         return static_cast<Integer*>(object.get())->value != 0;
+    case Object::Type::FLOAT:
+        return static_cast<Float*>(object.get())->value != 0;
+    default:
+        return true;
     }
+}
 
-    return true;
+Evaluator::Evaluator()
+    : _true(std::make_shared<Boolean>(true)), _false(std::make_shared<Boolean>(false)),
+      _nil(std::make_shared<Nil>()) {
+    for (int64_t value = SMALL_INT_MIN; value <= SMALL_INT_MAX; value++) {
+        _small_ints.push_back(std::make_shared<Integer>(value));
+    }
+
+    _stack.reserve(FRAME_STACK_SIZE);
+}
+
+IoLoop& Evaluator::GetIo() {
+    if (_io == nullptr) {
+        _io = std::make_unique<IoLoop>();
+    }
+    return *_io;
+}
+
+// the start of a statement, enough to tell which one it is in a trace
+static std::string Describe(const Statement& statement) {
+    static constexpr size_t LENGTH = 80;
+
+    std::stringstream stream;
+    stream << statement;
+    std::string text = stream.str();
+    if (text.size() > LENGTH) {
+        text.resize(LENGTH);
+        text += "...";
+    }
+    return text;
 }
 
 ObjectPtr Evaluator::Evaluate(const Program& node, EnvironmentPtr environment) {
+    char stack_base = 0;
+    Start(&stack_base);
+    const std::shared_ptr<AstArena>* arena = _arena;
+    _arena = &node.arena;
+
     ObjectPtr result;
     for (const Statement* statement : node.statements) {
-        result = EvalStatement(statement, environment);
+        TraceSpan span("statement", "eval");
+        if (span.IsActive()) {
+            span.detail = Describe(*statement);
+        }
+
+        result = EvalStatement(statement, *environment);
         if (result->type == Object::Type::ERROR) {
-            return result;
+            break;
+        }
+    }
+
+    _arena = arena;
+    _running = false;
+    if (_profiler != nullptr) {
+        _profiler->Drain();
+    }
+
+    return result;
+}
+
+ObjectPtr Evaluator::EvaluateStatement(const Program& program,
+                                       size_t index,
+                                       Environment& environment,
+                                       Dependencies& dependencies) {
+    char stack_base = 0;
+    Start(&stack_base);
+    const std::shared_ptr<AstArena>* arena = _arena;
+    _arena = &program.arena;
+    _tracked = &environment;
+    _dependencies = &dependencies;
+
+    const Statement* statement = program.statements[index];
+    ObjectPtr result;
+    {
+        TraceSpan span("statement", "eval");
+        if (span.IsActive()) {
+            span.detail = Describe(*statement);
         }
+
+        result = EvalStatement(statement, environment);
+    }
+
+    _tracked = nullptr;
+    _dependencies = nullptr;
+    _arena = arena;
+    _running = false;
+    if (_profiler != nullptr) {
+        _profiler->Drain();
+    }
+
+    return result;
+}
+
+void Dependencies::Read(const std::string* name) {
+    if (std::find(writes.begin(), writes.end(), name) == writes.end() &&
+        std::find(reads.begin(), reads.end(), name) == reads.end()) {
+        reads.push_back(name);
     }
+}
+
+void Dependencies::Write(const std::string* name) {
+    if (std::find(writes.begin(), writes.end(), name) == writes.end()) {
+        writes.push_back(name);
+    }
+}
+
+ObjectPtr
+Evaluator::Call(const ObjectPtr& function, const ObjectPtr* arguments, size_t count) {
+    if (_running) {
+        return Invoke(function, arguments, count);
+    }
+
+    char stack_base = 0;
+    Start(&stack_base);
+    ObjectPtr result = Invoke(function, arguments, count);
+    _running = false;
 
     return result;
 }
 
+void Evaluator::Start(const char* stack_base) {
+    _running = true;
+    _stack_base = stack_base;
+    _fuel = 0;
+    _batch = 0;
+    _steps = 0;
+    _exhausted = nullptr;
+    if (_limits.time.count() != 0) {
+        _deadline = std::chrono::steady_clock::now() + _limits.time;
+    }
+}
+
+bool Evaluator::Refuel() {
+    if (_exhausted != nullptr) {
+        _fuel = 0;
+        return false;
+    }
+
+    // samples point into the program, fold them before the buffer fills up
+    if (_profiler != nullptr && _profiler->Pending()) {
+        _profiler->Drain();
+    }
+
+    // the previous batch is used up and the current step needs a new one
+    _steps += _batch;
+    _batch = CHECK_INTERVAL;
+
+    if (_limits.steps != 0) {
+        if (_steps >= _limits.steps) {
+            _exhausted = std::make_shared<Error>(
+                "step limit of " + std::to_string(_limits.steps) + " exceeded");
+        }
+        _batch = std::min(_batch, _limits.steps - _steps);
+    }
+    if (_limits.objects != 0 && _heap.objects > _limits.objects) {
+        _exhausted = std::make_shared<Error>(
+            "object limit of " + std::to_string(_limits.objects) + " exceeded");
+    }
+    if (_limits.bytes != 0 && _heap.bytes > _limits.bytes) {
+        _exhausted = std::make_shared<Error>(
+            "memory limit of " + std::to_string(_limits.bytes) + " bytes exceeded");
+    }
+    if (_limits.time.count() != 0 && std::chrono::steady_clock::now() > _deadline) {
+        _exhausted = std::make_shared<Error>(
+            "time limit of " + std::to_string(_limits.time.count()) + "ms exceeded");
+    }
+
+    if (_exhausted != nullptr) {
+        _batch = 0;
+        _fuel = 0;
+        return false;
+    }
+
+    _fuel = _batch - 1;
+    return true;
+}
+
 ObjectPtr Evaluator::EvalStatement(Statement const* statement,
-                                   EnvironmentPtr environment) {
+                                   Environment& environment) {
     switch (statement->type) {
     case Statement::Type::LET:
         return EvalLet(static_cast<LetStatement const*>(statement), environment);
@@ -44,40 +289,52 @@ ObjectPtr Evaluator::EvalStatement(Statement const* statement,
     case Statement::Type::EXPRESSION:
         return EvalExpressionStatement(static_cast<ExpressionStatement const*>(statement),
                                        environment);
+    case Statement::Type::YIELD:
+        // generators run their statements through Resume, this is a yield nested in
+        // an expression which cannot be suspended
+        return New<Error>("yield is only allowed in statements of a generator's body");
     }
 
-    return std::make_shared<Error>("found impossible statement type");
+    return New<Error>("found impossible statement type");
 }
 
-ObjectPtr Evaluator::EvalLet(LetStatement const* node, EnvironmentPtr environment) {
+ObjectPtr Evaluator::EvalLet(LetStatement const* node, Environment& environment) {
     ObjectPtr value = EvalExpression(node->value, environment);
-    if (value->type == Object::Type::ERROR) {
+    if (IsAbrupt(value)) {
         return value;
     }
     if (value->type == Object::Type::FUNCTION) {
         Function* function = static_cast<Function*>(value.get());
-        function->environment->Set(node->name->value, value);
+        function->environment->SetSelf(node->name->value, value);
     }
 
-    environment->Set(node->name->value, value);
+    TrackWrite(node->name->value, environment);
+    environment.Set(node->name->value, value);
 
-    return NIL;
+    return _nil;
 }
 
-ObjectPtr Evaluator::EvalReturn(ReturnStatement const* node, EnvironmentPtr environment) {
+ObjectPtr Evaluator::EvalReturn(ReturnStatement const* node, Environment& environment) {
     ObjectPtr value = EvalExpression(node->value, environment);
-    return std::make_shared<Return>(value);
+    if (IsAbrupt(value)) {
+        return value;
+    }
+
+    _signal = Signal::RETURN;
+    return value;
 }
 
 ObjectPtr Evaluator::EvalExpressionStatement(ExpressionStatement const* node,
-                                             EnvironmentPtr environment) {
+                                             Environment& environment) {
     return EvalExpression(node->expression, environment);
 }
 
-ObjectPtr Evaluator::EvalExpression(Expression const* node, EnvironmentPtr environment) {
+ObjectPtr Evaluator::EvalExpression(Expression const* node, Environment& environment) {
     switch (node->type) {
     case Expression::Type::INT:
         return EvalIntLiteral(static_cast<IntegerLiteral const*>(node));
+    case Expression::Type::STRING:
+        return New<String>(static_cast<StringLiteral const*>(node)->value);
     case Expression::Type::BOOLEAN:
         return EvalBoolLiteral(static_cast<BooleanLiteral const*>(node));
     case Expression::Type::PREFIX:
@@ -94,102 +351,499 @@ ObjectPtr Evaluator::EvalExpression(Expression const* node, EnvironmentPtr envir
         return EvalFunction(static_cast<FunctionExpression const*>(node), environment);
     case Expression::Type::CALL:
         return EvalCall(static_cast<CallExpression const*>(node), environment);
+    case Expression::Type::STRUCT:
+        return New<StructType>(&static_cast<StructExpression const*>(node)->shape, *_arena);
+    case Expression::Type::FIELD:
+        return EvalField(static_cast<FieldExpression const*>(node), environment);
+    case Expression::Type::ASSIGN:
+        return EvalAssign(static_cast<AssignExpression const*>(node), environment);
+    case Expression::Type::WHILE:
+        return EvalWhile(static_cast<WhileExpression const*>(node), environment);
+    case Expression::Type::FOR:
+        return EvalFor(static_cast<ForExpression const*>(node), environment);
+    case Expression::Type::MAP:
+        return EvalMap(static_cast<MapExpression const*>(node), environment);
+    case Expression::Type::FLOAT:
+        return New<Float>(static_cast<FloatLiteral const*>(node)->value);
+    case Expression::Type::BIG_INT:
+        return NewInteger(static_cast<BigIntLiteral const*>(node)->value);
     }
 
-    return std::make_shared<Error>("found impossible expression type");
+    return New<Error>("found impossible expression type");
 }
 
 ObjectPtr Evaluator::EvalIntLiteral(IntegerLiteral const* node) {
-    return std::make_shared<Integer>(node->value);
+    return NewInteger(node->value);
 }
 
 ObjectPtr Evaluator::EvalBoolLiteral(BooleanLiteral const* node) {
-    return node->value ? TRUE : FALSE;
+    return NewBoolean(node->value);
 }
 
-ObjectPtr Evaluator::EvalIdentifier(Identifier const* node, EnvironmentPtr environment) {
-    ObjectPtr value = environment->Get(node->value);
+ObjectPtr Evaluator::EvalIdentifier(Identifier const* node, Environment& environment) {
+    TrackRead(node->value, environment);
+    ObjectPtr value = environment.Get(node->value);
     if (value == nullptr) {
-        return std::make_shared<Error>("identifier not found: " + node->value);
+        return New<Error>("identifier not found: " + node->value);
     }
 
     return value;
 }
 
 ObjectPtr Evaluator::EvalPrefix(PrefixExpression const* node,
-                                EnvironmentPtr environment) {
+                                Environment& environment) {
     ObjectPtr right = EvalExpression(node->right, environment);
-    if (right->type == Object::Type::ERROR) {
+    if (IsAbrupt(right)) {
         return right;
     }
 
     switch (node->op) {
     case PrefixExpression::Operation::NOT:
-        return IsTruthy(right) ? FALSE : TRUE;
+        return NewBoolean(!IsTruthy(right));
     case PrefixExpression::Operation::NEGATE:
-        return std::make_shared<Integer>(-static_cast<Integer*>(right.get())->value);
+        if (right->type == Object::Type::INT) {
+            int64_t value = static_cast<Integer*>(right.get())->value;
+            int64_t result;
+            if (__builtin_sub_overflow(0, value, &result)) {
+                return NewInteger(-BigInt(value));
+            }
+            return NewInteger(result);
+        }
+        if (right->type == Object::Type::BIG_INT) {
+            return NewInteger(-static_cast<BigInteger*>(right.get())->value);
+        }
+        if (right->type == Object::Type::FLOAT) {
+            return New<Float>(-static_cast<Float*>(right.get())->value);
+        }
+
+        std::stringstream stream;
+        stream << "type mismatch for \"" << node->op << "\", found " << right->type;
+        return New<Error>(stream.str());
+    }
+
+    return New<Error>("found impossible prefix operator");
+}
+
+InfixExpression::Specialization Specialize(InfixExpression const* node,
+                                           const ObjectPtr& left,
+                                           const ObjectPtr& right) {
+    if (left->type == Object::Type::INT && right->type == Object::Type::INT) {
+        if (node->left->type == Expression::Type::IDENT &&
+            node->right->type == Expression::Type::INT) {
+            return InfixExpression::Specialization::INT_CONSTANT;
+        }
+        return InfixExpression::Specialization::INT_INT;
+    }
+
+    if (left->type == Object::Type::BOOL && right->type == Object::Type::BOOL) {
+        return InfixExpression::Specialization::BOOL_BOOL;
+    }
+
+    if (left->type == Object::Type::FLOAT && right->type == Object::Type::FLOAT) {
+        return InfixExpression::Specialization::FLOAT_FLOAT;
     }
 
-    return std::make_shared<Error>("found impossible prefix operator");
+    return InfixExpression::Specialization::GENERIC;
 }
 
-ObjectPtr Evaluator::EvalInfix(InfixExpression const* node, EnvironmentPtr environment) {
+ObjectPtr Evaluator::EvalInfix(InfixExpression const* node, Environment& environment) {
+    if (node->specialization == InfixExpression::Specialization::INT_CONSTANT) {
+        const std::string& name = static_cast<Identifier const*>(node->left)->value;
+        TrackRead(name, environment);
+        ObjectPtr left = environment.Get(name);
+        if (left != nullptr && left->type == Object::Type::INT) {
+            return EvalIntInfix(static_cast<Integer*>(left.get())->value,
+                                static_cast<IntegerLiteral const*>(node->right)->value,
+                                node->op);
+        }
+
+        // both operands are free of side effects, so they can simply be redone
+        node->specialization = InfixExpression::Specialization::GENERIC;
+    }
+
+    if (_pool != nullptr) {
+        ObjectPtr result = Fork(node, environment);
+        if (result != nullptr) {
+            return result;
+        }
+    }
+
     ObjectPtr left = EvalExpression(node->left, environment);
-    if (left->type == Object::Type::ERROR) {
+    if (IsAbrupt(left)) {
         return left;
     }
     ObjectPtr right = EvalExpression(node->right, environment);
-    if (right->type == Object::Type::ERROR) {
+    if (IsAbrupt(right)) {
         return right;
     }
 
+    switch (node->specialization) {
+    case InfixExpression::Specialization::INT_INT:
+        if (left->type == Object::Type::INT && right->type == Object::Type::INT) {
+            return EvalIntInfix(static_cast<Integer*>(left.get())->value,
+                                static_cast<Integer*>(right.get())->value,
+                                node->op);
+        }
+        node->specialization = InfixExpression::Specialization::GENERIC;
+        break;
+    case InfixExpression::Specialization::BOOL_BOOL:
+        if (left->type == Object::Type::BOOL && right->type == Object::Type::BOOL) {
+            return EvalBoolInfix(left, right, node->op);
+        }
+        node->specialization = InfixExpression::Specialization::GENERIC;
+        break;
+    case InfixExpression::Specialization::FLOAT_FLOAT:
+        if (left->type == Object::Type::FLOAT && right->type == Object::Type::FLOAT) {
+            return EvalFloatInfix(static_cast<Float*>(left.get())->value,
+                                  static_cast<Float*>(right.get())->value,
+                                  node->op);
+        }
+        node->specialization = InfixExpression::Specialization::GENERIC;
+        break;
+    case InfixExpression::Specialization::UNINITIALIZED:
+        node->specialization = Specialize(node, left, right);
+        break;
+    default:
+        break;
+    }
+
+    return EvalInfixValues(left, right, node->op);
+}
+
+// Expressions that can be evaluated out of order, as they call nothing
+static bool IsCallFree(const Expression* node) {
+    switch (node->type) {
+    case Expression::Type::IDENT:
+    case Expression::Type::INT:
+    case Expression::Type::BIG_INT:
+    case Expression::Type::FLOAT:
+    case Expression::Type::STRING:
+    case Expression::Type::BOOLEAN:
+        return true;
+    case Expression::Type::PREFIX:
+        return IsCallFree(static_cast<PrefixExpression const*>(node)->right);
+    case Expression::Type::INFIX: {
+        const InfixExpression* infix = static_cast<InfixExpression const*>(node);
+        return IsCallFree(infix->left) && IsCallFree(infix->right);
+    }
+    case Expression::Type::FIELD:
+        return IsCallFree(static_cast<FieldExpression const*>(node)->object);
+    default:
+        return false;
+    }
+}
+
+// Evaluates the right operand as a forked call while this thread evaluates the left
+// one, nullptr if the operands are not calls that can run in either order. Both run
+// a fork level deeper.
+ObjectPtr Evaluator::Fork(InfixExpression const* node, Environment& environment) {
+    if (_fork_depth >= _pool->GetMaxDepth() || node->left->type != Expression::Type::CALL ||
+        node->right->type != Expression::Type::CALL) {
+        return nullptr;
+    }
+    if (_limits.steps != 0 || _limits.objects != 0 || _limits.bytes != 0 ||
+        _limits.time.count() != 0) {
+        return nullptr;
+    }
+
+    CallExpression const* right_call = static_cast<CallExpression const*>(node->right);
+    if (Forkable(static_cast<CallExpression const*>(node->left), environment) == nullptr) {
+        return nullptr;
+    }
+    ObjectPtr function = Forkable(right_call, environment);
+    if (function == nullptr) {
+        return nullptr;
+    }
+
+    ForkedCall call;
+    call.function = std::move(function);
+    call.count = right_call->arguments.size();
+    call.depth = _fork_depth + 1;
+    for (size_t i = 0; i < call.count; i++) {
+        ObjectPtr argument = EvalExpression(right_call->arguments[i], environment);
+        // evaluated once more in order, so the left operand's error comes first
+        if (IsAbrupt(argument)) {
+            return nullptr;
+        }
+        call.arguments[i] = std::move(argument);
+    }
+
+    _pool->Push(_queue, &call);
+    size_t depth = _fork_depth;
+    _fork_depth = call.depth;
+    ObjectPtr left = EvalExpression(node->left, environment);
+    _fork_depth = depth;
+
+    ObjectPtr right;
+    if (_pool->Pop(_queue, &call)) {
+        if (IsAbrupt(left)) {
+            return left;
+        }
+        right = RunHere(call);
+    } else {
+        Join(call);
+        if (IsAbrupt(left)) {
+            return left;
+        }
+        right = Joined(call);
+    }
+    if (IsAbrupt(right)) {
+        return right;
+    }
+
+    return EvalInfixValues(left, right, node->op);
+}
+
+// The result of a call another thread ran, as an object of this evaluator
+ObjectPtr Evaluator::Joined(ForkedCall& call) {
+    if (!call.copied) {
+        // pure, so it can simply be redone where its result may live
+        return RunHere(call);
+    }
+
+    switch (call.type) {
+    case Object::Type::INT:
+        return NewInteger(call.integer);
+    case Object::Type::BIG_INT:
+        return NewInteger(std::move(call.big));
+    case Object::Type::FLOAT:
+        return New<Float>(call.number);
+    case Object::Type::BOOL:
+        return NewBoolean(call.integer != 0);
+    case Object::Type::STRING:
+        return New<String>(std::move(call.text));
+    case Object::Type::ERROR:
+        return New<Error>(std::move(call.text));
+    default:
+        return _nil;
+    }
+}
+
+// the function a call would call if it can be forked, nullptr if not
+ObjectPtr Evaluator::Forkable(CallExpression const* node, Environment& environment) {
+    if (node->function->type != Expression::Type::IDENT ||
+        node->arguments.size() > MAX_NATIVE_ARGUMENTS) {
+        return nullptr;
+    }
+    for (const Expression* argument : node->arguments) {
+        if (!IsCallFree(argument)) {
+            return nullptr;
+        }
+    }
+
+    const std::string& name = static_cast<Identifier const*>(node->function)->value;
+    TrackRead(name, environment);
+    ObjectPtr function = environment.Get(name);
+    if (function == nullptr || function->type != Object::Type::FUNCTION) {
+        return nullptr;
+    }
+
+    const Function* function_object = static_cast<Function*>(function.get());
+    if (function_object->generator ||
+        function_object->parameters.size() != node->arguments.size() ||
+        !IsPure(*function_object)) {
+        return nullptr;
+    }
+    return function;
+}
+
+ObjectPtr Evaluator::RunHere(ForkedCall& call) {
+    size_t depth = _fork_depth;
+    _fork_depth = call.depth;
+    ObjectPtr result = Invoke(call.function, call.arguments, call.count);
+    _fork_depth = depth;
+    return result;
+}
+
+void Evaluator::RunForked(ForkedCall& call) {
+    size_t depth = _fork_depth;
+    _fork_depth = call.depth;
+    ObjectPtr result = Call(call.function, call.arguments, call.count);
+    _fork_depth = depth;
+
+    call.copied = true;
+    call.type = result->type;
+    switch (result->type) {
+    case Object::Type::INT:
+        call.integer = static_cast<Integer*>(result.get())->value;
+        break;
+    case Object::Type::BIG_INT:
+        call.big = static_cast<BigInteger*>(result.get())->value;
+        break;
+    case Object::Type::FLOAT:
+        call.number = static_cast<Float*>(result.get())->value;
+        break;
+    case Object::Type::BOOL:
+        call.integer = static_cast<Boolean*>(result.get())->value;
+        break;
+    case Object::Type::STRING:
+        call.text = static_cast<String*>(result.get())->value;
+        break;
+    case Object::Type::ERROR:
+        call.text = static_cast<Error*>(result.get())->message;
+        break;
+    case Object::Type::NIL:
+        break;
+    default:
+        call.copied = false;
+        break;
+    }
+
+    // released here, where it was allocated, before the forking thread goes on
+    result = nullptr;
+    _pool->Done(call);
+}
+
+// Waits for a stolen call, running calls stolen from other threads meanwhile while
+// there is room on the stacks for them.
+void Evaluator::Join(ForkedCall& call) {
+    int spins = 0;
+    while (!call.done) {
+        char stack_position;
+        bool room = static_cast<size_t>(_stack_base - &stack_position) < _limits.stack / 2 &&
+                    _stack.size() < _stack.capacity() / 2;
+        ForkedCall* other = room ? _pool->Steal(_queue) : nullptr;
+        if (other != nullptr) {
+            RunForked(*other);
+            spins = 0;
+        } else if (spins < ForkJoinPool::SPINS) {
+            std::this_thread::yield();
+            spins++;
+        } else {
+            _pool->Wait(call, room);
+            spins = 0;
+        }
+    }
+}
+
+ObjectPtr Evaluator::EvalInfixValues(const ObjectPtr& left,
+                                     const ObjectPtr& right,
+                                     InfixExpression::Operation op) {
     if (left->type == Object::Type::INT && right->type == Object::Type::INT) {
-        return EvalIntInfix(left, right, node->op);
+        return EvalIntInfix(static_cast<Integer*>(left.get())->value,
+                            static_cast<Integer*>(right.get())->value,
+                            op);
+    }
+
+    if (IsInteger(left) && IsInteger(right)) {
+        return EvalBigIntInfix(ToBigInt(left), ToBigInt(right), op);
+    }
+
+    // either one is a float, the integer is converted
+    if (IsNumber(left) && IsNumber(right)) {
+        return EvalFloatInfix(ToDouble(left), ToDouble(right), op);
     }
 
     if (left->type == Object::Type::BOOL && right->type == Object::Type::BOOL) {
-        return EvalBoolInfix(left, right, node->op);
+        return EvalBoolInfix(left, right, op);
+    }
+
+    if (left->type == Object::Type::STRING && right->type == Object::Type::STRING) {
+        const std::string& left_value = static_cast<String*>(left.get())->value;
+        const std::string& right_value = static_cast<String*>(right.get())->value;
+        switch (op) {
+        case InfixExpression::Operation::ADD:
+            return New<String>(left_value + right_value);
+        case InfixExpression::Operation::EQUAL:
+            return NewBoolean(left_value == right_value);
+        case InfixExpression::Operation::NOT_EQUAL:
+            return NewBoolean(left_value != right_value);
+        default:
+            break;
+        }
     }
 
     std::stringstream stream;
-    stream << "type mismatch for \"" << node->op << "\", found " << left->type << " and "
+    stream << "type mismatch for \"" << op << "\", found " << left->type << " and "
            << right->type;
-    return std::make_shared<Error>(stream.str());
+    return New<Error>(stream.str());
 }
 
-ObjectPtr
-Evaluator::EvalIntInfix(ObjectPtr left, ObjectPtr right, InfixExpression::Operation op) {
-    int left_value = static_cast<Integer*>(left.get())->value;
-    int right_value = static_cast<Integer*>(right.get())->value;
+ObjectPtr Evaluator::EvalIntInfix(int64_t left_value,
+                                  int64_t right_value,
+                                  InfixExpression::Operation op) {
+    int64_t result;
+
+    // on overflow the operation is redone on bignums
+    switch (op) {
+    case InfixExpression::Operation::ADD:
+        if (__builtin_add_overflow(left_value, right_value, &result)) {
+            return EvalBigIntInfix(left_value, right_value, op);
+        }
+        return NewInteger(result);
+    case InfixExpression::Operation::SUBTRACT:
+        if (__builtin_sub_overflow(left_value, right_value, &result)) {
+            return EvalBigIntInfix(left_value, right_value, op);
+        }
+        return NewInteger(result);
+    case InfixExpression::Operation::MULTIPLY:
+        if (__builtin_mul_overflow(left_value, right_value, &result)) {
+            return EvalBigIntInfix(left_value, right_value, op);
+        }
+        return NewInteger(result);
+    case InfixExpression::Operation::DIVIDE:
+        if (right_value == 0) {
+            return New<Error>("division by zero");
+        }
+        if (left_value == INT64_MIN && right_value == -1) {
+            return EvalBigIntInfix(left_value, right_value, op);
+        }
+        return NewInteger(left_value / right_value);
+    case InfixExpression::Operation::EQUAL:
+        return NewBoolean(left_value == right_value);
+    case InfixExpression::Operation::NOT_EQUAL:
+        return NewBoolean(left_value != right_value);
+    case InfixExpression::Operation::LESS:
+        return NewBoolean(left_value < right_value);
+    case InfixExpression::Operation::GREATER:
+        return NewBoolean(left_value > right_value);
+    case InfixExpression::Operation::LESS_EQUAL:
+        return NewBoolean(left_value <= right_value);
+    case InfixExpression::Operation::GREATER_EQUAL:
+        return NewBoolean(left_value >= right_value);
+    case InfixExpression::Operation::AND:
+        return NewBoolean(left_value != 0 && right_value != 0);
+    case InfixExpression::Operation::OR:
+        return NewBoolean(left_value != 0 || right_value != 0);
+    }
 
+    return New<Error>("found impossible integer infix expression");
+}
+
+ObjectPtr Evaluator::EvalBigIntInfix(const BigInt& left,
+                                     const BigInt& right,
+                                     InfixExpression::Operation op) {
     switch (op) {
     case InfixExpression::Operation::ADD:
-        return std::make_shared<Integer>(left_value + right_value);
+        return NewInteger(left + right);
     case InfixExpression::Operation::SUBTRACT:
-        return std::make_shared<Integer>(left_value - right_value);
+        return NewInteger(left - right);
     case InfixExpression::Operation::MULTIPLY:
-        return std::make_shared<Integer>(left_value * right_value);
+        return NewInteger(left * right);
     case InfixExpression::Operation::DIVIDE:
-        return std::make_shared<Integer>(left_value / right_value);
+        if (right.IsZero()) {
+            return New<Error>("division by zero");
+        }
+        return NewInteger(left / right);
     case InfixExpression::Operation::EQUAL:
-        return (left_value == right_value) ? TRUE : FALSE;
+        return NewBoolean(left.Compare(right) == 0);
     case InfixExpression::Operation::NOT_EQUAL:
-        return (left_value != right_value) ? TRUE : FALSE;
+        return NewBoolean(left.Compare(right) != 0);
     case InfixExpression::Operation::LESS:
-        return (left_value < right_value) ? TRUE : FALSE;
+        return NewBoolean(left.Compare(right) < 0);
     case InfixExpression::Operation::GREATER:
-        return (left_value > right_value) ? TRUE : FALSE;
+        return NewBoolean(left.Compare(right) > 0);
     case InfixExpression::Operation::LESS_EQUAL:
-        return (left_value <= right_value) ? TRUE : FALSE;
+        return NewBoolean(left.Compare(right) <= 0);
     case InfixExpression::Operation::GREATER_EQUAL:
-        return (left_value >= right_value) ? TRUE : FALSE;
+        return NewBoolean(left.Compare(right) >= 0);
     case InfixExpression::Operation::AND:
-        return (IsTruthy(left) && IsTruthy(right)) ? TRUE : FALSE;
+        return NewBoolean(!left.IsZero() && !right.IsZero());
     case InfixExpression::Operation::OR:
-        return (IsTruthy(left) || IsTruthy(right)) ? TRUE : FALSE;
+        return NewBoolean(!left.IsZero() || !right.IsZero());
     }
 
-    return std::make_shared<Error>("found impossible integer infix expression");
+    return New<Error>("found impossible integer infix expression");
 }
 
 ObjectPtr
@@ -199,23 +853,64 @@ Evaluator::EvalBoolInfix(ObjectPtr left, ObjectPtr right, InfixExpression::Opera
 
     switch (op) {
     case InfixExpression::Operation::EQUAL:
-        return left_value == right_value ? TRUE : FALSE;
+        return NewBoolean(left_value == right_value);
     case InfixExpression::Operation::NOT_EQUAL:
-        return left_value != right_value ? TRUE : FALSE;
+        return NewBoolean(left_value != right_value);
     case InfixExpression::Operation::AND:
-        return (left_value && right_value) ? TRUE : FALSE;
+        return NewBoolean(left_value && right_value);
     case InfixExpression::Operation::OR:
-        return (left_value || right_value) ? TRUE : FALSE;
+        return NewBoolean(left_value || right_value);
     default:
-        return std::make_shared<Error>("unsupported operator for booleans");
+        return New<Error>("unsupported operator for booleans");
+    }
+}
+
+ObjectPtr Evaluator::EvalFloatInfix(double left_value,
+                                    double right_value,
+                                    InfixExpression::Operation op) {
+    switch (op) {
+    case InfixExpression::Operation::ADD:
+        return NewFloat(left_value + right_value);
+    case InfixExpression::Operation::SUBTRACT:
+        return NewFloat(left_value - right_value);
+    case InfixExpression::Operation::MULTIPLY:
+        return NewFloat(left_value * right_value);
+    case InfixExpression::Operation::DIVIDE:
+        // an error as for integers rather than an infinity
+        if (right_value == 0) {
+            return New<Error>("division by zero");
+        }
+        return NewFloat(left_value / right_value);
+    case InfixExpression::Operation::EQUAL:
+        return NewBoolean(left_value == right_value);
+    case InfixExpression::Operation::NOT_EQUAL:
+        return NewBoolean(left_value != right_value);
+    case InfixExpression::Operation::LESS:
+        return NewBoolean(left_value < right_value);
+    case InfixExpression::Operation::GREATER:
+        return NewBoolean(left_value > right_value);
+    case InfixExpression::Operation::LESS_EQUAL:
+        return NewBoolean(left_value <= right_value);
+    case InfixExpression::Operation::GREATER_EQUAL:
+        return NewBoolean(left_value >= right_value);
+    case InfixExpression::Operation::AND:
+        return NewBoolean(left_value != 0 && right_value != 0);
+    case InfixExpression::Operation::OR:
+        return NewBoolean(left_value != 0 || right_value != 0);
     }
+
+    return New<Error>("found impossible float infix expression");
 }
 
-ObjectPtr Evaluator::EvalBlock(BlockExpression const* node, EnvironmentPtr environment) {
-    ObjectPtr result = NIL;
+ObjectPtr Evaluator::EvalBlock(BlockExpression const* node, Environment& environment) {
+    ObjectPtr result = _nil;
     for (const Statement* statement : node->statements) {
+        if (!Step()) {
+            return _exhausted;
+        }
+
         result = EvalStatement(statement, environment);
-        if (result->type == Object::Type::ERROR) {
+        if (IsAbrupt(result)) {
             return result;
         }
     }
@@ -224,9 +919,9 @@ ObjectPtr Evaluator::EvalBlock(BlockExpression const* node, EnvironmentPtr envir
 }
 
 ObjectPtr Evaluator::EvalIfElse(IfElseExpression const* node,
-                                EnvironmentPtr environment) {
+                                Environment& environment) {
     ObjectPtr condition = EvalExpression(node->condition, environment);
-    if (condition->type == Object::Type::ERROR) {
+    if (IsAbrupt(condition)) {
         return condition;
     }
 
@@ -238,56 +933,583 @@ ObjectPtr Evaluator::EvalIfElse(IfElseExpression const* node,
         return EvalExpression(node->alternative, environment);
     }
 
-    return NIL;
+    return _nil;
+}
+
+ObjectPtr Evaluator::EvalAssign(AssignExpression const* node, Environment& environment) {
+    ObjectPtr value = EvalExpression(node->value, environment);
+    if (IsAbrupt(value)) {
+        return value;
+    }
+
+    TrackWrite(node->name->value, environment);
+    if (!environment.Assign(node->name->value, value)) {
+        return New<Error>("identifier not found: " + node->name->value);
+    }
+
+    return value;
+}
+
+// Loop bodies run directly in the enclosing environment, so an iteration allocates
+// nothing beyond the values it computes and its lets just overwrite their slot.
+ObjectPtr Evaluator::EvalWhile(WhileExpression const* node, Environment& environment) {
+    while (true) {
+        // charged per iteration so that even an empty body runs out of fuel
+        if (!Step()) {
+            return _exhausted;
+        }
+
+        ObjectPtr condition = EvalExpression(node->condition, environment);
+        if (IsAbrupt(condition)) {
+            return condition;
+        }
+        if (!IsTruthy(condition)) {
+            return _nil;
+        }
+
+        ObjectPtr result = EvalBlock(node->body, environment);
+        if (IsAbrupt(result)) {
+            return result;
+        }
+    }
+}
+
+ObjectPtr Evaluator::EvalFor(ForExpression const* node, Environment& environment) {
+    ObjectPtr initialized = EvalStatement(node->initializer, environment);
+    if (IsAbrupt(initialized)) {
+        return initialized;
+    }
+
+    while (true) {
+        if (!Step()) {
+            return _exhausted;
+        }
+
+        ObjectPtr condition = EvalExpression(node->condition, environment);
+        if (IsAbrupt(condition)) {
+            return condition;
+        }
+        if (!IsTruthy(condition)) {
+            return _nil;
+        }
+
+        ObjectPtr result = EvalBlock(node->body, environment);
+        if (IsAbrupt(result)) {
+            return result;
+        }
+
+        ObjectPtr updated = EvalExpression(node->update, environment);
+        if (IsAbrupt(updated)) {
+            return updated;
+        }
+    }
+}
+
+ObjectPtr Evaluator::EvalMap(MapExpression const* node, Environment& environment) {
+    std::shared_ptr<Map> map = NewMap();
+    for (const auto& [key_node, value_node] : node->entries) {
+        ObjectPtr key = EvalExpression(key_node, environment);
+        if (IsAbrupt(key)) {
+            return key;
+        }
+        if (!HashTable::IsKey(*key)) {
+            std::stringstream stream;
+            stream << "unusable as map key: " << key->type;
+            return New<Error>(stream.str());
+        }
+
+        ObjectPtr value = EvalExpression(value_node, environment);
+        if (IsAbrupt(value)) {
+            return value;
+        }
+
+        map->table.Set(std::move(key), std::move(value));
+    }
+
+    return map;
 }
 
 ObjectPtr Evaluator::EvalFunction(FunctionExpression const* node,
-                                  EnvironmentPtr environment) {
-    // TODO: filter only the closed over variables
-    EnvironmentPtr closed = std::make_shared<Environment>(*environment);
-    return std::make_shared<Function>(node->parameters, node->body, closed);
+                                  Environment& environment) {
+    if (&environment == _tracked) {
+        for (const std::string* name : node->GetNames()) {
+            if (environment.store.count(*name) != 0) {
+                _dependencies->Read(name);
+            }
+        }
+    }
+
+    EnvironmentPtr closed = environment.Capture(_heap, node->GetNames());
+    return New<Function>(node->parameters, node->body, closed, node->generator, node, *_arena);
 }
 
-ObjectPtr Evaluator::EvalCall(CallExpression const* node, EnvironmentPtr environment) {
-    ObjectPtr function = EvalExpression(node->function, environment);
-    if (function->type == Object::Type::ERROR) {
-        return function;
+ObjectPtr Evaluator::EvalField(FieldExpression const* node, Environment& environment) {
+    ObjectPtr object = EvalExpression(node->object, environment);
+    if (IsAbrupt(object)) {
+        return object;
     }
 
-    std::vector<ObjectPtr> arguments;
-    for (Expression const* argument : node->arguments) {
-        ObjectPtr evaluated = EvalExpression(argument, environment);
-        if (evaluated->type == Object::Type::ERROR) {
-            return evaluated;
+    if (object->type != Object::Type::INSTANCE) {
+        std::stringstream stream;
+        stream << "cannot read field " << node->field->value << " of " << object->type;
+        return New<Error>(stream.str());
+    }
+
+    Instance* instance = static_cast<Instance*>(object.get());
+    uint64_t cache = node->cache.load(std::memory_order_relaxed);
+    if (cache >> 32 == instance->shape->id) {
+        return instance->Fields()[static_cast<uint32_t>(cache)];
+    }
+
+    size_t offset = instance->shape->Find(node->field->value);
+    if (offset == Shape::NOT_FOUND) {
+        return New<Error>(instance->shape->name + " has no field " + node->field->value);
+    }
+
+    node->cache.store(static_cast<uint64_t>(instance->shape->id) << 32 | offset,
+                      std::memory_order_relaxed);
+    return instance->Fields()[offset];
+}
+
+ObjectPtr Evaluator::EvalCall(CallExpression const* node, Environment& environment) {
+    ObjectPtr function;
+    if (node->specialization == CallExpression::Specialization::KNOWN_ARITY) {
+        const std::string& name = static_cast<Identifier const*>(node->function)->value;
+        TrackRead(name, environment);
+        function = environment.Get(name);
+        if (function != nullptr && function->type == Object::Type::FUNCTION) {
+            Function* function_object = static_cast<Function*>(function.get());
+            if (function_object->parameters.size() == node->arguments.size()) {
+                return CallFunction(function_object, node->arguments, environment);
+            }
         }
 
-        arguments.push_back(evaluated);
+        node->specialization = CallExpression::Specialization::GENERIC;
+    }
+
+    function = EvalExpression(node->function, environment);
+    if (IsAbrupt(function)) {
+        return function;
     }
 
     if (function->type == Object::Type::FUNCTION) {
         Function* function_object = static_cast<Function*>(function.get());
-        if (arguments.size() != function_object->parameters.size()) {
-            return std::make_shared<Error>(
+        size_t count = node->arguments.size();
+        if (count != function_object->parameters.size()) {
+            return New<Error>(
                 "wrong number of arguments: expected " +
                 std::to_string(function_object->parameters.size()) + ", got " +
-                std::to_string(arguments.size()));
+                std::to_string(count));
         }
 
-        EnvironmentPtr extended =
-            std::make_shared<Environment>(function_object->environment);
-        for (size_t i = 0; i < arguments.size(); ++i) {
-            extended->Set(function_object->parameters[i]->value, arguments[i]);
+        if (node->specialization == CallExpression::Specialization::UNINITIALIZED) {
+            node->specialization = node->function->type == Expression::Type::IDENT
+                                       ? CallExpression::Specialization::KNOWN_ARITY
+                                       : CallExpression::Specialization::GENERIC;
         }
 
-        ObjectPtr result = EvalBlock(function_object->body, extended);
-        if (result->type == Object::Type::RETURN) {
-            return static_cast<Return*>(result.get())->value;
-        }
+        return CallFunction(function_object, node->arguments, environment);
+    }
 
-        return result;
+    if (function->type == Object::Type::BUILTIN) {
+        return CallBuiltin(static_cast<Builtin*>(function.get()), node->arguments, environment);
+    }
+
+    if (function->type == Object::Type::STRUCT) {
+        return Construct(static_cast<StructType*>(function.get()), node->arguments, environment);
     }
 
     std::stringstream stream;
     stream << "\"" << *function << "\" is not a function";
-    return std::make_shared<Error>(stream.str());
+    return New<Error>(stream.str());
+}
+
+ObjectPtr Evaluator::CallFunction(Function* function,
+                                  const std::vector<Expression*>& arguments,
+                                  Environment& environment) {
+    size_t count = arguments.size();
+    ObjectPtr refused = CheckCall(count);
+    if (refused != nullptr) {
+        return refused;
+    }
+
+    // Arguments go straight into the slots of the new frame. Each slot is pushed before
+    // its argument is evaluated, so the caller's frame is no longer the top of the stack
+    // and a let in the argument spills instead of taking the slot's place.
+    size_t base = _stack.size();
+    for (size_t i = 0; i < count; ++i) {
+        _stack.push_back({&function->parameters[i]->value, nullptr});
+        ObjectPtr evaluated = EvalExpression(arguments[i], environment);
+        if (IsAbrupt(evaluated)) {
+            _stack.erase(_stack.begin() + base, _stack.end());
+            return evaluated;
+        }
+
+        _stack[base + i].value = std::move(evaluated);
+    }
+
+    return EnterFrame(function, base);
+}
+
+ObjectPtr
+Evaluator::Invoke(const ObjectPtr& function, const ObjectPtr* arguments, size_t count) {
+    if (function->type == Object::Type::BUILTIN) {
+        Builtin* builtin = static_cast<Builtin*>(function.get());
+        if (count != builtin->arity) {
+            return New<Error>("wrong number of arguments to " + builtin->name +
+                              ": expected " + std::to_string(builtin->arity) + ", got " +
+                              std::to_string(count));
+        }
+        if (!Step()) {
+            return _exhausted;
+        }
+
+        return builtin->function(*this, arguments, count);
+    }
+
+    if (function->type == Object::Type::STRUCT) {
+        StructType* type = static_cast<StructType*>(function.get());
+        const Shape* shape = type->shape;
+        if (count != shape->fields.size()) {
+            return New<Error>("wrong number of fields for " + shape->name + ": expected " +
+                              std::to_string(shape->fields.size()) + ", got " +
+                              std::to_string(count));
+        }
+        if (!Step()) {
+            return _exhausted;
+        }
+
+        std::shared_ptr<Instance> instance = NewInstance(shape, type->arena);
+        std::copy(arguments, arguments + count, instance->Fields());
+        return instance;
+    }
+
+    if (function->type != Object::Type::FUNCTION) {
+        std::stringstream stream;
+        stream << "\"" << *function << "\" is not a function";
+        return New<Error>(stream.str());
+    }
+
+    Function* function_object = static_cast<Function*>(function.get());
+    if (count != function_object->parameters.size()) {
+        return New<Error>("wrong number of arguments: expected " +
+                          std::to_string(function_object->parameters.size()) + ", got " +
+                          std::to_string(count));
+    }
+
+    ObjectPtr refused = CheckCall(count);
+    if (refused != nullptr) {
+        return refused;
+    }
+
+    size_t base = _stack.size();
+    for (size_t i = 0; i < count; ++i) {
+        _stack.push_back({&function_object->parameters[i]->value, arguments[i]});
+    }
+
+    return EnterFrame(function_object, base);
+}
+
+ObjectPtr Evaluator::CheckCall(size_t count) {
+    if (!Step()) {
+        return _exhausted;
+    }
+
+    char stack_position;
+    if (_stack.size() + count > _stack.capacity() ||
+        static_cast<size_t>(_stack_base - &stack_position) > _limits.stack) {
+        return New<Error>("stack overflow");
+    }
+
+    return nullptr;
+}
+
+ObjectPtr Evaluator::EnterFrame(Function* function, size_t base) {
+    // the arguments move from the frame stack into the generator's own environment
+    if (function->generator) {
+        EnvironmentPtr locals =
+            std::allocate_shared<Environment>(HeapAllocator<Environment>(&_heap, Heap::ENVIRONMENT),
+                                              function->environment);
+        for (size_t i = base; i < _stack.size(); i++) {
+            locals->Set(*_stack[i].name, std::move(_stack[i].value));
+        }
+        _stack.erase(_stack.begin() + base, _stack.end());
+
+        return New<Generator>(function->body, std::move(locals), function->arena);
+    }
+
+    if (_profiler != nullptr) {
+        _profiler->Enter(function->definition);
+    }
+    uint64_t start = Trace::IsOn() ? Trace::Now() : 0;
+
+    const std::shared_ptr<AstArena>* arena = _arena;
+    _arena = &function->arena;
+    Environment frame(function->environment, &_stack, base);
+    ObjectPtr result = EvalBlock(function->body, frame);
+    _signal = Signal::NONE;
+    _arena = arena;
+
+    if (_profiler != nullptr) {
+        _profiler->Leave();
+    }
+    // most calls are far too short to be worth a span
+    if (start != 0) {
+        uint64_t end = Trace::Now();
+        if (end - start >= static_cast<uint64_t>(Trace::GetCallThreshold().count())) {
+            const FunctionExpression* definition = function->definition;
+            Trace::Record(definition != nullptr && !definition->name.empty()
+                              ? definition->name
+                              : "fn",
+                          "call", start, end,
+                          definition != nullptr
+                              ? "line " + std::to_string(definition->line + 1)
+                              : "");
+        }
+    }
+    _stack.erase(_stack.begin() + base, _stack.end());
+
+    return result;
+}
+
+ObjectPtr Evaluator::Next(const ObjectPtr& iterator) {
+    if (!Step()) {
+        return _exhausted;
+    }
+
+    switch (static_cast<Iterator*>(iterator.get())->kind) {
+    case Iterator::Kind::RANGE: {
+        Range* range = static_cast<Range*>(iterator.get());
+        if (range->next >= range->end) {
+            return nullptr;
+        }
+        return NewInteger(range->next++);
+    }
+    case Iterator::Kind::GENERATOR: {
+        Generator* generator = static_cast<Generator*>(iterator.get());
+        if (generator->running) {
+            return New<Error>("generator is already running");
+        }
+
+        generator->running = true;
+        const std::shared_ptr<AstArena>* arena = _arena;
+        _arena = &generator->arena;
+        ObjectPtr value = Resume(generator);
+        _arena = arena;
+        generator->running = false;
+
+        return value;
+    }
+    case Iterator::Kind::KEYS: {
+        Keys* keys = static_cast<Keys*>(iterator.get());
+        const HashTable& table = static_cast<Map*>(keys->map.get())->table;
+        if (keys->position >= table.Size()) {
+            return nullptr;
+        }
+        return table.Entries()[keys->position++].key;
+    }
+    case Iterator::Kind::TAKE: {
+        Take* take = static_cast<Take*>(iterator.get());
+        if (take->remaining <= 0) {
+            return nullptr;
+        }
+        take->remaining--;
+        return Next(take->source);
+    }
+    }
+
+    return New<Error>("found impossible iterator kind");
+}
+
+// Runs the generator's body until the next yield. Only statements directly in the
+// body, or in blocks of loops and conditionals that are statements themselves, are
+// tracked and can yield, everything else is evaluated as usual.
+ObjectPtr Evaluator::Resume(Generator* generator) {
+    Environment& environment = *generator->environment;
+    std::vector<Generator::Activation>& activations = generator->activations;
+
+    while (!activations.empty()) {
+        Generator::Activation& top = activations.back();
+        const Expression* node = top.node;
+        ObjectPtr result;
+
+        switch (node->type) {
+        case Expression::Type::BLOCK: {
+            const BlockExpression* block = static_cast<const BlockExpression*>(node);
+            if (top.position == block->statements.size()) {
+                activations.pop_back();
+                continue;
+            }
+            if (!Step()) {
+                return _exhausted;
+            }
+
+            const Statement* statement = block->statements[top.position++];
+            if (statement->type == Statement::Type::YIELD) {
+                result = EvalExpression(static_cast<const YieldStatement*>(statement)->value,
+                                        environment);
+                if (IsAbrupt(result)) {
+                    break;
+                }
+                return result;
+            }
+            if (statement->type == Statement::Type::RETURN) {
+                result = EvalExpression(static_cast<const ReturnStatement*>(statement)->value,
+                                        environment);
+                activations.clear();
+                break;
+            }
+            if (statement->type == Statement::Type::EXPRESSION) {
+                const Expression* expression =
+                    static_cast<const ExpressionStatement*>(statement)->expression;
+                switch (expression->type) {
+                case Expression::Type::BLOCK:
+                case Expression::Type::IF_ELSE:
+                case Expression::Type::WHILE:
+                case Expression::Type::FOR:
+                    activations.push_back({expression, 0});
+                    continue;
+                default:
+                    break;
+                }
+            }
+
+            result = EvalStatement(statement, environment);
+            break;
+        }
+        case Expression::Type::IF_ELSE: {
+            const IfElseExpression* if_else = static_cast<const IfElseExpression*>(node);
+            result = EvalExpression(if_else->condition, environment);
+            if (IsAbrupt(result)) {
+                break;
+            }
+
+            activations.pop_back();
+            if (IsTruthy(result)) {
+                activations.push_back({if_else->consequence, 0});
+            } else if (if_else->alternative != nullptr) {
+                activations.push_back({if_else->alternative, 0});
+            }
+            continue;
+        }
+        case Expression::Type::WHILE: {
+            const WhileExpression* loop = static_cast<const WhileExpression*>(node);
+            if (!Step()) {
+                return _exhausted;
+            }
+
+            result = EvalExpression(loop->condition, environment);
+            if (IsAbrupt(result)) {
+                break;
+            }
+            if (!IsTruthy(result)) {
+                activations.pop_back();
+                continue;
+            }
+
+            activations.push_back({loop->body, 0});
+            continue;
+        }
+        case Expression::Type::FOR: {
+            // 0 runs the initializer, 1 tests the condition, 2 updates after the body
+            const ForExpression* loop = static_cast<const ForExpression*>(node);
+            if (top.position == 0) {
+                top.position = 1;
+                result = EvalStatement(loop->initializer, environment);
+                break;
+            }
+            if (top.position == 2) {
+                top.position = 1;
+                result = EvalExpression(loop->update, environment);
+                break;
+            }
+            if (!Step()) {
+                return _exhausted;
+            }
+
+            result = EvalExpression(loop->condition, environment);
+            if (IsAbrupt(result)) {
+                break;
+            }
+            if (!IsTruthy(result)) {
+                activations.pop_back();
+                continue;
+            }
+
+            top.position = 2;
+            activations.push_back({loop->body, 0});
+            continue;
+        }
+        default:
+            return New<Error>("found impossible generator activation");
+        }
+
+        // an error or a return from a nested block ends the generator
+        if (IsAbrupt(result)) {
+            activations.clear();
+            if (result->type == Object::Type::ERROR) {
+                _signal = Signal::NONE;
+                return result;
+            }
+        }
+        if (_signal == Signal::RETURN) {
+            _signal = Signal::NONE;
+            activations.clear();
+        }
+    }
+
+    return nullptr;
+}
+
+ObjectPtr Evaluator::CallBuiltin(Builtin* builtin,
+                                 const std::vector<Expression*>& arguments,
+                                 Environment& environment) {
+    size_t count = arguments.size();
+    if (count != builtin->arity || count > MAX_NATIVE_ARGUMENTS) {
+        return New<Error>("wrong number of arguments to " + builtin->name + ": expected " +
+                          std::to_string(builtin->arity) + ", got " +
+                          std::to_string(count));
+    }
+
+    if (!Step()) {
+        return _exhausted;
+    }
+
+    ObjectPtr evaluated[MAX_NATIVE_ARGUMENTS];
+    for (size_t i = 0; i < count; ++i) {
+        evaluated[i] = EvalExpression(arguments[i], environment);
+        if (IsAbrupt(evaluated[i])) {
+            return evaluated[i];
+        }
+    }
+
+    return builtin->function(*this, evaluated, count);
+}
+
+ObjectPtr Evaluator::Construct(StructType* type,
+                               const std::vector<Expression*>& arguments,
+                               Environment& environment) {
+    const Shape* shape = type->shape;
+    size_t count = arguments.size();
+    if (count != shape->fields.size()) {
+        return New<Error>("wrong number of fields for " + shape->name + ": expected " +
+                          std::to_string(shape->fields.size()) + ", got " +
+                          std::to_string(count));
+    }
+
+    if (!Step()) {
+        return _exhausted;
+    }
+
+    std::shared_ptr<Instance> instance = NewInstance(shape, type->arena);
+    for (size_t i = 0; i < count; ++i) {
+        ObjectPtr evaluated = EvalExpression(arguments[i], environment);
+        if (IsAbrupt(evaluated)) {
+            return evaluated;
+        }
+
+        instance->Fields()[i] = std::move(evaluated);
+    }
+
+    return instance;
 }
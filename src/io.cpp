@@ -0,0 +1,345 @@
+#include "io.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define HAVE_IO_URING 1
+#else
+#define HAVE_IO_URING 0
+#endif
+
+// Opens the file and sizes the buffer, errno on failure.
+static int Open(IoRequest& request) {
+    if (request.kind == IoRequest::Kind::WRITE) {
+        request.fd = open(request.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        return request.fd < 0 ? errno : 0;
+    }
+
+    request.fd = open(request.path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (request.fd < 0) {
+        return errno;
+    }
+
+    // files without a meaningful size, like pipes or /proc, are read until the end
+    struct stat status;
+    if (fstat(request.fd, &status) == 0 && S_ISREG(status.st_mode) && status.st_size > 0) {
+        request.size = status.st_size;
+    }
+    request.data.resize(request.size != 0 ? request.size : 4096);
+    return 0;
+}
+
+// Where the next read or write goes, growing the buffer of a read that filled it.
+static size_t NextRange(IoRequest& request, char*& buffer) {
+    if (request.kind == IoRequest::Kind::READ && request.offset == request.data.size()) {
+        request.data.resize(request.data.size() * 2);
+    }
+
+    buffer = request.data.data() + request.offset;
+    // a single read or write transfers at most about 2GB anyway
+    return std::min<size_t>(request.data.size() - request.offset, 1 << 30);
+}
+
+// Accounts for count bytes transferred, true once the request is complete.
+static bool Transferred(IoRequest& request, size_t count) {
+    request.offset += count;
+    if (request.kind == IoRequest::Kind::WRITE) {
+        return request.offset == request.data.size();
+    }
+
+    if (count == 0 || (request.size != 0 && request.offset == request.size)) {
+        request.data.resize(request.offset);
+        return true;
+    }
+    return false;
+}
+
+static void Close(IoRequest& request) {
+    if (request.fd >= 0) {
+        close(request.fd);
+        request.fd = -1;
+    }
+}
+
+IoLoop::IoLoop(bool use_ring) {
+    if (use_ring && SetupRing()) {
+        return;
+    }
+
+    for (size_t i = 0; i < WORKERS; i++) {
+        _workers.emplace_back(&IoLoop::Work, this);
+    }
+}
+
+IoLoop::~IoLoop() {
+    if (UsesRing()) {
+        // the kernel may still write into their buffers
+        while (!_in_flight.empty()) {
+            Reap(true);
+        }
+
+        munmap(_sqes, _sqes_size);
+        if (_cq_ring != _ring) {
+            munmap(_cq_ring, _cq_ring_size);
+        }
+        munmap(_ring, _ring_size);
+        close(_ring_fd);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _wake.notify_all();
+
+    for (std::thread& worker : _workers) {
+        worker.join();
+    }
+}
+
+void IoLoop::Submit(std::shared_ptr<IoRequest> request) {
+    if (!UsesRing()) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _queue.push_back(std::move(request));
+        }
+        _wake.notify_one();
+        return;
+    }
+
+    int error = Open(*request);
+    if (error != 0) {
+        Finish(request.get(), error);
+        return;
+    }
+
+    IoRequest* pointer = request.get();
+    _in_flight.emplace(reinterpret_cast<uint64_t>(pointer), std::move(request));
+    Queue(pointer);
+}
+
+void IoLoop::Wait(IoRequest& request) {
+    if (UsesRing()) {
+        while (!request.done) {
+            Reap(true);
+        }
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _done.wait(lock, [&] { return request.done; });
+}
+
+#if HAVE_IO_URING
+
+static int Setup(unsigned entries, io_uring_params* params) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int Enter(int fd, unsigned submit, unsigned complete, unsigned flags) {
+    return static_cast<int>(
+        syscall(__NR_io_uring_enter, fd, submit, complete, flags, nullptr, 0));
+}
+
+bool IoLoop::SetupRing() {
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    int fd = Setup(RING_ENTRIES, &params);
+    if (fd < 0) {
+        return false;
+    }
+
+    // plain reads and writes came with the same kernel as this feature
+    if ((params.features & IORING_FEAT_RW_CUR_POS) == 0) {
+        close(fd);
+        return false;
+    }
+
+    _ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    _cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single) {
+        _ring_size = std::max(_ring_size, _cq_ring_size);
+        _cq_ring_size = _ring_size;
+    }
+
+    _ring = mmap(nullptr, _ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                 IORING_OFF_SQ_RING);
+    if (_ring == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+
+    _cq_ring = single ? _ring
+                      : mmap(nullptr, _cq_ring_size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (_cq_ring == MAP_FAILED) {
+        munmap(_ring, _ring_size);
+        close(fd);
+        return false;
+    }
+
+    _sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    _sqes = mmap(nullptr, _sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                 IORING_OFF_SQES);
+    if (_sqes == MAP_FAILED) {
+        if (!single) {
+            munmap(_cq_ring, _cq_ring_size);
+        }
+        munmap(_ring, _ring_size);
+        close(fd);
+        return false;
+    }
+
+    char* sq = static_cast<char*>(_ring);
+    _sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    _sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    _sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    _sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+
+    char* cq = static_cast<char*>(_cq_ring);
+    _cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    _cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    _cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    _cq_entries = params.cq_entries;
+    _cqes = cq + params.cq_off.cqes;
+
+    _ring_fd = fd;
+    return true;
+}
+
+// Submits the next read or write of request right away, so the kernel starts on it
+// while the script keeps running.
+void IoLoop::Queue(IoRequest* request) {
+    // no more operations outstanding than completions fit in the ring
+    while (_submitted >= _cq_entries) {
+        Reap(true);
+    }
+
+    unsigned tail = *_sq_tail;
+    unsigned index = tail & _sq_mask;
+
+    char* buffer;
+    size_t length = NextRange(*request, buffer);
+
+    io_uring_sqe* sqe = static_cast<io_uring_sqe*>(_sqes) + index;
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = request->kind == IoRequest::Kind::READ ? IORING_OP_READ : IORING_OP_WRITE;
+    sqe->fd = request->fd;
+    sqe->addr = reinterpret_cast<uint64_t>(buffer);
+    sqe->len = static_cast<uint32_t>(length);
+    sqe->off = request->offset;
+    sqe->user_data = reinterpret_cast<uint64_t>(request);
+
+    _sq_array[index] = index;
+    __atomic_store_n(_sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    while (Enter(_ring_fd, 1, 0, 0) < 0) {
+        if (errno != EINTR && errno != EAGAIN) {
+            // not consumed by the kernel, take it back
+            __atomic_store_n(_sq_tail, tail, __ATOMIC_RELEASE);
+            Finish(request, errno);
+            return;
+        }
+    }
+    _submitted++;
+}
+
+void IoLoop::Reap(bool wait) {
+    if (wait) {
+        while (Enter(_ring_fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno == EINTR) {
+        }
+    }
+
+    // copied out first, completing a request can queue its next part
+    std::vector<std::pair<uint64_t, int32_t>> completed;
+    unsigned head = *_cq_head;
+    unsigned tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+        const io_uring_cqe& cqe = static_cast<const io_uring_cqe*>(_cqes)[head & _cq_mask];
+        completed.emplace_back(cqe.user_data, cqe.res);
+        _submitted--;
+    }
+    __atomic_store_n(_cq_head, head, __ATOMIC_RELEASE);
+
+    for (const auto& [user_data, result] : completed) {
+        auto found = _in_flight.find(user_data);
+        if (found != _in_flight.end()) {
+            Complete(found->second.get(), result);
+        }
+    }
+}
+
+#else
+
+bool IoLoop::SetupRing() { return false; }
+void IoLoop::Queue(IoRequest*) {}
+void IoLoop::Reap(bool) {}
+
+#endif
+
+void IoLoop::Complete(IoRequest* request, int32_t result) {
+    if (result < 0) {
+        Finish(request, -result);
+    } else if (Transferred(*request, result)) {
+        Finish(request, 0);
+    } else {
+        Queue(request);
+    }
+}
+
+// may release the last reference to request
+void IoLoop::Finish(IoRequest* request, int error) {
+    Close(*request);
+    request->error = error;
+    request->done = true;
+    _in_flight.erase(reinterpret_cast<uint64_t>(request));
+}
+
+void IoLoop::Work() {
+    while (true) {
+        std::shared_ptr<IoRequest> request;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _wake.wait(lock, [this] { return _stopping || !_queue.empty(); });
+            if (_queue.empty()) {
+                return;
+            }
+            request = std::move(_queue.front());
+            _queue.pop_front();
+        }
+
+        int error = Open(*request);
+        while (error == 0) {
+            char* buffer;
+            size_t length = NextRange(*request, buffer);
+            ssize_t count = request->kind == IoRequest::Kind::READ
+                                ? pread(request->fd, buffer, length, request->offset)
+                                : pwrite(request->fd, buffer, length, request->offset);
+            if (count < 0) {
+                if (errno != EINTR) {
+                    error = errno;
+                }
+                continue;
+            }
+            if (Transferred(*request, count)) {
+                break;
+            }
+        }
+        Close(*request);
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        request->error = error;
+        request->done = true;
+        _done.notify_all();
+    }
+}
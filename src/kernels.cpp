@@ -0,0 +1,114 @@
+#include "kernels.h"
+
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KERNELS_SIMD
+#endif
+
+using Kernel = void (*)(const double* in, double* out, size_t count);
+
+static void SqrtScalar(const double* in, double* out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        out[i] = std::sqrt(in[i]);
+    }
+}
+
+static void FloorScalar(const double* in, double* out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        out[i] = std::floor(in[i]);
+    }
+}
+
+static void ExpScalar(const double* in, double* out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        out[i] = std::exp(in[i]);
+    }
+}
+
+static void LogScalar(const double* in, double* out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        out[i] = std::log(in[i]);
+    }
+}
+
+#ifdef KERNELS_SIMD
+
+// Each iteration loads its elements before storing any, so out may be in. The last
+// elements that do not fill a vector go to the narrower kernel.
+
+static void SqrtSse2(const double* in, double* out, size_t count) {
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        _mm_storeu_pd(out + i, _mm_sqrt_pd(_mm_loadu_pd(in + i)));
+    }
+    SqrtScalar(in + i, out + i, count - i);
+}
+
+__attribute__((target("avx"))) static void SqrtAvx(const double* in, double* out, size_t count) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256d low = _mm256_sqrt_pd(_mm256_loadu_pd(in + i));
+        __m256d high = _mm256_sqrt_pd(_mm256_loadu_pd(in + i + 4));
+        _mm256_storeu_pd(out + i, low);
+        _mm256_storeu_pd(out + i + 4, high);
+    }
+    SqrtSse2(in + i, out + i, count - i);
+}
+
+// SSE2 has no rounding instruction, without AVX floor stays scalar
+__attribute__((target("avx"))) static void FloorAvx(const double* in, double* out, size_t count) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256d low = _mm256_floor_pd(_mm256_loadu_pd(in + i));
+        __m256d high = _mm256_floor_pd(_mm256_loadu_pd(in + i + 4));
+        _mm256_storeu_pd(out + i, low);
+        _mm256_storeu_pd(out + i + 4, high);
+    }
+    FloorScalar(in + i, out + i, count - i);
+}
+
+static bool HasAvx() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx");
+}
+
+static const bool avx = HasAvx();
+static const Kernel sqrt_kernel = avx ? &SqrtAvx : &SqrtSse2;
+static const Kernel floor_kernel = avx ? &FloorAvx : &FloorScalar;
+
+#else
+
+static const Kernel sqrt_kernel = &SqrtScalar;
+static const Kernel floor_kernel = &FloorScalar;
+
+#endif
+
+void ApplyMath(MathFunction function, const double* in, double* out, size_t count) {
+    switch (function) {
+    case MathFunction::SQRT:
+        sqrt_kernel(in, out, count);
+        break;
+    case MathFunction::EXP:
+        ExpScalar(in, out, count);
+        break;
+    case MathFunction::LOG:
+        LogScalar(in, out, count);
+        break;
+    case MathFunction::FLOOR:
+        floor_kernel(in, out, count);
+        break;
+    }
+}
+
+void ApplyPow(const double* base,
+              size_t base_step,
+              const double* exponent,
+              size_t exponent_step,
+              double* out,
+              size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        out[i] = std::pow(base[i * base_step], exponent[i * exponent_step]);
+    }
+}
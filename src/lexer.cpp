@@ -1,5 +1,14 @@
 #include "lexer.h"
 
+#include "trace.h"
+
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LEXER_SIMD
+#endif
+
 inline bool IsAlphaNumerical(char c) {
     return ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') || c == '_';
 }
@@ -10,11 +19,215 @@ inline bool IsWhitespace(char c) {
     return c == ' ' || c == '\t' || c == '\n' || c == '\r';
 }
 
+// Runs of whitespace, identifier characters and digits are found a block of bytes at
+// a time: every byte of the block is classified at once, and the first one outside
+// the class ends the run. Newlines in a whitespace run are counted with a popcount.
+enum class CharClass {
+    WHITESPACE,
+    IDENTIFIER,
+    DIGIT,
+};
+
+struct CharRun {
+    // first position past the run
+    size_t end;
+    size_t newlines;
+    // position of the last newline, only valid if there are any
+    size_t last_newline;
+};
+
+static inline bool Belongs(char c, CharClass type) {
+    switch (type) {
+    case CharClass::WHITESPACE:
+        return IsWhitespace(c);
+    case CharClass::IDENTIFIER:
+        return IsAlphaNumerical(c) || IsDigit(c);
+    case CharClass::DIGIT:
+        return IsDigit(c);
+    }
+    return false;
+}
+
+static void ScanScalar(const char* data, size_t size, CharClass type, CharRun& run) {
+    while (run.end < size && Belongs(data[run.end], type)) {
+        if (data[run.end] == '\n') {
+            run.newlines++;
+            run.last_newline = run.end;
+        }
+        run.end++;
+    }
+}
+
+// newlines among the first length bytes of a block starting at position
+static inline void CountNewlines(uint64_t newlines, size_t length, size_t position, CharRun& run) {
+    if (length < 64) {
+        newlines &= (uint64_t(1) << length) - 1;
+    }
+    if (newlines != 0) {
+        run.newlines += __builtin_popcountll(newlines);
+        run.last_newline = position + 63 - __builtin_clzll(newlines);
+    }
+}
+
+#ifdef LEXER_SIMD
+
+// bytes in [low, high], with signed compares since SSE2 has no unsigned ones
+static inline __m128i InRange(__m128i bytes, char low, char high) {
+    __m128i shifted = _mm_add_epi8(bytes, _mm_set1_epi8(static_cast<char>(-128 - low)));
+    return _mm_cmplt_epi8(shifted, _mm_set1_epi8(static_cast<char>(-128 + (high - low) + 1)));
+}
+
+static inline uint32_t Classify(__m128i bytes, CharClass type) {
+    __m128i in = _mm_setzero_si128();
+    switch (type) {
+    case CharClass::WHITESPACE:
+        in = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(' ')),
+                                       _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\t'))),
+                          _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('\n')),
+                                       _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\r'))));
+        break;
+    case CharClass::IDENTIFIER:
+        // setting bit 5 maps upper to lower case letters and leaves digits alone
+        in = _mm_or_si128(
+            _mm_or_si128(InRange(_mm_or_si128(bytes, _mm_set1_epi8(0x20)), 'a', 'z'),
+                         InRange(bytes, '0', '9')),
+            _mm_cmpeq_epi8(bytes, _mm_set1_epi8('_')));
+        break;
+    case CharClass::DIGIT:
+        in = InRange(bytes, '0', '9');
+        break;
+    }
+    return _mm_movemask_epi8(in);
+}
+
+static void ScanSse2(const char* data, size_t size, CharClass type, CharRun& run) {
+    while (run.end + 16 <= size) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + run.end));
+        uint32_t outside = ~Classify(bytes, type) & 0xffff;
+        size_t length = outside != 0 ? __builtin_ctz(outside) : 16;
+        if (type == CharClass::WHITESPACE) {
+            CountNewlines(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('\n'))),
+                          length, run.end, run);
+        }
+
+        run.end += length;
+        if (outside != 0) {
+            return;
+        }
+    }
+
+    ScanScalar(data, size, type, run);
+}
+
+__attribute__((target("avx2"))) static inline __m256i InRange(__m256i bytes,
+                                                              char low,
+                                                              char high) {
+    __m256i shifted = _mm256_add_epi8(bytes, _mm256_set1_epi8(static_cast<char>(-128 - low)));
+    return _mm256_cmpgt_epi8(_mm256_set1_epi8(static_cast<char>(-128 + (high - low) + 1)),
+                             shifted);
+}
+
+__attribute__((target("avx2"))) static inline uint32_t Classify(__m256i bytes,
+                                                               CharClass type) {
+    __m256i in = _mm256_setzero_si256();
+    switch (type) {
+    case CharClass::WHITESPACE:
+        in = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(' ')),
+                            _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\t'))),
+            _mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\n')),
+                            _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\r'))));
+        break;
+    case CharClass::IDENTIFIER:
+        in = _mm256_or_si256(
+            _mm256_or_si256(
+                InRange(_mm256_or_si256(bytes, _mm256_set1_epi8(0x20)), 'a', 'z'),
+                InRange(bytes, '0', '9')),
+            _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('_')));
+        break;
+    case CharClass::DIGIT:
+        in = InRange(bytes, '0', '9');
+        break;
+    }
+    return _mm256_movemask_epi8(in);
+}
+
+__attribute__((target("avx2"))) static void ScanAvx2(const char* data,
+                                                     size_t size,
+                                                     CharClass type,
+                                                     CharRun& run) {
+    while (run.end + 32 <= size) {
+        __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + run.end));
+        uint32_t outside = ~Classify(bytes, type);
+        size_t length = outside != 0 ? __builtin_ctz(outside) : 32;
+        if (type == CharClass::WHITESPACE) {
+            CountNewlines(static_cast<uint32_t>(_mm256_movemask_epi8(
+                              _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\n')))),
+                          length, run.end, run);
+        }
+
+        run.end += length;
+        if (outside != 0) {
+            return;
+        }
+    }
+
+    ScanSse2(data, size, type, run);
+}
+
+using ScanFunction = void (*)(const char* data, size_t size, CharClass type, CharRun& run);
+
+static ScanFunction SelectScan() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? &ScanAvx2 : &ScanSse2;
+}
+
+static const ScanFunction scan = SelectScan();
+
+#else
+
+static void (*const scan)(const char*, size_t, CharClass, CharRun&) = &ScanScalar;
+
+#endif
+
+CharRun Lexer::ScanRun(CharClass type) const {
+    CharRun run{_position, 0, 0};
+    scan(_input.data(), _input.size(), type, run);
+    return run;
+}
+
+void Lexer::Skip(const CharRun& run) {
+    if (run.newlines != 0) {
+        _line += run.newlines;
+        // the character after a newline is column 1, as with Advance
+        _column = run.end - run.last_newline;
+    } else {
+        _column += run.end - _position;
+    }
+
+    _position = run.end;
+    _read_position = run.end + 1;
+    _char = run.end < _input.size() ? _input[run.end] : '\0';
+}
+
 Lexer::Lexer(const std::string& input)
     : _input(input), _position(0), _read_position(1), _char(input[0]), _line(0),
       _column(0) {}
 
 Token Lexer::NextToken() {
+    // tokens are too small to be spans of their own, their time is summed up instead
+    if (Trace::IsOn()) {
+        uint64_t start = Trace::Now();
+        Token token = Scan();
+        _traced_time += Trace::Now() - start;
+        _traced_tokens++;
+        return token;
+    }
+
+    return Scan();
+}
+
+Token Lexer::Scan() {
     SkipWhitespace();
 
     Token token = CreateToken(Token::Type::ILLEGAL, "");
@@ -70,6 +283,15 @@ Token Lexer::NextToken() {
     case ';':
         token = CreateToken(Token::Type::SEMICOLON, ";");
         break;
+    case ':':
+        token = CreateToken(Token::Type::COLON, ":");
+        break;
+    case '.':
+        token = CreateToken(Token::Type::DOT, ".");
+        break;
+    case '"':
+        token = ReadString();
+        break;
     case '(':
         token = CreateToken(Token::Type::LPAREN, "(");
         break;
@@ -118,38 +340,94 @@ char Lexer::Peek() {
 }
 
 Token Lexer::CreateToken(Token::Type type, std::string literal) {
-    return Token(type, literal, _line, _column);
+    return Token(type, std::move(literal), _line, _column);
 }
 
 void Lexer::SkipWhitespace() {
-    while (IsWhitespace(_char)) {
-        if (_char == '\n') {
-            _line++;
-            _column = 0;
-        }
-        Advance();
+    if (IsWhitespace(_char)) {
+        Skip(ScanRun(CharClass::WHITESPACE));
     }
 }
 
 Token Lexer::ReadIdentifier() {
     uint position = _position;
-    while (IsAlphaNumerical(_char) || IsDigit(_char)) {
-        Advance();
-    }
+    Skip(ScanRun(CharClass::IDENTIFIER));
 
     std::string literal = _input.substr(position, _position - position);
 
-    if (keywords.find(literal) != keywords.end()) {
-        return CreateToken(keywords[literal], literal);
+    // longer identifiers cannot be keywords, no need to hash them
+    if (literal.size() <= MAX_KEYWORD_LENGTH) {
+        auto keyword = keywords.find(literal);
+        if (keyword != keywords.end()) {
+            return CreateToken(keyword->second, std::move(literal));
+        }
     }
 
-    return CreateToken(Token::Type::IDENT, literal);
+    return CreateToken(Token::Type::IDENT, std::move(literal));
 }
 
 Token Lexer::ReadNumber() {
     uint position = _position;
-    while (IsDigit(_char)) {
+    Skip(ScanRun(CharClass::DIGIT));
+
+    // only a digit after the dot makes a fraction, 1.x stays a field access
+    bool fraction = _char == '.' && IsDigit(Peek());
+    if (fraction) {
+        Advance();
+        Skip(ScanRun(CharClass::DIGIT));
+    }
+
+    // an exponent, as in 1e+300 or 2.5e-7, makes a float too
+    uint digit = _read_position + (Peek() == '+' || Peek() == '-');
+    bool exponent = (_char == 'e' || _char == 'E') && digit < _input.length() &&
+                    IsDigit(_input[digit]);
+    if (exponent) {
+        while (_position < digit) {
+            Advance();
+        }
+        Skip(ScanRun(CharClass::DIGIT));
+    }
+
+    Token::Type type = fraction || exponent ? Token::Type::FLOAT : Token::Type::INT;
+    return CreateToken(type, _input.substr(position, _position - position));
+}
+
+// Stops on the closing quote, which the caller skips. Supports \", \\, \n and \t,
+// an unterminated string is an ILLEGAL token.
+Token Lexer::ReadString() {
+    uint position = _position;
+    std::string value;
+
+    Advance();
+    while (_char != '"') {
+        if (_char == '\0') {
+            return CreateToken(Token::Type::ILLEGAL, _input.substr(position));
+        }
+        if (_char == '\n') {
+            _line++;
+            _column = 0;
+        }
+
+        if (_char == '\\') {
+            Advance();
+            switch (_char) {
+            case 'n':
+                value += '\n';
+                break;
+            case 't':
+                value += '\t';
+                break;
+            case '\0':
+                return CreateToken(Token::Type::ILLEGAL, _input.substr(position));
+            default:
+                value += _char;
+                break;
+            }
+        } else {
+            value += _char;
+        }
         Advance();
     }
-    return CreateToken(Token::Type::INT, _input.substr(position, _position - position));
+
+    return CreateToken(Token::Type::STRING, value);
 }
@@ -1,12 +1,199 @@
+#include "builtins.h"
 #include "lexer.h"
 #include "parser.h"
 #include "evaluator.h"
+#include "optimizer.h"
+#include "parallel.h"
+#include "snapshot.h"
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <cstring>
+#include <algorithm>
+#include <iomanip>
 
-int Repl() {
+struct Options {
+    Limits limits;
+    bool optimize = true;
+    bool verbose = false;
+    bool mem_stats = false;
+    // folded stacks are written here when set
+    const char* profile = nullptr;
+    unsigned long long profile_rate = 1000;
+    // a Chrome trace is written here when set
+    const char* trace = nullptr;
+    std::chrono::microseconds trace_threshold{100};
+    // globals are restored from here before running, and saved there afterwards
+    const char* snapshot = nullptr;
+    const char* save_snapshot = nullptr;
+    // threads pure calls are evaluated on, one for none
+    unsigned long long threads = 1;
+};
+
+void Optimize(Program& program, const Options& options, bool keep_globals) {
+    if (!options.optimize) {
+        return;
+    }
+
+    Optimizer optimizer(keep_globals);
+    optimizer.Optimize(program);
+    if (options.verbose) {
+        for (const std::string& change : optimizer.GetChanges()) {
+            std::cerr << "optimizer: " << change << std::endl;
+        }
+    }
+}
+
+static void WriteAllocations(std::ostream& stream, const char* name,
+                             const AllocationStats& stats) {
+    stream << std::left << std::setw(14) << name << std::right << std::setw(12)
+           << stats.allocations << std::setw(12) << stats.frees << std::setw(12)
+           << stats.Live() << std::setw(14) << stats.bytes << std::setw(14)
+           << stats.peak_bytes << "\n";
+}
+
+// Called once the globals are released, whatever is still live then only survives
+// through reference cycles.
+void WriteMemoryStats(std::ostream& stream, const Heap& heap) {
+    stream << std::left << std::setw(14) << "kind" << std::right << std::setw(12)
+           << "allocated" << std::setw(12) << "freed" << std::setw(12) << "live"
+           << std::setw(14) << "live bytes" << std::setw(14) << "peak bytes" << "\n";
+
+    AllocationStats total;
+    for (size_t kind = 0; kind < Heap::KINDS; kind++) {
+        const AllocationStats& stats = heap.kinds[kind];
+        if (stats.allocations == 0) {
+            continue;
+        }
+
+        WriteAllocations(stream, AllocationKindName(kind), stats);
+        total.allocations += stats.allocations;
+        total.frees += stats.frees;
+    }
+
+    total.bytes = heap.bytes;
+    total.peak_bytes = heap.peak_bytes;
+    WriteAllocations(stream, "total", total);
+    WriteAllocations(stream, "AST nodes", GetAstStats());
+
+    if (total.Live() != 0) {
+        stream << total.Live() << " allocations (" << heap.bytes
+               << " bytes) leaked through reference cycles\n";
+    }
+}
+
+// Runs the evaluator under the profiler if one was asked for, the folded stacks are
+// written when the session ends.
+class Profiling {
+public:
+    Profiling(Evaluator& evaluator, const Options& options)
+        : _path(options.profile),
+          _profiler(std::chrono::microseconds(1000000 / std::max(options.profile_rate, 1ull))) {
+        if (_path == nullptr) {
+            return;
+        }
+
+        if (!_profiler.Start()) {
+            std::cerr << "profiler: could not start the timer" << std::endl;
+            return;
+        }
+        evaluator.SetProfiler(&_profiler);
+    }
+
+    ~Profiling() {
+        if (_path == nullptr) {
+            return;
+        }
+
+        _profiler.Stop();
+        std::ofstream file(_path);
+        _profiler.WriteFolded(file);
+        if (!file) {
+            std::cerr << "profiler: could not write " << _path << std::endl;
+        }
+        if (_profiler.GetDropped() != 0) {
+            std::cerr << "profiler: " << _profiler.GetDropped() << " samples dropped"
+                      << std::endl;
+        }
+    }
+
+private:
+    const char* _path;
+    Profiler _profiler;
+};
+
+// Lets the evaluator fork pure calls onto options.threads threads for as long as the
+// returned pool lives, nullptr if there is only one.
+std::unique_ptr<ForkJoinPool> Parallelize(Evaluator& evaluator, const Options& options) {
+    if (options.threads <= 1) {
+        return nullptr;
+    }
+
+    auto pool = std::make_unique<ForkJoinPool>(options.threads - 1);
+    evaluator.SetPool(pool.get());
+    return pool;
+}
+
+// Binds the globals of options.snapshot if there is one. The returned arena holds the
+// nodes of the restored functions, which share it, nullptr if the snapshot could not
+// be read.
+std::shared_ptr<AstArena> Restore(Evaluator& evaluator,
+                                  const EnvironmentPtr& environment,
+                                  const Options& options) {
+    if (options.snapshot == nullptr) {
+        return std::make_shared<AstArena>();
+    }
+
+    std::ifstream file(options.snapshot, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "snapshot: could not open " << options.snapshot << std::endl;
+        return nullptr;
+    }
+    std::string data(std::istreambuf_iterator<char>(file), {});
+
+    try {
+        return LoadSnapshot(data, evaluator, environment);
+    } catch (const SnapshotError& error) {
+        std::cerr << "snapshot: " << options.snapshot << ": " << error.what() << std::endl;
+        return nullptr;
+    }
+}
+
+// Writes the globals to options.save_snapshot if asked to, false if that failed.
+bool Save(const Environment& environment, const Options& options) {
+    if (options.save_snapshot == nullptr) {
+        return true;
+    }
+
+    // written out only once complete, a failed save leaves the file as it was
+    std::ostringstream buffer;
+    try {
+        SaveSnapshot(buffer, environment);
+    } catch (const SnapshotError& error) {
+        std::cerr << "snapshot: cannot save " << error.what() << std::endl;
+        return false;
+    }
+
+    std::ofstream file(options.save_snapshot, std::ios::binary);
+    file << buffer.str();
+    if (!file) {
+        std::cerr << "snapshot: could not write " << options.save_snapshot << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int Repl(const Options& options) {
     Evaluator evaluator;
+    evaluator.SetLimits(options.limits);
+    Profiling profiling(evaluator, options);
+    std::unique_ptr<ForkJoinPool> pool = Parallelize(evaluator, options);
     EnvironmentPtr environment = std::make_shared<Environment>();
+    InstallBuiltins(evaluator, *environment);
+
+    if (Restore(evaluator, environment, options) == nullptr) {
+        return EXIT_FAILURE;
+    }
 
     while (true) {
         std::string input;
@@ -29,16 +216,36 @@ int Repl() {
             continue;
         }
 
+        // bindings stay visible to the following lines
+        Optimize(program, options, true);
+
+        // the functions and structs the line defined keep its nodes, the rest of
+        // them are freed with the program
         ObjectPtr result = evaluator.Evaluate(program, environment);
         std::cout << *result << std::endl;
     }
 
-    return EXIT_SUCCESS;
+    bool saved = Save(*environment, options);
+
+    if (options.mem_stats) {
+        environment = nullptr;
+        WriteMemoryStats(std::cerr, evaluator.GetHeap());
+    }
+
+    return saved ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
-int RunFile(std::string source) {
+int RunFile(std::string source, const Options& options) {
     Evaluator evaluator;
+    evaluator.SetLimits(options.limits);
+    Profiling profiling(evaluator, options);
+    std::unique_ptr<ForkJoinPool> pool = Parallelize(evaluator, options);
     EnvironmentPtr environment = std::make_shared<Environment>();
+    InstallBuiltins(evaluator, *environment);
+
+    if (Restore(evaluator, environment, options) == nullptr) {
+        return EXIT_FAILURE;
+    }
 
     Lexer lexer = Lexer(source);
     Parser parser = Parser(lexer);
@@ -52,32 +259,140 @@ int RunFile(std::string source) {
         return 1;
     }
 
+    // a prelude that is saved keeps all of its globals
+    Optimize(program, options, options.save_snapshot != nullptr);
+
     ObjectPtr result = evaluator.Evaluate(program, environment);
-    if (result->type == Object::Type::ERROR) {
+    bool failed = result->type == Object::Type::ERROR;
+    if (failed) {
         std::cerr << "RUNTIME ERROR: " << *result << std::endl;
-        return EXIT_FAILURE;
+    } else if (!Save(*environment, options)) {
+        failed = true;
+    }
+
+    if (options.mem_stats) {
+        result = nullptr;
+        environment = nullptr;
+        WriteMemoryStats(std::cerr, evaluator.GetHeap());
     }
 
-    return EXIT_SUCCESS;
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int Usage(const char* program) {
+    std::cerr << "usage: " << program << " [options] [file]\n"
+              << "  --max-steps N       stop after N calls and block statements\n"
+              << "  --max-objects N     cap the number of live objects\n"
+              << "  --max-memory BYTES  cap the bytes held by live objects\n"
+              << "  --timeout MS        stop after MS milliseconds\n"
+              << "  --no-optimize       skip inlining and dead code removal\n"
+              << "  --threads N         run independent calls of pure functions on N threads,\n"
+              << "                      unless a step, object, memory or time limit is set\n"
+              << "  --verbose           report what the optimizer changed\n"
+              << "  --mem-stats         report allocations by kind when done\n"
+              << "  --profile FILE      sample the call stack, write folded stacks to FILE\n"
+              << "  --profile-rate HZ   samples per second of CPU time, 1000 by default\n"
+              << "  --trace FILE        write a Chrome trace of parsing and evaluation to FILE\n"
+              << "  --trace-min US      only trace calls taking US microseconds, 100 by default\n"
+              << "  --snapshot FILE     start from the globals saved in FILE\n"
+              << "  --save-snapshot FILE\n"
+              << "                      save the globals to FILE when done\n";
+    return EXIT_FAILURE;
 }
 
 int main(int argc, char** argv) {
-    if (argc == 1) {
-        return Repl();
+    Options options;
+    Limits& limits = options.limits;
+    const char* path = nullptr;
+
+    for (int i = 1; i < argc; i++) {
+        const char* argument = argv[i];
+        if (argument[0] != '-') {
+            if (path != nullptr) {
+                return Usage(argv[0]);
+            }
+            path = argument;
+            continue;
+        }
+
+        if (std::strcmp(argument, "--no-optimize") == 0) {
+            options.optimize = false;
+            continue;
+        }
+        if (std::strcmp(argument, "--verbose") == 0) {
+            options.verbose = true;
+            continue;
+        }
+        if (std::strcmp(argument, "--mem-stats") == 0) {
+            options.mem_stats = true;
+            continue;
+        }
+
+        if (i + 1 >= argc) {
+            return Usage(argv[0]);
+        }
+        if (std::strcmp(argument, "--profile") == 0) {
+            options.profile = argv[++i];
+            continue;
+        }
+        if (std::strcmp(argument, "--trace") == 0) {
+            options.trace = argv[++i];
+            continue;
+        }
+        if (std::strcmp(argument, "--snapshot") == 0) {
+            options.snapshot = argv[++i];
+            continue;
+        }
+        if (std::strcmp(argument, "--save-snapshot") == 0) {
+            options.save_snapshot = argv[++i];
+            continue;
+        }
+
+        unsigned long long value = std::strtoull(argv[++i], nullptr, 10);
+        if (std::strcmp(argument, "--max-steps") == 0) {
+            limits.steps = value;
+        } else if (std::strcmp(argument, "--max-objects") == 0) {
+            limits.objects = value;
+        } else if (std::strcmp(argument, "--max-memory") == 0) {
+            limits.bytes = value;
+        } else if (std::strcmp(argument, "--timeout") == 0) {
+            limits.time = std::chrono::milliseconds(value);
+        } else if (std::strcmp(argument, "--threads") == 0) {
+            options.threads = value;
+        } else if (std::strcmp(argument, "--profile-rate") == 0) {
+            options.profile_rate = value;
+        } else if (std::strcmp(argument, "--trace-min") == 0) {
+            options.trace_threshold = std::chrono::microseconds(value);
+        } else {
+            return Usage(argv[0]);
+        }
     }
 
-    if (argc == 2) {
-        std::ifstream file(argv[1]);
+    std::string source;
+    if (path != nullptr) {
+        std::ifstream file(path);
         if (!file.is_open()) {
-            std::cout << "Could not open file: " << argv[1] << std::endl;
+            std::cout << "Could not open file: " << path << std::endl;
             return 1;
         }
 
-        std::string source((std::istreambuf_iterator<char>(file)),
-                           std::istreambuf_iterator<char>());
+        source.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    if (options.trace != nullptr) {
+        Trace::Start(options.trace_threshold);
+    }
 
-        return RunFile(source);
+    int status = path == nullptr ? Repl(options) : RunFile(source, options);
+
+    // written once at the end, so that tracing does no I/O during the run
+    if (options.trace != nullptr) {
+        std::ofstream file(options.trace);
+        Trace::Write(file);
+        if (!file) {
+            std::cerr << "trace: could not write " << options.trace << std::endl;
+        }
     }
 
-    return EXIT_SUCCESS;
+    return status;
 }
@@ -1,5 +1,9 @@
 #include "object.h"
 
+#include "io.h"
+
+#include <algorithm>
+
 
 std::ostream& operator<<(std::ostream& stream, const Object& object) {
     object.Print(stream);
@@ -11,40 +15,118 @@ std::ostream& operator<<(std::ostream& stream, Object::Type type) {
         case Object::Type::INT:
             stream << "INT";
             break;
+        case Object::Type::BIG_INT:
+            stream << "INT";
+            break;
         case Object::Type::BOOL:
             stream << "BOOL";
             break;
+        case Object::Type::STRING:
+            stream << "STRING";
+            break;
         case Object::Type::NIL:
             stream << "NIL";
             break;
-        case Object::Type::RETURN:
-            stream << "RETURN";
-            break;
         case Object::Type::FUNCTION:
             stream << "FUNCTION";
             break;
+        case Object::Type::BUILTIN:
+            stream << "BUILTIN";
+            break;
+        case Object::Type::STRUCT:
+            stream << "STRUCT";
+            break;
+        case Object::Type::INSTANCE:
+            stream << "INSTANCE";
+            break;
+        case Object::Type::ITERATOR:
+            stream << "ITERATOR";
+            break;
+        case Object::Type::MAP:
+            stream << "MAP";
+            break;
+        case Object::Type::FUTURE:
+            stream << "FUTURE";
+            break;
         case Object::Type::ERROR:
             stream << "ERROR";
             break;
+        case Object::Type::FLOAT:
+            stream << "FLOAT";
+            break;
+        case Object::Type::ARRAY:
+            stream << "ARRAY";
+            break;
     }
 
     return stream;
 }
 
+const char* AllocationKindName(size_t kind) {
+    switch (kind) {
+    case Object::Type::INT:
+        return "INT";
+    case Object::Type::BIG_INT:
+        return "BIG_INT";
+    case Object::Type::BOOL:
+        return "BOOL";
+    case Object::Type::STRING:
+        return "STRING";
+    case Object::Type::NIL:
+        return "NIL";
+    case Object::Type::FUNCTION:
+        return "FUNCTION";
+    case Object::Type::BUILTIN:
+        return "BUILTIN";
+    case Object::Type::STRUCT:
+        return "STRUCT";
+    case Object::Type::INSTANCE:
+        return "INSTANCE";
+    case Object::Type::ITERATOR:
+        return "ITERATOR";
+    case Object::Type::MAP:
+        return "MAP";
+    case Object::Type::FUTURE:
+        return "FUTURE";
+    case Object::Type::ERROR:
+        return "ERROR";
+    case Object::Type::FLOAT:
+        return "FLOAT";
+    case Object::Type::ARRAY:
+        return "ARRAY";
+    case Heap::ARRAY_STORAGE:
+        return "ARRAY_STORAGE";
+    case Heap::ENVIRONMENT:
+        return "ENVIRONMENT";
+    case Heap::MAP_STORAGE:
+        return "MAP_STORAGE";
+    default:
+        return nullptr;
+    }
+}
+
 void Integer::Print(std::ostream& stream) const {
     stream << value;
 }
 
+void Float::Print(std::ostream& stream) const {
+    stream << FormatFloat(value);
+}
+
+void BigInteger::Print(std::ostream& stream) const {
+    stream << value;
+}
+
 void Boolean::Print(std::ostream& stream) const {
     stream << (value ? "true" : "false");
 }
 
-void Nil::Print(std::ostream& stream) const {
-    stream << "nil";
+void String::Print(std::ostream& stream) const {
+    stream << "\"" << value << "\"";
 }
 
-void Return::Print(std::ostream& stream) const {
-    stream << "return " << *value;
+void Nil::Print(std::ostream& stream) const {
+    stream << "nil";
 }
 
 void Function::Print(std::ostream& stream) const {
@@ -58,6 +140,85 @@ void Function::Print(std::ostream& stream) const {
     stream << ") " << *body;
 }
 
+void Builtin::Print(std::ostream& stream) const {
+    stream << "builtin " << name;
+}
+
+void StructType::Print(std::ostream& stream) const {
+    stream << "struct " << shape->name << " { ";
+    for (size_t i = 0; i < shape->fields.size(); i++) {
+        stream << shape->fields[i];
+        if (i != shape->fields.size() - 1) {
+            stream << ", ";
+        }
+    }
+    stream << " }";
+}
+
+void Instance::Print(std::ostream& stream) const {
+    stream << shape->name << " { ";
+    for (size_t i = 0; i < shape->fields.size(); i++) {
+        stream << shape->fields[i] << ": " << *Fields()[i];
+        if (i != shape->fields.size() - 1) {
+            stream << ", ";
+        }
+    }
+    stream << " }";
+}
+
+void Range::Print(std::ostream& stream) const {
+    stream << "range(" << next << ", " << end << ")";
+}
+
+void Generator::Print(std::ostream& stream) const {
+    stream << "generator";
+}
+
+void Take::Print(std::ostream& stream) const {
+    stream << "take(" << *source << ", " << remaining << ")";
+}
+
+void Map::Print(std::ostream& stream) const {
+    // a map can contain itself
+    thread_local std::vector<const Map*> printing;
+    if (std::find(printing.begin(), printing.end(), this) != printing.end()) {
+        stream << "{...}";
+        return;
+    }
+    printing.push_back(this);
+
+    stream << "{";
+    const auto& entries = table.Entries();
+    for (size_t i = 0; i < entries.size(); i++) {
+        stream << *entries[i].key << ": " << *entries[i].value;
+        if (i != entries.size() - 1) {
+            stream << ", ";
+        }
+    }
+    stream << "}";
+
+    printing.pop_back();
+}
+
+void FloatArray::Print(std::ostream& stream) const {
+    stream << "[";
+    for (size_t i = 0; i < values.size(); i++) {
+        stream << FormatFloat(values[i]);
+        if (i != values.size() - 1) {
+            stream << ", ";
+        }
+    }
+    stream << "]";
+}
+
+void Keys::Print(std::ostream& stream) const {
+    stream << "keys(" << *map << ")";
+}
+
+void Future::Print(std::ostream& stream) const {
+    stream << (request->kind == IoRequest::Kind::READ ? "read " : "write ") << request->path;
+}
+
 void Error::Print(std::ostream& stream) const {
     stream << "error: " << message;
 }
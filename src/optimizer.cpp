@@ -0,0 +1,1099 @@
+#include "optimizer.h"
+
+#include <algorithm>
+#include <sstream>
+
+using Renames = std::unordered_map<std::string, const Expression*>;
+
+static void CountReferences(const Expression* node,
+                            std::unordered_map<std::string, size_t>& references);
+
+static void CountReferences(const Statement* node,
+                            std::unordered_map<std::string, size_t>& references) {
+    ForEachChild(node, [&references](auto child) { CountReferences(child, references); });
+}
+
+// every identifier use, nested functions included since they capture the scope
+static void CountReferences(const Expression* node,
+                            std::unordered_map<std::string, size_t>& references) {
+    if (node->type == Expression::Type::IDENT) {
+        references[static_cast<const Identifier*>(node)->value]++;
+    } else if (node->type == Expression::Type::ASSIGN) {
+        // an assigned name is still needed even if it is never read
+        references[static_cast<const AssignExpression*>(node)->name->value]++;
+    }
+    ForEachChild(node, [&references](auto child) { CountReferences(child, references); });
+}
+
+static void CollectAssigned(const Expression* node, std::unordered_set<std::string>& names);
+
+static void CollectAssigned(const Statement* node, std::unordered_set<std::string>& names) {
+    ForEachChild(node, [&names](auto child) { CollectAssigned(child, names); });
+}
+
+// every assignment target, nested functions included since they can assign to
+// bindings of an enclosing scope
+static void CollectAssigned(const Expression* node, std::unordered_set<std::string>& names) {
+    if (node->type == Expression::Type::ASSIGN) {
+        names.insert(static_cast<const AssignExpression*>(node)->name->value);
+    }
+    ForEachChild(node, [&names](auto child) { CollectAssigned(child, names); });
+}
+
+static Expression* Clone(const Expression* node, const Renames& renames);
+
+static Statement* Clone(const Statement* node, const Renames& renames) {
+    switch (node->type) {
+    case Statement::Type::LET: {
+        const LetStatement* let = static_cast<const LetStatement*>(node);
+        auto renamed = renames.find(let->name->value);
+        std::string name = renamed != renames.end()
+                               ? static_cast<const Identifier*>(renamed->second)->value
+                               : let->name->value;
+        return new LetStatement(new Identifier(name), Clone(let->value, renames));
+    }
+    case Statement::Type::RETURN:
+        return new ReturnStatement(
+            Clone(static_cast<const ReturnStatement*>(node)->value, renames));
+    case Statement::Type::YIELD:
+        return new YieldStatement(
+            Clone(static_cast<const YieldStatement*>(node)->value, renames));
+    case Statement::Type::EXPRESSION:
+        return new ExpressionStatement(
+            Clone(static_cast<const ExpressionStatement*>(node)->expression, renames));
+    }
+
+    return nullptr;
+}
+
+static BlockExpression* CloneBlock(const BlockExpression* node, const Renames& renames) {
+    std::vector<Statement*> statements;
+    for (const Statement* statement : node->statements) {
+        statements.push_back(Clone(statement, renames));
+    }
+
+    return new BlockExpression(statements);
+}
+
+// Fresh copy with identifiers substituted, specializations start over. Only used on
+// bodies without function or struct literals.
+static Expression* Clone(const Expression* node, const Renames& renames) {
+    switch (node->type) {
+    case Expression::Type::IDENT: {
+        const std::string& name = static_cast<const Identifier*>(node)->value;
+        auto renamed = renames.find(name);
+        if (renamed != renames.end()) {
+            return Clone(renamed->second, {});
+        }
+        return new Identifier(name);
+    }
+    case Expression::Type::INT:
+        return new IntegerLiteral(static_cast<const IntegerLiteral*>(node)->value);
+    case Expression::Type::FLOAT:
+        return new FloatLiteral(static_cast<const FloatLiteral*>(node)->value);
+    case Expression::Type::BIG_INT:
+        return new BigIntLiteral(static_cast<const BigIntLiteral*>(node)->value);
+    case Expression::Type::BOOLEAN:
+        return new BooleanLiteral(static_cast<const BooleanLiteral*>(node)->value);
+    case Expression::Type::PREFIX: {
+        const PrefixExpression* prefix = static_cast<const PrefixExpression*>(node);
+        return new PrefixExpression(prefix->op, Clone(prefix->right, renames));
+    }
+    case Expression::Type::INFIX: {
+        const InfixExpression* infix = static_cast<const InfixExpression*>(node);
+        return new InfixExpression(infix->op,
+                                   Clone(infix->left, renames),
+                                   Clone(infix->right, renames));
+    }
+    case Expression::Type::BLOCK:
+        return CloneBlock(static_cast<const BlockExpression*>(node), renames);
+    case Expression::Type::IF_ELSE: {
+        const IfElseExpression* if_else = static_cast<const IfElseExpression*>(node);
+        return new IfElseExpression(
+            Clone(if_else->condition, renames),
+            CloneBlock(if_else->consequence, renames),
+            if_else->alternative != nullptr ? Clone(if_else->alternative, renames)
+                                            : nullptr);
+    }
+    case Expression::Type::CALL: {
+        const CallExpression* call = static_cast<const CallExpression*>(node);
+        std::vector<Expression*> arguments;
+        for (const Expression* argument : call->arguments) {
+            arguments.push_back(Clone(argument, renames));
+        }
+        return new CallExpression(Clone(call->function, renames), arguments);
+    }
+    case Expression::Type::STRING:
+        return new StringLiteral(static_cast<const StringLiteral*>(node)->value);
+    case Expression::Type::MAP: {
+        std::vector<std::pair<Expression*, Expression*>> entries;
+        for (const auto& [key, value] : static_cast<const MapExpression*>(node)->entries) {
+            entries.emplace_back(Clone(key, renames), Clone(value, renames));
+        }
+        return new MapExpression(std::move(entries));
+    }
+    case Expression::Type::FIELD: {
+        const FieldExpression* field = static_cast<const FieldExpression*>(node);
+        return new FieldExpression(Clone(field->object, renames),
+                                   new Identifier(field->field->value));
+    }
+    case Expression::Type::ASSIGN: {
+        const AssignExpression* assign = static_cast<const AssignExpression*>(node);
+        auto renamed = renames.find(assign->name->value);
+        std::string name = renamed != renames.end()
+                               ? static_cast<const Identifier*>(renamed->second)->value
+                               : assign->name->value;
+        return new AssignExpression(new Identifier(name), Clone(assign->value, renames));
+    }
+    case Expression::Type::WHILE: {
+        const WhileExpression* loop = static_cast<const WhileExpression*>(node);
+        return new WhileExpression(Clone(loop->condition, renames),
+                                   CloneBlock(loop->body, renames));
+    }
+    case Expression::Type::FOR: {
+        const ForExpression* loop = static_cast<const ForExpression*>(node);
+        return new ForExpression(Clone(loop->initializer, renames),
+                                 Clone(loop->condition, renames),
+                                 Clone(loop->update, renames),
+                                 CloneBlock(loop->body, renames));
+    }
+    default:
+        return nullptr;
+    }
+}
+
+// names introduced by the optimizer itself, unique and bound before every use
+static bool IsHygienic(const std::string& name) {
+    return name.find('#') != std::string::npos;
+}
+
+// What inlining needs to know about a function body.
+struct Inspection {
+    size_t size = 0;
+    bool suitable = true;
+    std::unordered_set<std::string> locals;
+    std::unordered_set<std::string> lets;
+    std::vector<std::string> free;
+};
+
+static void Inspect(const Expression* node, Inspection& inspection);
+
+static void Inspect(const Statement* node, Inspection& inspection, bool top = false) {
+    inspection.size++;
+    switch (node->type) {
+    case Statement::Type::LET: {
+        const LetStatement* let = static_cast<const LetStatement*>(node);
+        Inspect(let->value, inspection);
+        const std::string& name = let->name->value;
+        // a let in a nested block only binds for some paths, and a second let of the
+        // same name changes what earlier uses refer to
+        if ((!top && !IsHygienic(name)) || !inspection.locals.insert(name).second) {
+            inspection.suitable = false;
+        }
+        break;
+    }
+    case Statement::Type::RETURN:
+    case Statement::Type::YIELD:
+        inspection.suitable = false;
+        break;
+    case Statement::Type::EXPRESSION:
+        Inspect(static_cast<const ExpressionStatement*>(node)->expression, inspection);
+        break;
+    }
+}
+
+static void Inspect(const Expression* node, Inspection& inspection) {
+    inspection.size++;
+    switch (node->type) {
+    case Expression::Type::IDENT: {
+        const std::string& name = static_cast<const Identifier*>(node)->value;
+        if (inspection.locals.count(name) != 0 || IsHygienic(name)) {
+            break;
+        }
+        // used before its let, resolves to an outer binding for now
+        if (inspection.lets.count(name) != 0) {
+            inspection.suitable = false;
+            break;
+        }
+        if (std::find(inspection.free.begin(), inspection.free.end(), name) ==
+            inspection.free.end()) {
+            inspection.free.push_back(name);
+        }
+        break;
+    }
+    case Expression::Type::FUNCTION:
+    case Expression::Type::STRUCT:
+    case Expression::Type::ASSIGN:
+    case Expression::Type::WHILE:
+    case Expression::Type::FOR:
+        inspection.suitable = false;
+        break;
+    default:
+        // statements of nested blocks are not at the top of the body
+        ForEachChild(node, [&inspection](auto child) { Inspect(child, inspection); });
+        break;
+    }
+}
+
+static bool MayBind(const Expression* node);
+
+static bool MayBind(const Statement* node) {
+    bool binds = node->type == Statement::Type::LET;
+    ForEachChild(node, [&binds](auto child) { binds = binds || MayBind(child); });
+    return binds;
+}
+
+// Whether evaluating node can bind or assign a name of the enclosing scope, or run
+// code that might. Function literals only run when called.
+static bool MayBind(const Expression* node) {
+    switch (node->type) {
+    case Expression::Type::CALL:
+    case Expression::Type::ASSIGN:
+        return true;
+    case Expression::Type::FUNCTION:
+        return false;
+    default: {
+        bool binds = false;
+        ForEachChild(node, [&binds](auto child) { binds = binds || MayBind(child); });
+        return binds;
+    }
+    }
+}
+
+static bool Measure(const Expression* node, size_t& size);
+
+static bool Measure(const Statement* node, size_t& size) {
+    size++;
+    bool clonable = true;
+    ForEachChild(node, [&](auto child) { clonable = clonable && Measure(child, size); });
+    return clonable;
+}
+
+// Adds the nodes of a body to size, false if it has function or struct literals,
+// which are not cloned.
+static bool Measure(const Expression* node, size_t& size) {
+    size++;
+    if (node->type == Expression::Type::FUNCTION || node->type == Expression::Type::STRUCT) {
+        return false;
+    }
+
+    bool clonable = true;
+    ForEachChild(node, [&](auto child) { clonable = clonable && Measure(child, size); });
+    return clonable;
+}
+
+static bool IsConstant(const Expression* node) {
+    return node->type == Expression::Type::INT || node->type == Expression::Type::BOOLEAN;
+}
+
+// as IsTruthy would see the value of a constant
+static bool IsTrue(const Expression* node) {
+    if (node->type == Expression::Type::INT) {
+        return static_cast<const IntegerLiteral*>(node)->value != 0;
+    }
+    return static_cast<const BooleanLiteral*>(node)->value;
+}
+
+// The value of an operation on two constants, or the node itself if evaluating it
+// would fail or overflow into a big integer.
+static Expression* FoldInfix(InfixExpression* node) {
+    using Operation = InfixExpression::Operation;
+
+    if (node->left->type == Expression::Type::BOOLEAN &&
+        node->right->type == Expression::Type::BOOLEAN) {
+        bool left = static_cast<const BooleanLiteral*>(node->left)->value;
+        bool right = static_cast<const BooleanLiteral*>(node->right)->value;
+        switch (node->op) {
+        case Operation::EQUAL:
+            return new BooleanLiteral(left == right);
+        case Operation::NOT_EQUAL:
+            return new BooleanLiteral(left != right);
+        case Operation::AND:
+            return new BooleanLiteral(left && right);
+        case Operation::OR:
+            return new BooleanLiteral(left || right);
+        default:
+            return node;
+        }
+    }
+
+    if (node->left->type != Expression::Type::INT || node->right->type != Expression::Type::INT) {
+        return node;
+    }
+
+    int64_t left = static_cast<const IntegerLiteral*>(node->left)->value;
+    int64_t right = static_cast<const IntegerLiteral*>(node->right)->value;
+    int64_t result;
+    switch (node->op) {
+    case Operation::ADD:
+        if (__builtin_add_overflow(left, right, &result)) {
+            return node;
+        }
+        return new IntegerLiteral(result);
+    case Operation::SUBTRACT:
+        if (__builtin_sub_overflow(left, right, &result)) {
+            return node;
+        }
+        return new IntegerLiteral(result);
+    case Operation::MULTIPLY:
+        if (__builtin_mul_overflow(left, right, &result)) {
+            return node;
+        }
+        return new IntegerLiteral(result);
+    case Operation::DIVIDE:
+        if (right == 0 || (left == INT64_MIN && right == -1)) {
+            return node;
+        }
+        return new IntegerLiteral(left / right);
+    case Operation::LESS:
+        return new BooleanLiteral(left < right);
+    case Operation::GREATER:
+        return new BooleanLiteral(left > right);
+    case Operation::LESS_EQUAL:
+        return new BooleanLiteral(left <= right);
+    case Operation::GREATER_EQUAL:
+        return new BooleanLiteral(left >= right);
+    case Operation::EQUAL:
+        return new BooleanLiteral(left == right);
+    case Operation::NOT_EQUAL:
+        return new BooleanLiteral(left != right);
+    case Operation::AND:
+        return new BooleanLiteral(left != 0 && right != 0);
+    case Operation::OR:
+        return new BooleanLiteral(left != 0 || right != 0);
+    }
+
+    return node;
+}
+
+static Expression* Fold(Expression* node);
+
+static void Fold(Statement* node) {
+    switch (node->type) {
+    case Statement::Type::LET: {
+        LetStatement* let = static_cast<LetStatement*>(node);
+        let->value = Fold(let->value);
+        break;
+    }
+    case Statement::Type::RETURN: {
+        ReturnStatement* return_statement = static_cast<ReturnStatement*>(node);
+        return_statement->value = Fold(return_statement->value);
+        break;
+    }
+    case Statement::Type::YIELD: {
+        YieldStatement* yield = static_cast<YieldStatement*>(node);
+        yield->value = Fold(yield->value);
+        break;
+    }
+    case Statement::Type::EXPRESSION: {
+        ExpressionStatement* expression = static_cast<ExpressionStatement*>(node);
+        expression->expression = Fold(expression->expression);
+        break;
+    }
+    }
+}
+
+static void FoldBlock(BlockExpression* node) {
+    for (Statement* statement : node->statements) {
+        Fold(statement);
+    }
+}
+
+// Evaluates operators on constants and takes the branch of conditionals on them, in a
+// clone without function or struct literals.
+static Expression* Fold(Expression* node) {
+    switch (node->type) {
+    case Expression::Type::PREFIX: {
+        PrefixExpression* prefix = static_cast<PrefixExpression*>(node);
+        prefix->right = Fold(prefix->right);
+        if (prefix->op == PrefixExpression::Operation::NOT && IsConstant(prefix->right)) {
+            return new BooleanLiteral(!IsTrue(prefix->right));
+        }
+        if (prefix->op == PrefixExpression::Operation::NEGATE &&
+            prefix->right->type == Expression::Type::INT &&
+            static_cast<IntegerLiteral*>(prefix->right)->value != INT64_MIN) {
+            return new IntegerLiteral(-static_cast<IntegerLiteral*>(prefix->right)->value);
+        }
+        break;
+    }
+    case Expression::Type::INFIX: {
+        InfixExpression* infix = static_cast<InfixExpression*>(node);
+        infix->left = Fold(infix->left);
+        infix->right = Fold(infix->right);
+        return FoldInfix(infix);
+    }
+    case Expression::Type::BLOCK:
+        FoldBlock(static_cast<BlockExpression*>(node));
+        break;
+    case Expression::Type::IF_ELSE: {
+        IfElseExpression* if_else = static_cast<IfElseExpression*>(node);
+        if_else->condition = Fold(if_else->condition);
+        FoldBlock(if_else->consequence);
+        if (if_else->alternative != nullptr) {
+            if_else->alternative = Fold(if_else->alternative);
+        }
+
+        // without an alternative a false condition is nil, which has no literal
+        if (IsConstant(if_else->condition)) {
+            if (IsTrue(if_else->condition)) {
+                return if_else->consequence;
+            }
+            if (if_else->alternative != nullptr) {
+                return if_else->alternative;
+            }
+        }
+        break;
+    }
+    case Expression::Type::CALL: {
+        CallExpression* call = static_cast<CallExpression*>(node);
+        call->function = Fold(call->function);
+        for (Expression*& argument : call->arguments) {
+            argument = Fold(argument);
+        }
+        break;
+    }
+    case Expression::Type::MAP:
+        for (auto& [key, value] : static_cast<MapExpression*>(node)->entries) {
+            key = Fold(key);
+            value = Fold(value);
+        }
+        break;
+    case Expression::Type::FIELD: {
+        FieldExpression* field = static_cast<FieldExpression*>(node);
+        field->object = Fold(field->object);
+        break;
+    }
+    case Expression::Type::ASSIGN: {
+        AssignExpression* assign = static_cast<AssignExpression*>(node);
+        assign->value = Fold(assign->value);
+        break;
+    }
+    case Expression::Type::WHILE: {
+        WhileExpression* loop = static_cast<WhileExpression*>(node);
+        loop->condition = Fold(loop->condition);
+        FoldBlock(loop->body);
+        break;
+    }
+    case Expression::Type::FOR: {
+        ForExpression* loop = static_cast<ForExpression*>(node);
+        Fold(loop->initializer);
+        loop->condition = Fold(loop->condition);
+        loop->update = Fold(loop->update);
+        FoldBlock(loop->body);
+        break;
+    }
+    default:
+        break;
+    }
+
+    return node;
+}
+
+void Optimizer::Optimize(Program& program) {
+    // inlined copies live as long as the program they were inlined into
+    AstArena::Scope arena(program.arena.get());
+
+    for (const Statement* statement : program.statements) {
+        CollectAssigned(statement, _assigned);
+    }
+
+    Scope global{nullptr, {}, {}, {}, {}};
+    for (const Statement* statement : program.statements) {
+        Collect(statement, global);
+    }
+    InlineStatements(program.statements, global, true);
+    AddSpecializations();
+
+    // removing one binding can leave the ones it used unreferenced
+    while (Cleanup(program.statements, true)) {
+    }
+}
+
+// Inlining
+
+void Optimizer::Collect(const Statement* node, Scope& scope) {
+    if (node->type == Statement::Type::LET) {
+        scope.bindings[static_cast<const LetStatement*>(node)->name->value]++;
+    }
+    ForEachChild(node, [this, &scope](auto child) { Collect(child, scope); });
+}
+
+// lets in nested blocks bind in the same scope, function literals start their own
+void Optimizer::Collect(const Expression* node, Scope& scope) {
+    if (node->type != Expression::Type::FUNCTION) {
+        ForEachChild(node, [this, &scope](auto child) { Collect(child, scope); });
+    }
+}
+
+const Optimizer::Scope* Optimizer::Resolve(const std::string& name, const Scope* scope) {
+    for (; scope != nullptr; scope = scope->parent) {
+        if (scope->bindings.count(name) != 0) {
+            return scope;
+        }
+    }
+
+    return nullptr;
+}
+
+void Optimizer::InlineStatements(std::vector<Statement*>& statements,
+                                 Scope& scope,
+                                 bool top) {
+    for (Statement* statement : statements) {
+        switch (statement->type) {
+        case Statement::Type::LET: {
+            LetStatement* let = static_cast<LetStatement*>(statement);
+            let->value = InlineExpression(let->value, scope);
+
+            const std::string& name = let->name->value;
+            Candidate candidate;
+            if (top && let->value->type == Expression::Type::FUNCTION &&
+                scope.bindings[name] == 1 &&
+                MakeCandidate(name,
+                              static_cast<const FunctionExpression*>(let->value),
+                              scope,
+                              candidate)) {
+                scope.candidates[name] = candidate;
+            }
+            if (top && let->value->type == Expression::Type::FUNCTION &&
+                scope.bindings[name] == 1) {
+                MakeSpecializable(let, statements, scope);
+            }
+            if (top) {
+                scope.defined.insert(name);
+            }
+            break;
+        }
+        case Statement::Type::RETURN: {
+            ReturnStatement* return_statement = static_cast<ReturnStatement*>(statement);
+            return_statement->value = InlineExpression(return_statement->value, scope);
+            break;
+        }
+        case Statement::Type::YIELD: {
+            YieldStatement* yield = static_cast<YieldStatement*>(statement);
+            yield->value = InlineExpression(yield->value, scope);
+            break;
+        }
+        case Statement::Type::EXPRESSION: {
+            ExpressionStatement* expression = static_cast<ExpressionStatement*>(statement);
+            expression->expression = InlineExpression(expression->expression, scope);
+            break;
+        }
+        }
+    }
+}
+
+Expression* Optimizer::InlineExpression(Expression* node, Scope& scope) {
+    switch (node->type) {
+    case Expression::Type::PREFIX: {
+        PrefixExpression* prefix = static_cast<PrefixExpression*>(node);
+        prefix->right = InlineExpression(prefix->right, scope);
+        break;
+    }
+    case Expression::Type::INFIX: {
+        InfixExpression* infix = static_cast<InfixExpression*>(node);
+        infix->left = InlineExpression(infix->left, scope);
+        infix->right = InlineExpression(infix->right, scope);
+        break;
+    }
+    case Expression::Type::BLOCK:
+        InlineStatements(static_cast<BlockExpression*>(node)->statements, scope, false);
+        break;
+    case Expression::Type::IF_ELSE: {
+        IfElseExpression* if_else = static_cast<IfElseExpression*>(node);
+        if_else->condition = InlineExpression(if_else->condition, scope);
+        InlineStatements(if_else->consequence->statements, scope, false);
+        if (if_else->alternative != nullptr) {
+            if_else->alternative = InlineExpression(if_else->alternative, scope);
+        }
+        break;
+    }
+    case Expression::Type::FUNCTION: {
+        FunctionExpression* function = static_cast<FunctionExpression*>(node);
+        Scope inner{&scope, {}, {}, {}, {}};
+        for (const Identifier* parameter : function->parameters) {
+            inner.bindings[parameter->value]++;
+            inner.defined.insert(parameter->value);
+        }
+        for (const Statement* statement : function->body->statements) {
+            Collect(statement, inner);
+        }
+        InlineStatements(function->body->statements, inner, true);
+        break;
+    }
+    case Expression::Type::CALL: {
+        CallExpression* call = static_cast<CallExpression*>(node);
+        call->function = InlineExpression(call->function, scope);
+        for (Expression*& argument : call->arguments) {
+            argument = InlineExpression(argument, scope);
+        }
+        Expression* inlined = InlineCall(call, scope);
+        if (inlined != call) {
+            return inlined;
+        }
+        return Specialize(call, scope);
+    }
+    case Expression::Type::MAP:
+        for (auto& [key, value] : static_cast<MapExpression*>(node)->entries) {
+            key = InlineExpression(key, scope);
+            value = InlineExpression(value, scope);
+        }
+        break;
+    case Expression::Type::FIELD: {
+        FieldExpression* field = static_cast<FieldExpression*>(node);
+        field->object = InlineExpression(field->object, scope);
+        break;
+    }
+    case Expression::Type::ASSIGN: {
+        AssignExpression* assign = static_cast<AssignExpression*>(node);
+        assign->value = InlineExpression(assign->value, scope);
+        break;
+    }
+    case Expression::Type::WHILE: {
+        WhileExpression* loop = static_cast<WhileExpression*>(node);
+        loop->condition = InlineExpression(loop->condition, scope);
+        InlineStatements(loop->body->statements, scope, false);
+        break;
+    }
+    case Expression::Type::FOR: {
+        ForExpression* loop = static_cast<ForExpression*>(node);
+        std::vector<Statement*> initializer{loop->initializer};
+        InlineStatements(initializer, scope, false);
+        loop->condition = InlineExpression(loop->condition, scope);
+        loop->update = InlineExpression(loop->update, scope);
+        InlineStatements(loop->body->statements, scope, false);
+        break;
+    }
+    default:
+        break;
+    }
+
+    return node;
+}
+
+bool Optimizer::MakeCandidate(const std::string& name,
+                              const FunctionExpression* function,
+                              Scope& scope,
+                              Candidate& candidate) {
+    Inspection inspection;
+    for (const Identifier* parameter : function->parameters) {
+        if (!inspection.locals.insert(parameter->value).second) {
+            return false;
+        }
+    }
+    for (const Statement* statement : function->body->statements) {
+        if (statement->type == Statement::Type::LET) {
+            inspection.lets.insert(static_cast<const LetStatement*>(statement)->name->value);
+        }
+    }
+    for (const Statement* statement : function->body->statements) {
+        Inspect(statement, inspection, true);
+    }
+    if (!inspection.suitable || inspection.size > INLINE_BUDGET) {
+        return false;
+    }
+
+    // The closure sees the bindings made before it was created. Names bound exactly
+    // once by then keep their value, so they are safe to look up at the call site.
+    candidate.function = function;
+    for (const std::string& free : inspection.free) {
+        if (free == name || _assigned.count(free) != 0) {
+            return false;
+        }
+
+        const Scope* owner = Resolve(free, &scope);
+        if (owner == nullptr || owner->bindings.at(free) != 1 ||
+            owner->defined.count(free) == 0) {
+            return false;
+        }
+        candidate.free.emplace_back(free, owner);
+    }
+
+    return true;
+}
+
+Expression* Optimizer::InlineCall(CallExpression* node, Scope& scope) {
+    if (node->function->type != Expression::Type::IDENT) {
+        return node;
+    }
+
+    const std::string& name = static_cast<Identifier*>(node->function)->value;
+    const Scope* owner = Resolve(name, &scope);
+    if (owner == nullptr || owner->bindings.at(name) != 1 || _assigned.count(name) != 0) {
+        return node;
+    }
+    auto found = owner->candidates.find(name);
+    if (found == owner->candidates.end()) {
+        return node;
+    }
+
+    const Candidate& candidate = found->second;
+    const FunctionExpression* function = candidate.function;
+    if (function->parameters.size() != node->arguments.size()) {
+        return node;
+    }
+    for (const auto& [free, free_owner] : candidate.free) {
+        if (Resolve(free, &scope) != free_owner) {
+            return node;
+        }
+    }
+
+    std::string suffix = "#" + std::to_string(++_inlined);
+    Renames renames;
+    std::vector<Statement*> statements;
+
+    // A name is read where the body uses it, after every argument, so it stays as it
+    // was only if no later argument can bind it again.
+    std::vector<bool> rebound(node->arguments.size(), false);
+    for (size_t i = node->arguments.size(); i-- > 1;) {
+        rebound[i - 1] = rebound[i] || MayBind(node->arguments[i]);
+    }
+
+    // literals and bound names are substituted, anything else is evaluated once into
+    // a renamed let before the body
+    for (size_t i = 0; i < node->arguments.size(); i++) {
+        const std::string& parameter = function->parameters[i]->value;
+        Expression* argument = node->arguments[i];
+        if (argument->type == Expression::Type::INT ||
+            argument->type == Expression::Type::FLOAT ||
+            argument->type == Expression::Type::BOOLEAN ||
+            (argument->type == Expression::Type::IDENT && !rebound[i] &&
+             Resolve(static_cast<Identifier*>(argument)->value, &scope) != nullptr &&
+             _assigned.count(static_cast<Identifier*>(argument)->value) == 0)) {
+            renames[parameter] = argument;
+            continue;
+        }
+
+        Identifier* renamed = new Identifier(parameter + suffix);
+        statements.push_back(new LetStatement(renamed, argument));
+        renames[parameter] = renamed;
+    }
+
+    std::vector<const std::string*> lets;
+    CollectLets(function->body, lets);
+    for (const std::string* let : lets) {
+        // a let inlined before keeps its suffix, so it stays apart from the caller's own
+        renames[*let] = new Identifier(*let + suffix);
+    }
+
+    for (const Statement* statement : function->body->statements) {
+        statements.push_back(Clone(statement, renames));
+    }
+    _changes.push_back("inlined call to " + name);
+
+    if (statements.size() == 1 && statements[0]->type == Statement::Type::EXPRESSION) {
+        return static_cast<ExpressionStatement*>(statements[0])->expression;
+    }
+
+    return new BlockExpression(statements);
+}
+
+// Specialization
+
+void Optimizer::MakeSpecializable(LetStatement* let,
+                                  std::vector<Statement*>& statements,
+                                  Scope& scope) {
+    const std::string& name = let->name->value;
+    const FunctionExpression* function = static_cast<const FunctionExpression*>(let->value);
+    if (function->generator || _assigned.count(name) != 0) {
+        return;
+    }
+
+    size_t size = 0;
+    if (!Measure(function->body, size) || size > SPECIALIZE_BUDGET) {
+        return;
+    }
+
+    // a parameter that is assigned or bound again in the body does not keep its value
+    std::unordered_set<std::string> assigned;
+    CollectAssigned(function->body, assigned);
+    std::vector<const std::string*> lets;
+    CollectLets(function->body, lets);
+    for (const std::string* let : lets) {
+        assigned.insert(*let);
+    }
+
+    std::unordered_set<std::string> parameters;
+    std::vector<bool> substitutable;
+    for (const Identifier* parameter : function->parameters) {
+        if (!parameters.insert(parameter->value).second) {
+            return;
+        }
+        substitutable.push_back(assigned.count(parameter->value) == 0);
+    }
+
+    scope.specializable[name] = _specializable.size();
+    _specializable.push_back({let, &statements, size, std::move(substitutable), {}, {}});
+}
+
+Expression* Optimizer::Specialize(CallExpression* node, Scope& scope) {
+    if (node->function->type != Expression::Type::IDENT) {
+        return node;
+    }
+
+    // the function must be bound before the call, so its copies are as well
+    const std::string& name = static_cast<Identifier*>(node->function)->value;
+    const Scope* owner = Resolve(name, &scope);
+    if (owner == nullptr || owner->bindings.at(name) != 1 || owner->defined.count(name) == 0) {
+        return node;
+    }
+    auto found = owner->specializable.find(name);
+    if (found == owner->specializable.end()) {
+        return node;
+    }
+
+    Specializable& specializable = _specializable[found->second];
+    const FunctionExpression* function =
+        static_cast<const FunctionExpression*>(specializable.let->value);
+    if (function->parameters.size() != node->arguments.size()) {
+        return node;
+    }
+
+    // the literals passed, one entry per parameter and empty for the others
+    Renames renames;
+    std::string key;
+    for (size_t i = 0; i < node->arguments.size(); i++) {
+        const Expression* argument = node->arguments[i];
+        if (specializable.substitutable[i] &&
+            (argument->type == Expression::Type::INT ||
+             argument->type == Expression::Type::FLOAT ||
+             argument->type == Expression::Type::BOOLEAN ||
+             argument->type == Expression::Type::STRING)) {
+            renames[function->parameters[i]->value] = argument;
+            std::stringstream stream;
+            stream << *argument;
+            key += stream.str();
+        }
+        key += '\0';
+    }
+    if (renames.empty()) {
+        return node;
+    }
+
+    auto copy = specializable.copies.find(key);
+    if (copy == specializable.copies.end()) {
+        if (_specialized_size + specializable.size > PROGRAM_SPECIALIZE_BUDGET) {
+            return node;
+        }
+        _specialized_size += specializable.size;
+
+        std::vector<Identifier*> parameters;
+        for (const Identifier* parameter : function->parameters) {
+            if (renames.count(parameter->value) == 0) {
+                parameters.push_back(new Identifier(parameter->value));
+            }
+        }
+        BlockExpression* body = CloneBlock(function->body, renames);
+        FoldBlock(body);
+
+        std::string copy_name = name + "#" + std::to_string(++_inlined);
+        // profiles and traces report the copy as the function it specializes
+        FunctionExpression* literal = new FunctionExpression(parameters, body);
+        literal->name = name;
+        literal->line = function->line;
+        specializable.added.push_back(new LetStatement(new Identifier(copy_name), literal));
+        copy = specializable.copies.emplace(key, copy_name).first;
+        _changes.push_back("specialized call to " + name + " as " + copy_name);
+    }
+
+    std::vector<Expression*> arguments;
+    for (size_t i = 0; i < node->arguments.size(); i++) {
+        if (renames.count(function->parameters[i]->value) == 0) {
+            arguments.push_back(node->arguments[i]);
+        }
+    }
+    node->function = new Identifier(copy->second);
+    node->arguments = arguments;
+    return node;
+}
+
+// Binds the copies right after the function they were made from.
+void Optimizer::AddSpecializations() {
+    for (Specializable& specializable : _specializable) {
+        if (specializable.added.empty()) {
+            continue;
+        }
+
+        std::vector<Statement*>& statements = *specializable.statements;
+        auto let = std::find(statements.begin(), statements.end(), specializable.let);
+        statements.insert(let + 1, specializable.added.begin(), specializable.added.end());
+    }
+}
+
+// Cleanup
+
+// literals, function and struct literals can be dropped without changing anything observable,
+// even a lookup could fail with an error
+bool Optimizer::IsPure(const Expression* node) {
+    switch (node->type) {
+    case Expression::Type::INT:
+    case Expression::Type::BIG_INT:
+    case Expression::Type::FLOAT:
+    case Expression::Type::STRING:
+    case Expression::Type::BOOLEAN:
+    case Expression::Type::FUNCTION:
+    case Expression::Type::STRUCT:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool Optimizer::Cleanup(std::vector<Statement*>& statements, bool global) {
+    std::unordered_map<std::string, size_t> references;
+    for (const Statement* statement : statements) {
+        CountReferences(statement, references);
+    }
+
+    return CleanupStatements(statements, references, global);
+}
+
+// The last statement of a block is its value and always stays.
+bool Optimizer::CleanupStatements(std::vector<Statement*>& statements,
+                                  const std::unordered_map<std::string, size_t>& references,
+                                  bool global) {
+    bool changed = false;
+
+    for (size_t i = 0; i < statements.size(); i++) {
+        bool last = i + 1 == statements.size();
+
+        switch (statements[i]->type) {
+        case Statement::Type::LET: {
+            LetStatement* let = static_cast<LetStatement*>(statements[i]);
+            let->value = CleanupExpression(let->value, references, global, changed);
+            if (last || (global && _keep_globals)) {
+                break;
+            }
+
+            // uses inside its own value are the function referring to itself
+            const std::string& name = let->name->value;
+            std::unordered_map<std::string, size_t> own;
+            CountReferences(let->value, own);
+            auto used = references.find(name);
+            if (used != references.end() && used->second > own[name]) {
+                break;
+            }
+
+            changed = true;
+            if (IsPure(let->value)) {
+                _changes.push_back("removed unused let " + name);
+                statements.erase(statements.begin() + i--);
+            } else {
+                _changes.push_back("removed unused binding of " + name);
+                statements[i] = new ExpressionStatement(let->value);
+            }
+            break;
+        }
+        case Statement::Type::RETURN: {
+            ReturnStatement* return_statement = static_cast<ReturnStatement*>(statements[i]);
+            return_statement->value =
+                CleanupExpression(return_statement->value, references, global, changed);
+            break;
+        }
+        case Statement::Type::YIELD: {
+            YieldStatement* yield = static_cast<YieldStatement*>(statements[i]);
+            yield->value = CleanupExpression(yield->value, references, global, changed);
+            break;
+        }
+        case Statement::Type::EXPRESSION: {
+            ExpressionStatement* expression = static_cast<ExpressionStatement*>(statements[i]);
+            expression->expression =
+                CleanupExpression(expression->expression, references, global, changed);
+            if (!last && IsPure(expression->expression)) {
+                changed = true;
+                _changes.push_back("removed unused expression statement");
+                statements.erase(statements.begin() + i--);
+            }
+            break;
+        }
+        }
+    }
+
+    return changed;
+}
+
+Expression*
+Optimizer::CleanupExpression(Expression* node,
+                             const std::unordered_map<std::string, size_t>& references,
+                             bool global,
+                             bool& changed) {
+    switch (node->type) {
+    case Expression::Type::PREFIX: {
+        PrefixExpression* prefix = static_cast<PrefixExpression*>(node);
+        prefix->right = CleanupExpression(prefix->right, references, global, changed);
+        break;
+    }
+    case Expression::Type::INFIX: {
+        InfixExpression* infix = static_cast<InfixExpression*>(node);
+        infix->left = CleanupExpression(infix->left, references, global, changed);
+        infix->right = CleanupExpression(infix->right, references, global, changed);
+        break;
+    }
+    case Expression::Type::BLOCK: {
+        BlockExpression* block = static_cast<BlockExpression*>(node);
+        changed |= CleanupStatements(block->statements, references, global);
+        if (block->statements.size() == 1 &&
+            block->statements[0]->type == Statement::Type::EXPRESSION) {
+            changed = true;
+            _changes.push_back("collapsed single expression block");
+            return static_cast<ExpressionStatement*>(block->statements[0])->expression;
+        }
+        break;
+    }
+    case Expression::Type::IF_ELSE: {
+        IfElseExpression* if_else = static_cast<IfElseExpression*>(node);
+        if_else->condition = CleanupExpression(if_else->condition, references, global, changed);
+        changed |= CleanupStatements(if_else->consequence->statements, references, global);
+        if (if_else->alternative != nullptr) {
+            if_else->alternative =
+                CleanupExpression(if_else->alternative, references, global, changed);
+        }
+        break;
+    }
+    case Expression::Type::FUNCTION:
+        changed |= Cleanup(static_cast<FunctionExpression*>(node)->body->statements, false);
+        break;
+    case Expression::Type::CALL: {
+        CallExpression* call = static_cast<CallExpression*>(node);
+        call->function = CleanupExpression(call->function, references, global, changed);
+        for (Expression*& argument : call->arguments) {
+            argument = CleanupExpression(argument, references, global, changed);
+        }
+        break;
+    }
+    case Expression::Type::MAP:
+        for (auto& [key, value] : static_cast<MapExpression*>(node)->entries) {
+            key = CleanupExpression(key, references, global, changed);
+            value = CleanupExpression(value, references, global, changed);
+        }
+        break;
+    case Expression::Type::FIELD: {
+        FieldExpression* field = static_cast<FieldExpression*>(node);
+        field->object = CleanupExpression(field->object, references, global, changed);
+        break;
+    }
+    case Expression::Type::ASSIGN: {
+        AssignExpression* assign = static_cast<AssignExpression*>(node);
+        assign->value = CleanupExpression(assign->value, references, global, changed);
+        break;
+    }
+    // loop bodies stay blocks, their last statement is not a value anyone reads but
+    // keeping it is harmless
+    case Expression::Type::WHILE: {
+        WhileExpression* loop = static_cast<WhileExpression*>(node);
+        loop->condition = CleanupExpression(loop->condition, references, global, changed);
+        changed |= CleanupStatements(loop->body->statements, references, global);
+        break;
+    }
+    case Expression::Type::FOR: {
+        ForExpression* loop = static_cast<ForExpression*>(node);
+        loop->condition = CleanupExpression(loop->condition, references, global, changed);
+        loop->update = CleanupExpression(loop->update, references, global, changed);
+        changed |= CleanupStatements(loop->body->statements, references, global);
+        break;
+    }
+    default:
+        break;
+    }
+
+    return node;
+}
@@ -0,0 +1,337 @@
+#include "parallel.h"
+
+#include "builtins.h"
+
+#include <algorithm>
+#include <type_traits>
+
+namespace {
+
+// Walks the body of a function and, through its calls, of every function it can
+// reach. Functions being checked are assumed to be pure, so recursion does not make
+// a function impure by itself.
+class PurityCheck {
+public:
+    bool Check(const Function& function) {
+        if (std::find(_visiting.begin(), _visiting.end(), &function) != _visiting.end()) {
+            return true;
+        }
+        Function::Purity known = function.purity.load(std::memory_order_relaxed);
+        if (known != Function::Purity::UNKNOWN) {
+            return known == Function::Purity::PURE;
+        }
+
+        _visiting.push_back(&function);
+        const Function* outer = _function;
+        std::vector<const std::string*> possible = std::move(_possible);
+        std::vector<const std::string*> bound = std::move(_bound);
+        _function = &function;
+        _possible.clear();
+        _bound.clear();
+
+        bool pure = CheckLiteral(function.parameters, function.body);
+
+        _function = outer;
+        _possible = std::move(possible);
+        _bound = std::move(bound);
+        return pure;
+    }
+
+    // Every function visited is pure once the first one is. If it is not, only that
+    // is certain, the others may have relied on an assumption.
+    void Record(const Function& function, bool pure) {
+        if (!pure) {
+            function.purity.store(Function::Purity::IMPURE, std::memory_order_relaxed);
+            return;
+        }
+        for (const Function* visited : _visiting) {
+            visited->purity.store(Function::Purity::PURE, std::memory_order_relaxed);
+        }
+    }
+
+private:
+    std::vector<const Function*> _visiting;
+    // whose environment the callees are looked up in
+    const Function* _function = nullptr;
+    // names that may be bound by the literals being checked, which shadow the
+    // environment
+    std::vector<const std::string*> _possible;
+    // locals that are certainly bound at this point of the innermost literal, the
+    // only names an assignment may rebind
+    std::vector<const std::string*> _bound;
+
+    static bool Contains(const std::vector<const std::string*>& names, const std::string* name) {
+        return std::find(names.begin(), names.end(), name) != names.end();
+    }
+
+    bool CheckLiteral(const std::vector<Identifier*>& parameters, const BlockExpression* body) {
+        size_t possible = _possible.size();
+        std::vector<const std::string*> bound = std::move(_bound);
+        _bound.clear();
+        for (const Identifier* parameter : parameters) {
+            _possible.push_back(&parameter->value);
+            _bound.push_back(&parameter->value);
+        }
+        // lets of the literal may bind their names wherever they are
+        CollectLets(body, _possible);
+
+        bool pure = CheckBlock(body);
+
+        _possible.resize(possible);
+        _bound = std::move(bound);
+        return pure;
+    }
+
+    // A let binds its name for the rest of the block, lets in nested blocks may not
+    // have run once they are left.
+    bool CheckBlock(const BlockExpression* node) {
+        size_t bound = _bound.size();
+        bool pure = true;
+        for (const Statement* statement : node->statements) {
+            if (!CheckStatement(statement)) {
+                pure = false;
+                break;
+            }
+        }
+        _bound.resize(bound);
+        return pure;
+    }
+
+    bool CheckStatement(const Statement* node) {
+        switch (node->type) {
+        case Statement::Type::LET: {
+            const LetStatement* let = static_cast<const LetStatement*>(node);
+            if (!CheckExpression(let->value)) {
+                return false;
+            }
+            _bound.push_back(&let->name->value);
+            return true;
+        }
+        case Statement::Type::RETURN:
+            return CheckExpression(static_cast<const ReturnStatement*>(node)->value);
+        case Statement::Type::EXPRESSION:
+            return CheckExpression(static_cast<const ExpressionStatement*>(node)->expression);
+        case Statement::Type::YIELD:
+            return CheckExpression(static_cast<const YieldStatement*>(node)->value);
+        }
+        return false;
+    }
+
+    // Spelled out per type rather than with a default, a new kind of node has to be
+    // judged here before it can appear in a forked call.
+    bool CheckExpression(const Expression* node) {
+        switch (node->type) {
+        case Expression::Type::IDENT:
+        case Expression::Type::INT:
+        case Expression::Type::BIG_INT:
+        case Expression::Type::FLOAT:
+        case Expression::Type::STRING:
+        case Expression::Type::BOOLEAN:
+        case Expression::Type::STRUCT:
+        case Expression::Type::PREFIX:
+        case Expression::Type::INFIX:
+        case Expression::Type::IF_ELSE:
+        case Expression::Type::FIELD:
+        case Expression::Type::WHILE:
+        case Expression::Type::MAP:
+            return CheckChildren(node);
+        case Expression::Type::BLOCK:
+            return CheckBlock(static_cast<const BlockExpression*>(node));
+        case Expression::Type::FUNCTION: {
+            const FunctionExpression* literal = static_cast<const FunctionExpression*>(node);
+            return CheckLiteral(literal->parameters, literal->body);
+        }
+        case Expression::Type::CALL:
+            return CheckCall(static_cast<const CallExpression*>(node));
+        case Expression::Type::ASSIGN: {
+            const AssignExpression* assign = static_cast<const AssignExpression*>(node);
+            return Contains(_bound, &assign->name->value) && CheckChildren(node);
+        }
+        case Expression::Type::FOR: {
+            // the initializer's let is bound for the rest of the loop only
+            size_t bound = _bound.size();
+            bool pure = CheckChildren(node);
+            _bound.resize(bound);
+            return pure;
+        }
+        }
+        return false;
+    }
+
+    bool CheckChildren(const Expression* node) {
+        bool pure = true;
+        ForEachChild(node, [this, &pure](auto child) {
+            if constexpr (std::is_same_v<decltype(child), const Statement*>) {
+                pure = pure && CheckStatement(child);
+            } else {
+                pure = pure && CheckExpression(child);
+            }
+        });
+        return pure;
+    }
+
+    bool CheckCall(const CallExpression* node) {
+        for (const Expression* argument : node->arguments) {
+            if (!CheckExpression(argument)) {
+                return false;
+            }
+        }
+
+        if (node->function->type != Expression::Type::IDENT) {
+            return false;
+        }
+        const std::string* name = &static_cast<const Identifier*>(node->function)->value;
+        if (Contains(_possible, name)) {
+            return false;
+        }
+
+        ObjectPtr callee = _function->environment->Get(*name);
+        if (callee == nullptr) {
+            return false;
+        }
+        switch (callee->type) {
+        case Object::Type::FUNCTION:
+            return Check(*static_cast<const Function*>(callee.get()));
+        case Object::Type::BUILTIN:
+            return IsPureBuiltin(*static_cast<const Builtin*>(callee.get()));
+        case Object::Type::STRUCT:
+            return true;
+        default:
+            return false;
+        }
+    }
+};
+
+} // namespace
+
+bool IsPure(const Function& function) {
+    Function::Purity known = function.purity.load(std::memory_order_relaxed);
+    if (known != Function::Purity::UNKNOWN) {
+        return known == Function::Purity::PURE;
+    }
+
+    PurityCheck check;
+    bool pure = check.Check(function);
+    check.Record(function, pure);
+    return pure;
+}
+
+ForkJoinPool::ForkJoinPool(size_t workers) {
+    _max_depth = 3;
+    for (size_t threads = workers + 1; threads > 1; threads >>= 1) {
+        _max_depth++;
+    }
+
+    for (size_t queue = 0; queue <= workers; queue++) {
+        _queues.push_back(std::make_unique<Queue>());
+    }
+    for (size_t worker = 0; worker < workers; worker++) {
+        _evaluators.push_back(std::make_unique<Evaluator>());
+        _evaluators.back()->SetPool(this, worker + 1);
+    }
+}
+
+ForkJoinPool::~ForkJoinPool() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _wake.notify_all();
+
+    for (std::thread& thread : _threads) {
+        thread.join();
+    }
+}
+
+void ForkJoinPool::Push(size_t queue, ForkedCall* call) {
+    std::call_once(_started, [this] {
+        for (size_t worker = 0; worker < _evaluators.size(); worker++) {
+            _threads.emplace_back(&ForkJoinPool::Work, this, worker + 1);
+        }
+    });
+
+    {
+        std::lock_guard<std::mutex> lock(_queues[queue]->mutex);
+        _queues[queue]->calls.push_back(call);
+    }
+
+    // a thread going to sleep counts itself before it looks at _queued, so one of
+    // the two sees the other
+    _queued++;
+    if (_sleeping != 0) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _wake.notify_all();
+    }
+}
+
+bool ForkJoinPool::Pop(size_t queue, ForkedCall* call) {
+    std::lock_guard<std::mutex> lock(_queues[queue]->mutex);
+    std::deque<ForkedCall*>& calls = _queues[queue]->calls;
+    if (calls.empty() || calls.back() != call) {
+        return false;
+    }
+
+    calls.pop_back();
+    _queued--;
+    return true;
+}
+
+ForkedCall* ForkJoinPool::Steal(size_t queue) {
+    if (_queued == 0) {
+        return nullptr;
+    }
+
+    for (size_t i = 1; i < _queues.size(); i++) {
+        Queue& victim = *_queues[(queue + i) % _queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.calls.empty()) {
+            ForkedCall* call = victim.calls.front();
+            victim.calls.pop_front();
+            _queued--;
+            return call;
+        }
+    }
+
+    return nullptr;
+}
+
+void ForkJoinPool::Wait(const ForkedCall& call, bool stealing) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _sleeping++;
+    _wake.wait(lock, [&] { return call.done || (stealing && _queued != 0); });
+    _sleeping--;
+}
+
+void ForkJoinPool::Done(ForkedCall& call) {
+    call.done = true;
+    if (_sleeping != 0) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _wake.notify_all();
+    }
+}
+
+void ForkJoinPool::Work(size_t queue) {
+    Evaluator& evaluator = *_evaluators[queue - 1];
+    while (true) {
+        // forks come in bursts, looking again for a moment is cheaper than sleeping
+        ForkedCall* call = nullptr;
+        for (int spin = 0; spin < SPINS && call == nullptr; spin++) {
+            call = Steal(queue);
+            if (call == nullptr) {
+                std::this_thread::yield();
+            }
+        }
+        if (call != nullptr) {
+            evaluator.RunForked(*call);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(_mutex);
+        _sleeping++;
+        _wake.wait(lock, [this] { return _stopping || _queued != 0; });
+        _sleeping--;
+        if (_stopping) {
+            return;
+        }
+    }
+}
@@ -1,13 +1,22 @@
 #include "parser.h"
 
+#include "trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
 #include <iostream>
 #include <sstream>
+#include <stdexcept>
 
 Parser::Parser(Lexer& lexer)
     : _lexer(lexer), _current_token(lexer.NextToken()), _peek_token(lexer.NextToken()) {}
 
 Program Parser::Parse() {
+    TraceSpan span("Parser::Parse", "parse");
     Program program;
+    program.arena = std::make_shared<AstArena>();
+    AstArena::Scope scope(program.arena.get());
 
     while (_current_token.type != Token::Type::EOF) {
         Statement* statement = ParseStatement();
@@ -17,12 +26,20 @@ Program Parser::Parse() {
         Advance();
     }
 
+    // the lexer runs interleaved with the parser, its share is shown as one span
+    if (span.IsActive()) {
+        Trace::Record("Lexer", "parse", span.GetStart(),
+                      span.GetStart() + _lexer.GetTracedTime(),
+                      std::to_string(_lexer.GetTracedTokens()) + " tokens");
+    }
+
     return program;
 }
 
 Parser::Precedence Parser::GetPrecedence(Token::Type type) {
     switch (type) {
     case Token::Type::LPAREN:
+    case Token::Type::DOT:
         return Precedence::CALL;
     case Token::Type::SLASH:
     case Token::Type::ASTERISK:
@@ -41,6 +58,8 @@ Parser::Precedence Parser::GetPrecedence(Token::Type type) {
     case Token::Type::OR:
     case Token::Type::AND:
         return Precedence::AND_OR;
+    case Token::Type::ASSIGN:
+        return Precedence::ASSIGN;
     default:
         return Precedence::LOWEST;
     }
@@ -62,6 +81,13 @@ Statement* Parser::ParseStatement() {
 
         Error("Return statements can only be used inside functions", _current_token);
         return nullptr;
+    case Token::Type::YIELD:
+        if (_in_function) {
+            return ParseYieldStatement();
+        }
+
+        Error("Yield statements can only be used inside functions", _current_token);
+        return nullptr;
     default:
         return ParseExpressionStatement();
     }
@@ -94,6 +120,17 @@ LetStatement* Parser::ParseLetStatement() {
 
     Advance();
 
+    // instances print with the name their declaration was bound to, and functions
+    // show up in profiles with it
+    if (expression->type == Expression::Type::STRUCT) {
+        static_cast<StructExpression*>(expression)->shape.name = name;
+    } else if (expression->type == Expression::Type::FUNCTION) {
+        static_cast<FunctionExpression*>(expression)->name = name;
+    }
+    if (_in_function) {
+        _locals.push_back(name);
+    }
+
     return new LetStatement(new Identifier(name), expression);
 }
 
@@ -115,6 +152,25 @@ ReturnStatement* Parser::ParseReturnStatement() {
     return new ReturnStatement(expression);
 }
 
+YieldStatement* Parser::ParseYieldStatement() {
+    Advance();
+
+    Expression* expression = ParseExpression(Precedence::LOWEST);
+    if (expression == nullptr) {
+        return nullptr;
+    }
+
+    // yield is required to end in a ;
+    if (!PeekOrError(Token::Type::SEMICOLON)) {
+        return nullptr;
+    }
+
+    Advance();
+
+    _yields = true;
+    return new YieldStatement(expression);
+}
+
 ExpressionStatement* Parser::ParseExpressionStatement() {
     Expression* expression = ParseExpression(Precedence::LOWEST);
     if (expression == nullptr) {
@@ -144,6 +200,12 @@ Expression* Parser::ParseExpression(Precedence precedence) {
     case Token::Type::INT:
         left = ParseIntegerLiteral();
         break;
+    case Token::Type::FLOAT:
+        left = ParseFloatLiteral();
+        break;
+    case Token::Type::STRING:
+        left = ParseStringLiteral();
+        break;
     case Token::Type::FALSE:
         left = ParseBooleanLiteral(false);
         break;
@@ -165,6 +227,18 @@ Expression* Parser::ParseExpression(Precedence precedence) {
     case Token::Type::FUNCTION:
         left = ParseFunctionLiteral();
         break;
+    case Token::Type::STRUCT:
+        left = ParseStructLiteral();
+        break;
+    case Token::Type::LBRACE:
+        left = ParseMapLiteral();
+        break;
+    case Token::Type::WHILE:
+        left = ParseWhileExpression();
+        break;
+    case Token::Type::FOR:
+        left = ParseForExpression();
+        break;
     default:
         Error("Unexpected token \"" + _current_token.literal + "\"", _current_token);
         return nullptr;
@@ -185,8 +259,28 @@ Expression* Parser::ParseExpression(Precedence precedence) {
 
 Identifier* Parser::ParseIdentifier() { return new Identifier(_current_token.literal); }
 
-IntegerLiteral* Parser::ParseIntegerLiteral() {
-    return new IntegerLiteral(std::stoi(_current_token.literal));
+Expression* Parser::ParseIntegerLiteral() {
+    // literals beyond int64_t are bignums, like results of arithmetic would be
+    try {
+        return new IntegerLiteral(std::stoll(_current_token.literal));
+    } catch (const std::out_of_range&) {
+        return new BigIntLiteral(BigInt::FromDecimal(_current_token.literal));
+    }
+}
+
+FloatLiteral* Parser::ParseFloatLiteral() {
+    // too small a value rounds to zero, too large a one is an error like for integers
+    double value = std::strtod(_current_token.literal.c_str(), nullptr);
+    if (std::isinf(value)) {
+        Error("Float literal \"" + _current_token.literal + "\" is out of range",
+              _current_token);
+        return nullptr;
+    }
+    return new FloatLiteral(value);
+}
+
+StringLiteral* Parser::ParseStringLiteral() {
+    return new StringLiteral(_current_token.literal);
 }
 
 BooleanLiteral* Parser::ParseBooleanLiteral(bool value) {
@@ -249,6 +343,10 @@ Expression* Parser::ParseInfixExpression(Expression* left) {
         return ParseBasicInfixExpression(left, InfixExpression::Operation::OR);
     case Token::Type::LPAREN:
         return ParseCallExpression(left);
+    case Token::Type::DOT:
+        return ParseFieldExpression(left);
+    case Token::Type::ASSIGN:
+        return ParseAssignExpression(left);
     default:
         Error("Unexpected token \"" + _current_token.literal + "\"", _current_token);
         return nullptr;
@@ -271,6 +369,7 @@ InfixExpression* Parser::ParseBasicInfixExpression(Expression* left,
 BlockExpression* Parser::ParseBlockExpression() {
     Advance();
 
+    size_t locals = _locals.size();
     std::vector<Statement*> statements;
     while (_current_token.type != Token::Type::RBRACE &&
            _current_token.type != Token::Type::EOF) {
@@ -283,6 +382,7 @@ BlockExpression* Parser::ParseBlockExpression() {
         statements.push_back(statement);
         Advance();
     }
+    _locals.resize(locals);
 
     return new BlockExpression(statements);
 }
@@ -333,7 +433,15 @@ IfElseExpression* Parser::ParseIfElseExpression() {
 }
 
 FunctionExpression* Parser::ParseFunctionLiteral() {
+    uint32_t line = _current_token.line;
+
+    // restored at the end, function literals nest
+    bool in_function = _in_function;
+    bool yields = _yields;
+    std::vector<std::string> locals = std::move(_locals);
     _in_function = true;
+    _yields = false;
+    _locals.clear();
 
     if (!PeekOrError(Token::Type::LPAREN)) {
         return nullptr;
@@ -351,6 +459,7 @@ FunctionExpression* Parser::ParseFunctionLiteral() {
         }
 
         parameters.push_back(parameter);
+        _locals.push_back(parameter->value);
 
         if (_peek_token.type == Token::Type::COMMA) {
             Advance();
@@ -370,8 +479,13 @@ FunctionExpression* Parser::ParseFunctionLiteral() {
         return nullptr;
     }
 
-    _in_function = false;
-    return new FunctionExpression(parameters, body);
+    bool generator = _yields;
+    _in_function = in_function;
+    _yields = yields;
+    _locals = std::move(locals);
+    FunctionExpression* function = new FunctionExpression(parameters, body, generator);
+    function->line = line;
+    return function;
 }
 
 CallExpression* Parser::ParseCallExpression(Expression* left) {
@@ -397,6 +511,183 @@ CallExpression* Parser::ParseCallExpression(Expression* left) {
     return new CallExpression(left, arguments);
 }
 
+StructExpression* Parser::ParseStructLiteral() {
+    if (!PeekOrError(Token::Type::LBRACE)) {
+        return nullptr;
+    }
+
+    Advance();
+
+    std::vector<Identifier*> fields;
+    std::vector<std::string> names;
+    while (_peek_token.type != Token::Type::RBRACE) {
+        if (!PeekOrError(Token::Type::IDENT)) {
+            return nullptr;
+        }
+
+        Advance();
+
+        const std::string& name = _current_token.literal;
+        if (std::find(names.begin(), names.end(), name) != names.end()) {
+            Error("Duplicate field \"" + name + "\"", _current_token);
+            return nullptr;
+        }
+
+        fields.push_back(ParseIdentifier());
+        names.push_back(name);
+
+        if (_peek_token.type == Token::Type::COMMA) {
+            Advance();
+        }
+    }
+
+    Advance();
+
+    return new StructExpression(fields, names);
+}
+
+MapExpression* Parser::ParseMapLiteral() {
+    std::vector<std::pair<Expression*, Expression*>> entries;
+    while (_peek_token.type != Token::Type::RBRACE) {
+        Advance();
+
+        Expression* key = ParseExpression(Precedence::LOWEST);
+        if (key == nullptr) {
+            return nullptr;
+        }
+
+        if (!PeekOrError(Token::Type::COLON)) {
+            return nullptr;
+        }
+
+        Advance();
+        Advance();
+
+        Expression* value = ParseExpression(Precedence::LOWEST);
+        if (value == nullptr) {
+            return nullptr;
+        }
+
+        entries.emplace_back(key, value);
+
+        if (_peek_token.type != Token::Type::RBRACE && !PeekOrError(Token::Type::COMMA)) {
+            return nullptr;
+        }
+        if (_peek_token.type == Token::Type::COMMA) {
+            Advance();
+        }
+    }
+
+    Advance();
+
+    return new MapExpression(std::move(entries));
+}
+
+FieldExpression* Parser::ParseFieldExpression(Expression* left) {
+    if (!PeekOrError(Token::Type::IDENT)) {
+        return nullptr;
+    }
+
+    Advance();
+
+    return new FieldExpression(left, ParseIdentifier());
+}
+
+AssignExpression* Parser::ParseAssignExpression(Expression* left) {
+    if (left->type != Expression::Type::IDENT) {
+        std::stringstream str;
+        str << "Cannot assign to \"" << *left << "\"";
+        Error(str.str(), _current_token);
+        return nullptr;
+    }
+
+    const std::string& name = static_cast<Identifier*>(left)->value;
+    if (_in_function && std::find(_locals.begin(), _locals.end(), name) == _locals.end()) {
+        Error("Cannot assign to \"" + name + "\", which the function does not bind itself",
+              _current_token);
+    }
+
+    Advance();
+
+    // right associative, a = b = 1 assigns to b first
+    Expression* value = ParseExpression(Precedence::LOWEST);
+    if (value == nullptr) {
+        return nullptr;
+    }
+
+    return new AssignExpression(static_cast<Identifier*>(left), value);
+}
+
+WhileExpression* Parser::ParseWhileExpression() {
+    Advance();
+
+    Expression* condition = ParseExpression(Precedence::LOWEST);
+    if (condition == nullptr) {
+        return nullptr;
+    }
+
+    if (!PeekOrError(Token::Type::LBRACE)) {
+        return nullptr;
+    }
+
+    Advance();
+
+    BlockExpression* body = ParseBlockExpression();
+    if (body == nullptr) {
+        return nullptr;
+    }
+
+    return new WhileExpression(condition, body);
+}
+
+ForExpression* Parser::ParseForExpression() {
+    Advance();
+
+    // a let in the initializer binds for the loop only
+    size_t locals = _locals.size();
+
+    // the initializer is a let or an expression and consumes its own ;
+    Statement* initializer = _current_token.type == Token::Type::LET
+                                 ? static_cast<Statement*>(ParseLetStatement())
+                                 : ParseExpressionStatement();
+    if (initializer == nullptr) {
+        return nullptr;
+    }
+
+    Advance();
+
+    Expression* condition = ParseExpression(Precedence::LOWEST);
+    if (condition == nullptr) {
+        return nullptr;
+    }
+
+    if (!PeekOrError(Token::Type::SEMICOLON)) {
+        return nullptr;
+    }
+
+    Advance();
+    Advance();
+
+    Expression* update = ParseExpression(Precedence::LOWEST);
+    if (update == nullptr) {
+        return nullptr;
+    }
+
+    if (!PeekOrError(Token::Type::LBRACE)) {
+        return nullptr;
+    }
+
+    Advance();
+
+    BlockExpression* body = ParseBlockExpression();
+    if (body == nullptr) {
+        return nullptr;
+    }
+    _locals.resize(locals);
+
+    return new ForExpression(initializer, condition, update, body);
+}
+
 void Parser::Error(const std::string& message, const Token& token) {
     _errors.emplace_back(message, token.line, token.column);
 }
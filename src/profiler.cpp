@@ -0,0 +1,147 @@
+#include "profiler.h"
+
+#include "ast.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <pthread.h>
+#include <sys/time.h>
+
+// the running profiler, and whether the current thread is the one it samples
+static std::atomic<Profiler*> active{nullptr};
+static thread_local bool profiled = false;
+static struct sigaction previous;
+
+Profiler::Profiler(std::chrono::microseconds interval)
+    : _interval(std::max(interval, std::chrono::microseconds(1))),
+      _buffer(SAMPLE_BUFFER_SIZE) {}
+
+Profiler::~Profiler() {
+    Stop();
+}
+
+bool Profiler::Start() {
+    Profiler* expected = nullptr;
+    if (_running || !active.compare_exchange_strong(expected, this)) {
+        return false;
+    }
+    profiled = true;
+
+    struct sigaction action = {};
+    action.sa_handler = &Profiler::Handle;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, &previous) != 0) {
+        profiled = false;
+        active = nullptr;
+        return false;
+    }
+
+    itimerval timer = {};
+    timer.it_interval.tv_sec = _interval.count() / 1000000;
+    timer.it_interval.tv_usec = _interval.count() % 1000000;
+    timer.it_value = timer.it_interval;
+    if (setitimer(ITIMER_PROF, &timer, nullptr) != 0) {
+        sigaction(SIGPROF, &previous, nullptr);
+        profiled = false;
+        active = nullptr;
+        return false;
+    }
+
+    _running = true;
+    return true;
+}
+
+void Profiler::Stop() {
+    if (!_running) {
+        return;
+    }
+
+    itimerval timer = {};
+    setitimer(ITIMER_PROF, &timer, nullptr);
+    sigaction(SIGPROF, &previous, nullptr);
+    profiled = false;
+    active = nullptr;
+    _running = false;
+
+    Drain();
+}
+
+void Profiler::Handle(int) {
+    // a sample landing on another thread is lost, that thread's stack is not known
+    Profiler* profiler = active.load(std::memory_order_relaxed);
+    if (profiler == nullptr || !profiled) {
+        return;
+    }
+
+    int saved = errno;
+    profiler->Sample();
+    errno = saved;
+}
+
+void Profiler::Sample() {
+    size_t depth = _depth;
+    depth = std::min(depth, MAX_DEPTH);
+    size_t written = _written;
+    if (written + depth + 1 > _buffer.size()) {
+        _dropped = _dropped + 1;
+        return;
+    }
+
+    _buffer[written] = depth;
+    for (size_t i = 0; i < depth; i++) {
+        _buffer[written + 1 + i] = reinterpret_cast<uintptr_t>(_frames[i]);
+    }
+    _written = written + depth + 1;
+}
+
+static std::string Name(const FunctionExpression* function) {
+    // lines count from 0 in the lexer
+    std::string line = std::to_string(function->line + 1);
+    return (function->name.empty() ? "fn" : function->name) + ":" + line;
+}
+
+void Profiler::Drain() {
+    sigset_t blocked, unblocked;
+    sigemptyset(&blocked);
+    sigaddset(&blocked, SIGPROF);
+    pthread_sigmask(SIG_BLOCK, &blocked, &unblocked);
+
+    // names repeat in almost every sample, resolve each definition once per drain
+    std::unordered_map<uintptr_t, std::string> names;
+    std::string stack;
+    size_t position = 0;
+    while (position < _written) {
+        size_t depth = _buffer[position++];
+        stack = "<script>";
+        for (size_t i = 0; i < depth; i++) {
+            uintptr_t frame = _buffer[position + i];
+            auto name = names.find(frame);
+            if (name == names.end()) {
+                name = names.emplace(frame,
+                                     Name(reinterpret_cast<const FunctionExpression*>(frame)))
+                           .first;
+            }
+            stack += ';';
+            stack += name->second;
+        }
+        position += depth;
+
+        _folded[stack]++;
+        _samples++;
+    }
+    _written = 0;
+
+    pthread_sigmask(SIG_SETMASK, &unblocked, nullptr);
+}
+
+void Profiler::WriteFolded(std::ostream& stream) {
+    Drain();
+
+    std::vector<std::pair<std::string, uint64_t>> stacks(_folded.begin(), _folded.end());
+    std::sort(stacks.begin(), stacks.end());
+    for (const auto& [stack, count] : stacks) {
+        stream << stack << ' ' << count << '\n';
+    }
+}
@@ -0,0 +1,304 @@
+#include "script.h"
+
+#include "builtins.h"
+#include "lexer.h"
+
+#include <algorithm>
+
+CompileError::CompileError(std::vector<ParseError> errors) : _errors(std::move(errors)) {
+    for (const ParseError& error : _errors) {
+        if (!_message.empty()) {
+            _message += "\n";
+        }
+        _message += error.what();
+    }
+}
+
+void Bindings::Install(Evaluator& evaluator, Environment& environment) const {
+    for (const auto& [name, value] : _values) {
+        environment.Set(name, value(evaluator));
+    }
+}
+
+ObjectPtr Isolate::Run(const Script& script, const Bindings& bindings) {
+    EnvironmentPtr environment = std::make_shared<Environment>();
+    InstallBuiltins(*_evaluator, *environment);
+    bindings.Install(*_evaluator, *environment);
+
+    return _evaluator->Evaluate(script.GetProgram(), environment);
+}
+
+ObjectPtr Isolate::RunBatch(const Script& script,
+                           const std::string& name,
+                           const std::vector<std::vector<int64_t>>& arguments,
+                           std::vector<int64_t>& results,
+                           const Bindings& bindings) {
+    EnvironmentPtr environment = std::make_shared<Environment>();
+    InstallBuiltins(*_evaluator, *environment);
+    bindings.Install(*_evaluator, *environment);
+
+    ObjectPtr result = _evaluator->Evaluate(script.GetProgram(), environment);
+    if (result != nullptr && result->type == Object::Type::ERROR) {
+        return result;
+    }
+
+    ObjectPtr function = environment->Get(name);
+    if (function == nullptr) {
+        return _evaluator->New<Error>("identifier not found: " + name);
+    }
+
+    return BatchEvaluator(*_evaluator).Run(function, arguments, results);
+}
+
+Script Compile(const std::string& source) {
+    Lexer lexer = Lexer(source);
+    Parser parser = Parser(lexer);
+
+    std::shared_ptr<Program> program = std::make_shared<Program>(parser.Parse());
+    if (!parser.GetErrors().empty()) {
+        throw CompileError(parser.GetErrors());
+    }
+
+    return Script(std::move(program));
+}
+
+ObjectPtr ReactiveScript::Run(const Bindings& inputs) {
+    Environment converted;
+    inputs.Install(_isolate.GetEvaluator(), converted);
+    _inputs = std::unordered_map<std::string, ObjectPtr>(converted.store.begin(),
+                                                         converted.store.end());
+
+    _evaluated = 0;
+    return RunAll();
+}
+
+ObjectPtr ReactiveScript::Update(const Bindings& inputs) {
+    Environment converted;
+    inputs.Install(_isolate.GetEvaluator(), converted);
+    for (const auto& [name, value] : converted.store) {
+        _inputs[name] = value;
+    }
+
+    _evaluated = 0;
+    if (!_incremental) {
+        return RunAll();
+    }
+
+    for (const auto& [name, value] : converted.store) {
+        _environment->Set(name, value);
+        const std::string* interned = &Intern(name);
+        Schedule(_readers, interned, 0);
+        // a statement that binds the input itself has to overwrite it again
+        Schedule(_writers, interned, 0);
+    }
+
+    std::vector<ObjectPtr> previous;
+    while (!_pending.empty()) {
+        size_t index = _pending.top();
+        _pending.pop();
+        _queued[index] = false;
+
+        const std::vector<const std::string*> writes = _nodes[index].dependencies.writes;
+        previous.clear();
+        for (const std::string* name : writes) {
+            previous.push_back(_environment->Get(*name));
+        }
+
+        RemoveReads(index);
+        ObjectPtr result = Evaluate(index);
+        if (result->type == Object::Type::ERROR) {
+            _incremental = false;
+            return result;
+        }
+
+        // binding other globals than before changes the writer of each, which only
+        // a full run sorts out
+        if (_nodes[index].dependencies.writes != writes || !AddReads(index)) {
+            return RunAll();
+        }
+
+        for (size_t i = 0; i < writes.size(); i++) {
+            if (_environment->Get(*writes[i]) != previous[i]) {
+                Schedule(_readers, writes[i], index + 1);
+            }
+        }
+    }
+
+    return Result();
+}
+
+ObjectPtr ReactiveScript::Get(const std::string& name) const {
+    return _environment != nullptr ? _environment->Get(name) : nullptr;
+}
+
+ObjectPtr ReactiveScript::RunAll() {
+    Evaluator& evaluator = _isolate.GetEvaluator();
+    _environment = std::make_shared<Environment>();
+    InstallBuiltins(evaluator, *_environment);
+    for (const auto& [name, value] : _inputs) {
+        _environment->Set(name, value);
+    }
+
+    size_t count = _program.statements.size();
+    _nodes.clear();
+    _nodes.resize(count);
+    _readers.clear();
+    _writers.clear();
+    _pending = {};
+    _queued.assign(count, false);
+    _incremental = false;
+
+    for (size_t index = 0; index < count; index++) {
+        ObjectPtr result = Evaluate(index);
+        if (result->type == Object::Type::ERROR) {
+            return result;
+        }
+    }
+
+    bool incremental = true;
+    for (size_t index = 0; index < count; index++) {
+        for (const std::string* name : _nodes[index].dependencies.writes) {
+            std::vector<size_t>& writers = _writers[name];
+            writers.push_back(index);
+            incremental = incremental && writers.size() == 1;
+        }
+    }
+    for (size_t index = 0; index < count; index++) {
+        incremental = AddReads(index) && incremental;
+    }
+    _incremental = incremental;
+
+    return Result();
+}
+
+ObjectPtr ReactiveScript::Evaluate(size_t index) {
+    Node& node = _nodes[index];
+    node.dependencies = Dependencies();
+    node.result = _isolate.GetEvaluator().EvaluateStatement(_program, index, *_environment,
+                                                            node.dependencies);
+    _evaluated++;
+
+    // A function bound by a let refers to itself through its self binding. Capturing
+    // its previous value when it is evaluated again is not a dependency.
+    const Statement* statement = _program.statements[index];
+    if (statement->type == Statement::Type::LET) {
+        const LetStatement* let = static_cast<const LetStatement*>(statement);
+        if (let->value->type == Expression::Type::FUNCTION) {
+            std::vector<const std::string*>& reads = node.dependencies.reads;
+            reads.erase(std::remove(reads.begin(), reads.end(), &let->name->value),
+                        reads.end());
+        }
+    }
+
+    return node.result;
+}
+
+void ReactiveScript::Schedule(const Index& index, const std::string* name, size_t after) {
+    auto it = index.find(name);
+    if (it == index.end()) {
+        return;
+    }
+
+    for (size_t statement : it->second) {
+        if (statement >= after && !_queued[statement]) {
+            _queued[statement] = true;
+            _pending.push(statement);
+        }
+    }
+}
+
+bool ReactiveScript::AddReads(size_t index) {
+    bool ordered = true;
+    for (const std::string* name : _nodes[index].dependencies.reads) {
+        std::vector<size_t>& readers = _readers[name];
+        readers.insert(std::upper_bound(readers.begin(), readers.end(), index), index);
+
+        auto it = _writers.find(name);
+        if (it != _writers.end() && it->second.back() >= index) {
+            ordered = false;
+        }
+    }
+    return ordered;
+}
+
+void ReactiveScript::RemoveReads(size_t index) {
+    for (const std::string* name : _nodes[index].dependencies.reads) {
+        std::vector<size_t>& readers = _readers[name];
+        readers.erase(std::lower_bound(readers.begin(), readers.end(), index));
+    }
+}
+
+ObjectPtr ReactiveScript::Result() const {
+    return _nodes.empty() ? nullptr : _nodes.back().result;
+}
+
+IsolatePool::IsolatePool(size_t threads) {
+    threads = std::max<size_t>(threads, 1);
+    for (size_t i = 0; i < threads; i++) {
+        _isolates.push_back(std::make_unique<Isolate>());
+    }
+    for (size_t i = 0; i < threads; i++) {
+        _threads.emplace_back(&IsolatePool::Work, this, std::ref(*_isolates[i]));
+    }
+}
+
+IsolatePool::~IsolatePool() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _wake.notify_all();
+
+    for (std::thread& thread : _threads) {
+        thread.join();
+    }
+}
+
+std::vector<ObjectPtr> IsolatePool::Run(const std::vector<Job>& jobs) {
+    std::vector<ObjectPtr> results(jobs.size());
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _jobs = &jobs;
+        _results = &results;
+        _next = 0;
+        _running = _threads.size();
+        _generation++;
+    }
+    _wake.notify_all();
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _done.wait(lock, [this] { return _running == 0; });
+
+    return results;
+}
+
+void IsolatePool::SetLimits(const Limits& limits) {
+    for (std::unique_ptr<Isolate>& isolate : _isolates) {
+        isolate->SetLimits(limits);
+    }
+}
+
+void IsolatePool::Work(Isolate& isolate) {
+    uint64_t generation = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _wake.wait(lock, [&] { return _stopping || _generation != generation; });
+            if (_stopping) {
+                return;
+            }
+            generation = _generation;
+        }
+
+        const std::vector<Job>& jobs = *_jobs;
+        for (size_t i = _next++; i < jobs.size(); i = _next++) {
+            (*_results)[i] = isolate.Run(*jobs[i].script, jobs[i].input);
+        }
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (--_running == 0) {
+            _done.notify_one();
+        }
+    }
+}
@@ -0,0 +1,989 @@
+#include "snapshot.h"
+
+#include "object.h"
+
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+// A snapshot starts with MAGIC and VERSION, followed by the number of globals and
+// each global's name and value. Values are written as references: NONE for null,
+// DEFINITION followed by the definition the first time something is reached, and
+// its index plus FIRST_INDEX after that. Objects, environments, statements and
+// expressions are numbered separately, in the order their definitions start, so that
+// cycles only ever refer back to something already allocated. Numbers are LEB128,
+// signed ones zigzag encoded first, doubles are their 8 bytes, least significant
+// first.
+static constexpr char MAGIC[8] = {'T', 'B', 'D', 'S', 'N', 'A', 'P', '\0'};
+static constexpr uint64_t VERSION = 1;
+
+enum Reference : uint64_t {
+    NONE,
+    DEFINITION,
+    FIRST_INDEX,
+};
+
+class SnapshotWriter {
+public:
+    SnapshotWriter(const Environment& globals) {
+        // closures of top level functions hold copies of the globals, not the globals
+        // themselves, but those of nested ones may refer to them as their outer
+        _environments.emplace(&globals, _environment_count++);
+    }
+
+    void WriteGlobals(const Environment& globals);
+    const std::string& GetData() const { return _data; }
+
+private:
+    std::string _data;
+
+    std::unordered_map<const Object*, uint64_t> _objects;
+    std::unordered_map<const Environment*, uint64_t> _environments;
+    std::unordered_map<const Statement*, uint64_t> _statements;
+    std::unordered_map<const Expression*, uint64_t> _expressions;
+    // struct literal written for each shape, which shares the numbering of expressions
+    std::unordered_map<const Shape*, uint64_t> _shapes;
+    uint64_t _object_count = 0;
+    uint64_t _environment_count = 0;
+    uint64_t _statement_count = 0;
+    uint64_t _expression_count = 0;
+
+    void Byte(uint8_t value) { _data.push_back(static_cast<char>(value)); }
+    void Unsigned(uint64_t value);
+    void Signed(int64_t value) {
+        Unsigned((static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+    }
+    void Double(double value) {
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        for (size_t i = 0; i < sizeof(bits); i++) {
+            Byte(static_cast<uint8_t>(bits >> (8 * i)));
+        }
+    }
+    void Text(const std::string& text);
+
+    // Writes the reference to pointer, true if its definition has to follow.
+    template <typename T>
+    bool WriteReference(std::unordered_map<const T*, uint64_t>& indices,
+                        uint64_t& count,
+                        const T* pointer);
+
+    void Write(const Object* object);
+    void Write(const Environment* environment);
+    void Write(const Statement* node);
+    void Write(const Expression* node);
+    void WriteShape(const Shape* shape);
+    void WriteShapeLiteral(const Shape& shape);
+};
+
+void SnapshotWriter::Unsigned(uint64_t value) {
+    while (value >= 0x80) {
+        Byte(static_cast<uint8_t>(value) | 0x80);
+        value >>= 7;
+    }
+    Byte(static_cast<uint8_t>(value));
+}
+
+void SnapshotWriter::Text(const std::string& text) {
+    Unsigned(text.size());
+    _data.append(text);
+}
+
+template <typename T>
+bool SnapshotWriter::WriteReference(std::unordered_map<const T*, uint64_t>& indices,
+                                    uint64_t& count,
+                                    const T* pointer) {
+    if (pointer == nullptr) {
+        Unsigned(Reference::NONE);
+        return false;
+    }
+
+    auto found = indices.find(pointer);
+    if (found != indices.end()) {
+        Unsigned(Reference::FIRST_INDEX + found->second);
+        return false;
+    }
+
+    indices.emplace(pointer, count++);
+    Unsigned(Reference::DEFINITION);
+    return true;
+}
+
+void SnapshotWriter::WriteGlobals(const Environment& globals) {
+    _data.append(MAGIC, sizeof(MAGIC));
+    Unsigned(VERSION);
+
+    Unsigned(globals.store.size());
+    for (const auto& [name, value] : globals.store) {
+        Text(name);
+        try {
+            Write(value.get());
+        } catch (const SnapshotError& error) {
+            throw SnapshotError(name + ": " + error.what());
+        }
+    }
+}
+
+void SnapshotWriter::Write(const Object* object) {
+    if (!WriteReference(_objects, _object_count, object)) {
+        return;
+    }
+
+    Byte(object->type);
+    switch (object->type) {
+    case Object::Type::INT:
+        Signed(static_cast<const Integer*>(object)->value);
+        break;
+    case Object::Type::BIG_INT:
+        Text(static_cast<const BigInteger*>(object)->value.ToString());
+        break;
+    case Object::Type::BOOL:
+        Byte(static_cast<const Boolean*>(object)->value);
+        break;
+    case Object::Type::STRING:
+        Text(static_cast<const String*>(object)->value);
+        break;
+    case Object::Type::NIL:
+        break;
+    case Object::Type::FUNCTION: {
+        // parameters, body and kind all come from the literal
+        const Function* function = static_cast<const Function*>(object);
+        if (function->definition == nullptr) {
+            throw SnapshotError("functions without a literal cannot be saved");
+        }
+        Write(function->definition);
+        Write(function->environment.get());
+        break;
+    }
+    case Object::Type::BUILTIN:
+        Text(static_cast<const Builtin*>(object)->name);
+        break;
+    case Object::Type::STRUCT:
+        WriteShape(static_cast<const StructType*>(object)->shape);
+        break;
+    case Object::Type::INSTANCE: {
+        const Instance* instance = static_cast<const Instance*>(object);
+        WriteShape(instance->shape);
+        for (size_t i = 0; i < instance->shape->fields.size(); i++) {
+            Write(instance->Fields()[i].get());
+        }
+        break;
+    }
+    case Object::Type::ITERATOR: {
+        const Iterator* iterator = static_cast<const Iterator*>(object);
+        Byte(iterator->kind);
+        switch (iterator->kind) {
+        case Iterator::Kind::RANGE:
+            Signed(static_cast<const Range*>(iterator)->next);
+            Signed(static_cast<const Range*>(iterator)->end);
+            break;
+        case Iterator::Kind::TAKE:
+            Write(static_cast<const Take*>(iterator)->source.get());
+            Signed(static_cast<const Take*>(iterator)->remaining);
+            break;
+        case Iterator::Kind::KEYS:
+            Write(static_cast<const Keys*>(iterator)->map.get());
+            Unsigned(static_cast<const Keys*>(iterator)->position);
+            break;
+        case Iterator::Kind::GENERATOR:
+            throw SnapshotError("generators cannot be saved");
+        }
+        break;
+    }
+    case Object::Type::MAP: {
+        const auto& entries = static_cast<const Map*>(object)->table.Entries();
+        Unsigned(entries.size());
+        for (const HashTable::Entry& entry : entries) {
+            Write(entry.key.get());
+            Write(entry.value.get());
+        }
+        break;
+    }
+    case Object::Type::FUTURE:
+        throw SnapshotError("futures cannot be saved");
+    case Object::Type::ERROR:
+        Text(static_cast<const Error*>(object)->message);
+        break;
+    case Object::Type::FLOAT:
+        Double(static_cast<const Float*>(object)->value);
+        break;
+    case Object::Type::ARRAY: {
+        const auto& values = static_cast<const FloatArray*>(object)->values;
+        Unsigned(values.size());
+        for (double value : values) {
+            Double(value);
+        }
+        break;
+    }
+    }
+}
+
+void SnapshotWriter::Write(const Environment* environment) {
+    if (!WriteReference(_environments, _environment_count, environment)) {
+        return;
+    }
+
+    // closures capture their frames, only a frame of a call still running has slots
+    if (environment->stack != nullptr) {
+        throw SnapshotError("call frames cannot be saved");
+    }
+
+    // a self binding is saved as an ordinary one, the reader tells them apart
+    std::shared_ptr<Object> self = environment->self.lock();
+    bool has_self = environment->self_name != nullptr && self != nullptr;
+
+    Write(environment->outer.get());
+    Unsigned(environment->store.size() + has_self);
+    for (const auto& [name, value] : environment->store) {
+        Text(name);
+        Write(value.get());
+    }
+    if (has_self) {
+        Text(*environment->self_name);
+        Write(self.get());
+    }
+}
+
+void SnapshotWriter::Write(const Statement* node) {
+    if (!WriteReference(_statements, _statement_count, node)) {
+        return;
+    }
+
+    Byte(node->type);
+    switch (node->type) {
+    case Statement::Type::LET:
+        Write(static_cast<const LetStatement*>(node)->name);
+        Write(static_cast<const LetStatement*>(node)->value);
+        break;
+    case Statement::Type::RETURN:
+        Write(static_cast<const ReturnStatement*>(node)->value);
+        break;
+    case Statement::Type::YIELD:
+        Write(static_cast<const YieldStatement*>(node)->value);
+        break;
+    case Statement::Type::EXPRESSION:
+        Write(static_cast<const ExpressionStatement*>(node)->expression);
+        break;
+    }
+}
+
+void SnapshotWriter::Write(const Expression* node) {
+    // a shape reached through a value before its literal was written for it already
+    if (node != nullptr && node->type == Expression::Type::STRUCT) {
+        auto found = _shapes.find(&static_cast<const StructExpression*>(node)->shape);
+        if (found != _shapes.end()) {
+            Unsigned(Reference::FIRST_INDEX + found->second);
+            return;
+        }
+    }
+
+    if (!WriteReference(_expressions, _expression_count, node)) {
+        return;
+    }
+
+    Byte(node->type);
+    switch (node->type) {
+    case Expression::Type::IDENT:
+        Text(static_cast<const Identifier*>(node)->value);
+        break;
+    case Expression::Type::INT:
+        Signed(static_cast<const IntegerLiteral*>(node)->value);
+        break;
+    case Expression::Type::FLOAT:
+        Double(static_cast<const FloatLiteral*>(node)->value);
+        break;
+    case Expression::Type::BIG_INT:
+        Text(static_cast<const BigIntLiteral*>(node)->value.ToString());
+        break;
+    case Expression::Type::STRING:
+        Text(static_cast<const StringLiteral*>(node)->value);
+        break;
+    case Expression::Type::BOOLEAN:
+        Byte(static_cast<const BooleanLiteral*>(node)->value);
+        break;
+    case Expression::Type::PREFIX: {
+        const PrefixExpression* prefix = static_cast<const PrefixExpression*>(node);
+        Byte(prefix->op);
+        Write(prefix->right);
+        break;
+    }
+    case Expression::Type::INFIX: {
+        const InfixExpression* infix = static_cast<const InfixExpression*>(node);
+        Byte(infix->op);
+        Write(infix->left);
+        Write(infix->right);
+        break;
+    }
+    case Expression::Type::BLOCK: {
+        const BlockExpression* block = static_cast<const BlockExpression*>(node);
+        Unsigned(block->statements.size());
+        for (const Statement* statement : block->statements) {
+            Write(statement);
+        }
+        break;
+    }
+    case Expression::Type::IF_ELSE: {
+        const IfElseExpression* if_else = static_cast<const IfElseExpression*>(node);
+        Write(if_else->condition);
+        Write(if_else->consequence);
+        Write(if_else->alternative);
+        break;
+    }
+    case Expression::Type::CALL: {
+        const CallExpression* call = static_cast<const CallExpression*>(node);
+        Write(call->function);
+        Unsigned(call->arguments.size());
+        for (const Expression* argument : call->arguments) {
+            Write(argument);
+        }
+        break;
+    }
+    case Expression::Type::FUNCTION: {
+        const FunctionExpression* function = static_cast<const FunctionExpression*>(node);
+        Unsigned(function->parameters.size());
+        for (const Identifier* parameter : function->parameters) {
+            Write(parameter);
+        }
+        Write(function->body);
+        Byte(function->generator);
+        Text(function->name);
+        Unsigned(function->line);
+        break;
+    }
+    case Expression::Type::STRUCT: {
+        const Shape& shape = static_cast<const StructExpression*>(node)->shape;
+        _shapes.emplace(&shape, _expression_count - 1);
+        WriteShapeLiteral(shape);
+        break;
+    }
+    case Expression::Type::FIELD:
+        Write(static_cast<const FieldExpression*>(node)->object);
+        Write(static_cast<const FieldExpression*>(node)->field);
+        break;
+    case Expression::Type::ASSIGN:
+        Write(static_cast<const AssignExpression*>(node)->name);
+        Write(static_cast<const AssignExpression*>(node)->value);
+        break;
+    case Expression::Type::WHILE:
+        Write(static_cast<const WhileExpression*>(node)->condition);
+        Write(static_cast<const WhileExpression*>(node)->body);
+        break;
+    case Expression::Type::FOR: {
+        const ForExpression* loop = static_cast<const ForExpression*>(node);
+        Write(loop->initializer);
+        Write(loop->condition);
+        Write(loop->update);
+        Write(loop->body);
+        break;
+    }
+    case Expression::Type::MAP: {
+        const auto& entries = static_cast<const MapExpression*>(node)->entries;
+        Unsigned(entries.size());
+        for (const auto& [key, value] : entries) {
+            Write(key);
+            Write(value);
+        }
+        break;
+    }
+    }
+}
+
+// Shapes are restored as the struct literal that owns them. One that is reached
+// through a struct or instance first is written as a literal of its own, which the
+// literal it came from refers to if it is reached later.
+void SnapshotWriter::WriteShape(const Shape* shape) {
+    auto found = _shapes.find(shape);
+    if (found != _shapes.end()) {
+        Unsigned(Reference::FIRST_INDEX + found->second);
+        return;
+    }
+
+    _shapes.emplace(shape, _expression_count++);
+    Unsigned(Reference::DEFINITION);
+    Byte(Expression::Type::STRUCT);
+    WriteShapeLiteral(*shape);
+}
+
+// the literal's field identifiers are recreated from the names
+void SnapshotWriter::WriteShapeLiteral(const Shape& shape) {
+    Text(shape.name);
+    Unsigned(shape.fields.size());
+    for (const std::string& field : shape.fields) {
+        Text(field);
+    }
+}
+
+void SaveSnapshot(std::ostream& stream, const Environment& globals) {
+    SnapshotWriter writer(globals);
+    writer.WriteGlobals(globals);
+    stream.write(writer.GetData().data(), writer.GetData().size());
+}
+
+class SnapshotReader {
+public:
+    SnapshotReader(const std::string& data, Evaluator& evaluator, const EnvironmentPtr& globals)
+        : _arena(std::make_shared<AstArena>()), _scope(_arena.get()),
+          _next(data.data()), _end(data.data() + data.size()), _evaluator(evaluator),
+          _globals(globals), _environments{globals} {}
+
+    std::shared_ptr<AstArena> ReadGlobals();
+
+private:
+    // first, so that the nodes outlive the objects read so far if reading fails
+    std::shared_ptr<AstArena> _arena;
+    AstArena::Scope _scope;
+
+    const char* _next;
+    const char* _end;
+
+    Evaluator& _evaluator;
+    EnvironmentPtr _globals;
+
+    std::vector<ObjectPtr> _objects;
+    std::vector<EnvironmentPtr> _environments;
+    std::vector<Statement*> _statements;
+    std::vector<Expression*> _expressions;
+
+    [[noreturn]] static void Corrupt() { throw SnapshotError("corrupt snapshot"); }
+
+    uint8_t Byte();
+    uint64_t Unsigned();
+    int64_t Signed() {
+        uint64_t value = Unsigned();
+        return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+    }
+    double Double() {
+        uint64_t bits = 0;
+        for (size_t i = 0; i < sizeof(bits); i++) {
+            bits |= static_cast<uint64_t>(Byte()) << (8 * i);
+        }
+        double value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+    std::string Text();
+    // a bignum's magnitude written out in decimal
+    static BigInt Decimal(const std::string& digits);
+    // a count of things that take at least a byte each
+    size_t Count();
+
+    // Reads a reference, true if the definition follows. Otherwise result is what it
+    // refers to, nullptr for NONE.
+    template <typename T>
+    bool ReadReference(const std::vector<T>& read, T& result);
+
+    ObjectPtr ReadObject();
+    ObjectPtr ReadValue();
+    EnvironmentPtr ReadEnvironment();
+    Statement* ReadStatement();
+    Expression* ReadExpression();
+    Expression* ReadNode();
+    Identifier* ReadIdentifier();
+    BlockExpression* ReadBlock();
+    const Shape* ReadShape();
+};
+
+uint8_t SnapshotReader::Byte() {
+    if (_next == _end) {
+        Corrupt();
+    }
+    return static_cast<uint8_t>(*_next++);
+}
+
+uint64_t SnapshotReader::Unsigned() {
+    uint64_t value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        uint8_t byte = Byte();
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return value;
+        }
+    }
+    Corrupt();
+}
+
+std::string SnapshotReader::Text() {
+    uint64_t size = Unsigned();
+    if (size > static_cast<uint64_t>(_end - _next)) {
+        Corrupt();
+    }
+    std::string text(_next, size);
+    _next += size;
+    return text;
+}
+
+BigInt SnapshotReader::Decimal(const std::string& digits) {
+    if (digits.empty() || digits.find_first_not_of("0123456789") != std::string::npos) {
+        Corrupt();
+    }
+    return BigInt::FromDecimal(digits);
+}
+
+size_t SnapshotReader::Count() {
+    uint64_t count = Unsigned();
+    if (count > static_cast<uint64_t>(_end - _next)) {
+        Corrupt();
+    }
+    return count;
+}
+
+template <typename T>
+bool SnapshotReader::ReadReference(const std::vector<T>& read, T& result) {
+    uint64_t reference = Unsigned();
+    if (reference == Reference::NONE) {
+        result = nullptr;
+        return false;
+    }
+    if (reference == Reference::DEFINITION) {
+        return true;
+    }
+
+    // a node can only refer to another one whose definition is complete
+    uint64_t index = reference - Reference::FIRST_INDEX;
+    if (index >= read.size() || read[index] == nullptr) {
+        Corrupt();
+    }
+    result = read[index];
+    return false;
+}
+
+std::shared_ptr<AstArena> SnapshotReader::ReadGlobals() {
+    if (static_cast<size_t>(_end - _next) < sizeof(MAGIC) ||
+        std::memcmp(_next, MAGIC, sizeof(MAGIC)) != 0) {
+        throw SnapshotError("not a snapshot");
+    }
+    _next += sizeof(MAGIC);
+    if (Unsigned() != VERSION) {
+        throw SnapshotError("snapshot of another version");
+    }
+
+    // nothing is bound until all of it was read
+    std::vector<std::pair<std::string, ObjectPtr>> bindings(Count());
+    for (auto& [name, value] : bindings) {
+        name = Text();
+        value = ReadValue();
+    }
+    if (_next != _end) {
+        Corrupt();
+    }
+
+    // a function bound in the environment it closes over was bound there by its let
+    for (const EnvironmentPtr& environment : _environments) {
+        for (auto it = environment->store.begin(); it != environment->store.end(); it++) {
+            if (it->second->type == Object::Type::FUNCTION &&
+                static_cast<Function*>(it->second.get())->environment == environment) {
+                environment->SetSelf(Intern(it->first), it->second);
+                break;
+            }
+        }
+    }
+
+    for (auto& [name, value] : bindings) {
+        _globals->Set(name, std::move(value));
+    }
+    return _arena;
+}
+
+ObjectPtr SnapshotReader::ReadObject() {
+    ObjectPtr object;
+    if (!ReadReference(_objects, object)) {
+        return object;
+    }
+
+    // Objects that can be part of a cycle are registered before their contents are
+    // read, the others once they are complete.
+    size_t index = _objects.size();
+    _objects.emplace_back();
+
+    switch (Byte()) {
+    case Object::Type::INT:
+        object = _evaluator.NewInteger(Signed());
+        break;
+    case Object::Type::BIG_INT: {
+        std::string digits = Text();
+        bool negative = !digits.empty() && digits[0] == '-';
+        BigInt value = Decimal(digits.substr(negative));
+        object = _evaluator.NewInteger(negative ? -value : value);
+        break;
+    }
+    case Object::Type::BOOL:
+        object = _evaluator.NewBoolean(Byte() != 0);
+        break;
+    case Object::Type::STRING:
+        object = _evaluator.New<String>(Text());
+        break;
+    case Object::Type::NIL:
+        object = _evaluator.GetNil();
+        break;
+    case Object::Type::FUNCTION: {
+        std::shared_ptr<Function> function =
+            _evaluator.New<Function>(std::vector<Identifier*>(), nullptr, nullptr);
+        _objects[index] = function;
+
+        Expression* literal = ReadNode();
+        if (literal->type != Expression::Type::FUNCTION) {
+            Corrupt();
+        }
+        const FunctionExpression* definition = static_cast<FunctionExpression*>(literal);
+        function->parameters = definition->parameters;
+        function->body = definition->body;
+        function->generator = definition->generator;
+        function->definition = definition;
+        function->arena = _arena;
+
+        function->environment = ReadEnvironment();
+        if (function->environment == nullptr) {
+            Corrupt();
+        }
+        return function;
+    }
+    case Object::Type::BUILTIN: {
+        std::string name = Text();
+        object = _globals->Get(name);
+        if (object == nullptr || object->type != Object::Type::BUILTIN) {
+            throw SnapshotError("unknown builtin " + name);
+        }
+        break;
+    }
+    case Object::Type::STRUCT:
+        object = _evaluator.New<StructType>(ReadShape(), _arena);
+        break;
+    case Object::Type::INSTANCE: {
+        const Shape* shape = ReadShape();
+        std::shared_ptr<Instance> instance = _evaluator.NewInstance(shape, _arena);
+        _objects[index] = instance;
+        for (size_t i = 0; i < shape->fields.size(); i++) {
+            instance->Fields()[i] = ReadValue();
+        }
+        return instance;
+    }
+    case Object::Type::ITERATOR:
+        switch (Byte()) {
+        case Iterator::Kind::RANGE: {
+            int64_t next = Signed();
+            int64_t end = Signed();
+            object = _evaluator.New<Range>(next, end);
+            break;
+        }
+        case Iterator::Kind::TAKE: {
+            std::shared_ptr<Take> take = _evaluator.New<Take>(nullptr, 0);
+            _objects[index] = take;
+            take->source = ReadValue();
+            take->remaining = Signed();
+            return take;
+        }
+        case Iterator::Kind::KEYS: {
+            std::shared_ptr<Keys> keys = _evaluator.New<Keys>(nullptr);
+            _objects[index] = keys;
+            keys->map = ReadValue();
+            keys->position = Unsigned();
+            return keys;
+        }
+        default:
+            Corrupt();
+        }
+        break;
+    case Object::Type::MAP: {
+        std::shared_ptr<Map> map = _evaluator.NewMap();
+        _objects[index] = map;
+        size_t count = Count();
+        for (size_t i = 0; i < count; i++) {
+            ObjectPtr key = ReadValue();
+            ObjectPtr value = ReadValue();
+            if (!HashTable::IsKey(*key)) {
+                Corrupt();
+            }
+            map->table.Set(std::move(key), std::move(value));
+        }
+        return map;
+    }
+    case Object::Type::ERROR:
+        object = _evaluator.New<Error>(Text());
+        break;
+    case Object::Type::FLOAT:
+        object = _evaluator.New<Float>(Double());
+        break;
+    case Object::Type::ARRAY: {
+        std::shared_ptr<FloatArray> array = _evaluator.NewArray();
+        size_t count = Count();
+        array->values.reserve(count);
+        for (size_t i = 0; i < count; i++) {
+            array->values.push_back(Double());
+        }
+        object = array;
+        break;
+    }
+    default:
+        Corrupt();
+    }
+
+    _objects[index] = object;
+    return object;
+}
+
+ObjectPtr SnapshotReader::ReadValue() {
+    ObjectPtr object = ReadObject();
+    if (object == nullptr) {
+        Corrupt();
+    }
+    return object;
+}
+
+EnvironmentPtr SnapshotReader::ReadEnvironment() {
+    EnvironmentPtr environment;
+    if (!ReadReference(_environments, environment)) {
+        return environment;
+    }
+
+    environment = _evaluator.NewEnvironment();
+    _environments.push_back(environment);
+
+    environment->outer = ReadEnvironment();
+    size_t count = Count();
+    environment->store.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        std::string name = Text();
+        environment->store.emplace(std::move(name), ReadValue());
+    }
+    return environment;
+}
+
+Statement* SnapshotReader::ReadStatement() {
+    Statement* node;
+    if (!ReadReference(_statements, node)) {
+        return node;
+    }
+
+    size_t index = _statements.size();
+    _statements.push_back(nullptr);
+
+    // Everything is read before a node is allocated, since a node allocated from the
+    // arena cannot be freed again once later ones are.
+    switch (Byte()) {
+    case Statement::Type::LET: {
+        Identifier* name = ReadIdentifier();
+        Expression* value = ReadNode();
+        node = new LetStatement(name, value);
+        break;
+    }
+    case Statement::Type::RETURN: {
+        Expression* value = ReadNode();
+        node = new ReturnStatement(value);
+        break;
+    }
+    case Statement::Type::YIELD: {
+        Expression* value = ReadNode();
+        node = new YieldStatement(value);
+        break;
+    }
+    case Statement::Type::EXPRESSION: {
+        Expression* expression = ReadNode();
+        node = new ExpressionStatement(expression);
+        break;
+    }
+    default:
+        Corrupt();
+    }
+
+    _statements[index] = node;
+    return node;
+}
+
+Expression* SnapshotReader::ReadExpression() {
+    Expression* node;
+    if (!ReadReference(_expressions, node)) {
+        return node;
+    }
+
+    size_t index = _expressions.size();
+    _expressions.push_back(nullptr);
+
+    // read completely before allocating, as for statements
+    switch (Byte()) {
+    case Expression::Type::IDENT: {
+        std::string name = Text();
+        node = new Identifier(name);
+        break;
+    }
+    case Expression::Type::INT: {
+        int64_t value = Signed();
+        node = new IntegerLiteral(value);
+        break;
+    }
+    case Expression::Type::FLOAT: {
+        double value = Double();
+        node = new FloatLiteral(value);
+        break;
+    }
+    case Expression::Type::BIG_INT: {
+        BigInt value = Decimal(Text());
+        node = new BigIntLiteral(std::move(value));
+        break;
+    }
+    case Expression::Type::STRING: {
+        std::string value = Text();
+        node = new StringLiteral(std::move(value));
+        break;
+    }
+    case Expression::Type::BOOLEAN: {
+        bool value = Byte() != 0;
+        node = new BooleanLiteral(value);
+        break;
+    }
+    case Expression::Type::PREFIX: {
+        uint8_t op = Byte();
+        if (op > PrefixExpression::Operation::NOT) {
+            Corrupt();
+        }
+        Expression* right = ReadNode();
+        node = new PrefixExpression(static_cast<PrefixExpression::Operation>(op), right);
+        break;
+    }
+    case Expression::Type::INFIX: {
+        uint8_t op = Byte();
+        if (op > InfixExpression::Operation::OR) {
+            Corrupt();
+        }
+        Expression* left = ReadNode();
+        Expression* right = ReadNode();
+        node = new InfixExpression(static_cast<InfixExpression::Operation>(op), left, right);
+        break;
+    }
+    case Expression::Type::BLOCK: {
+        std::vector<Statement*> statements(Count());
+        for (Statement*& statement : statements) {
+            statement = ReadStatement();
+            if (statement == nullptr) {
+                Corrupt();
+            }
+        }
+        node = new BlockExpression(statements);
+        break;
+    }
+    case Expression::Type::IF_ELSE: {
+        Expression* condition = ReadNode();
+        BlockExpression* consequence = ReadBlock();
+        Expression* alternative = ReadExpression();
+        node = new IfElseExpression(condition, consequence, alternative);
+        break;
+    }
+    case Expression::Type::CALL: {
+        Expression* function = ReadNode();
+        std::vector<Expression*> arguments(Count());
+        for (Expression*& argument : arguments) {
+            argument = ReadNode();
+        }
+        node = new CallExpression(function, arguments);
+        break;
+    }
+    case Expression::Type::FUNCTION: {
+        std::vector<Identifier*> parameters(Count());
+        for (Identifier*& parameter : parameters) {
+            parameter = ReadIdentifier();
+        }
+        BlockExpression* body = ReadBlock();
+        bool generator = Byte() != 0;
+        std::string name = Text();
+        uint64_t line = Unsigned();
+        FunctionExpression* function = new FunctionExpression(parameters, body, generator);
+        function->name = std::move(name);
+        function->line = line;
+        node = function;
+        break;
+    }
+    case Expression::Type::STRUCT: {
+        std::string name = Text();
+        std::vector<std::string> names(Count());
+        for (std::string& field : names) {
+            field = Text();
+        }
+        std::vector<Identifier*> fields;
+        for (const std::string& field : names) {
+            fields.push_back(new Identifier(field));
+        }
+        StructExpression* literal = new StructExpression(fields, std::move(names));
+        literal->shape.name = std::move(name);
+        node = literal;
+        break;
+    }
+    case Expression::Type::FIELD: {
+        Expression* object = ReadNode();
+        Identifier* field = ReadIdentifier();
+        node = new FieldExpression(object, field);
+        break;
+    }
+    case Expression::Type::ASSIGN: {
+        Identifier* name = ReadIdentifier();
+        Expression* value = ReadNode();
+        node = new AssignExpression(name, value);
+        break;
+    }
+    case Expression::Type::WHILE: {
+        Expression* condition = ReadNode();
+        BlockExpression* body = ReadBlock();
+        node = new WhileExpression(condition, body);
+        break;
+    }
+    case Expression::Type::FOR: {
+        Statement* initializer = ReadStatement();
+        Expression* condition = ReadExpression();
+        Expression* update = ReadExpression();
+        BlockExpression* body = ReadBlock();
+        node = new ForExpression(initializer, condition, update, body);
+        break;
+    }
+    case Expression::Type::MAP: {
+        std::vector<std::pair<Expression*, Expression*>> entries(Count());
+        for (auto& [key, value] : entries) {
+            key = ReadNode();
+            value = ReadNode();
+        }
+        node = new MapExpression(std::move(entries));
+        break;
+    }
+    default:
+        Corrupt();
+    }
+
+    _expressions[index] = node;
+    return node;
+}
+
+Expression* SnapshotReader::ReadNode() {
+    Expression* node = ReadExpression();
+    if (node == nullptr) {
+        Corrupt();
+    }
+    return node;
+}
+
+Identifier* SnapshotReader::ReadIdentifier() {
+    Expression* node = ReadNode();
+    if (node->type != Expression::Type::IDENT) {
+        Corrupt();
+    }
+    return static_cast<Identifier*>(node);
+}
+
+BlockExpression* SnapshotReader::ReadBlock() {
+    Expression* node = ReadNode();
+    if (node->type != Expression::Type::BLOCK) {
+        Corrupt();
+    }
+    return static_cast<BlockExpression*>(node);
+}
+
+const Shape* SnapshotReader::ReadShape() {
+    Expression* node = ReadNode();
+    if (node->type != Expression::Type::STRUCT) {
+        Corrupt();
+    }
+    return &static_cast<StructExpression*>(node)->shape;
+}
+
+std::shared_ptr<AstArena> LoadSnapshot(const std::string& data,
+                                       Evaluator& evaluator,
+                                       const EnvironmentPtr& globals) {
+    SnapshotReader reader(data, evaluator, globals);
+    return reader.ReadGlobals();
+}
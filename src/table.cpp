@@ -0,0 +1,125 @@
+#include "table.h"
+
+#include "object.h"
+
+#include <algorithm>
+#include <functional>
+#include <string_view>
+
+bool HashTable::IsKey(const Object& key) {
+    return key.type == Object::Type::INT || key.type == Object::Type::BIG_INT ||
+           key.type == Object::Type::BOOL || key.type == Object::Type::STRING;
+}
+
+// finalizer of splitmix64, spreads consecutive integers over the whole word
+static uint64_t Mix(uint64_t value) {
+    value ^= value >> 30;
+    value *= 0xbf58476d1ce4e5b9;
+    value ^= value >> 27;
+    value *= 0x94d049bb133111eb;
+    value ^= value >> 31;
+    return value;
+}
+
+uint64_t HashTable::Hash(const Object& key) {
+    switch (key.type) {
+    case Object::Type::INT:
+        return Mix(static_cast<const Integer&>(key).value);
+    case Object::Type::BIG_INT:
+        return Mix(static_cast<const BigInteger&>(key).value.Hash());
+    case Object::Type::BOOL:
+        return Mix(static_cast<const Boolean&>(key).value ? 0x9e3779b97f4a7c15 : 0);
+    default:
+        return Mix(std::hash<std::string_view>()(static_cast<const String&>(key).value));
+    }
+}
+
+bool HashTable::Equal(const Object& left, const Object& right) {
+    if (left.type != right.type) {
+        return false;
+    }
+
+    switch (left.type) {
+    case Object::Type::INT:
+        return static_cast<const Integer&>(left).value ==
+               static_cast<const Integer&>(right).value;
+    // bignums never fit an int64_t, so they are never equal to an INT
+    case Object::Type::BIG_INT:
+        return static_cast<const BigInteger&>(left).value.Compare(
+                   static_cast<const BigInteger&>(right).value) == 0;
+    case Object::Type::BOOL:
+        return static_cast<const Boolean&>(left).value ==
+               static_cast<const Boolean&>(right).value;
+    default:
+        return static_cast<const String&>(left).value ==
+               static_cast<const String&>(right).value;
+    }
+}
+
+size_t HashTable::Probe(const Object& key, uint64_t hash) const {
+    size_t mask = _control.size() - 1;
+    uint8_t control = Control(hash);
+
+    for (size_t slot = hash & mask;; slot = (slot + 1) & mask) {
+        if (_control[slot] == 0) {
+            return slot;
+        }
+        if (_control[slot] == control) {
+            const Entry& entry = _entries[_slots[slot]];
+            if (entry.hash == hash && Equal(*entry.key, key)) {
+                return slot;
+            }
+        }
+    }
+}
+
+const std::shared_ptr<Object>* HashTable::Find(const Object& key) const {
+    if (_entries.empty()) {
+        return nullptr;
+    }
+
+    size_t slot = Probe(key, Hash(key));
+    if (_control[slot] == 0) {
+        return nullptr;
+    }
+
+    return &_entries[_slots[slot]].value;
+}
+
+void HashTable::Set(std::shared_ptr<Object> key, std::shared_ptr<Object> value) {
+    uint64_t hash = Hash(*key);
+    if (!_entries.empty()) {
+        size_t slot = Probe(*key, hash);
+        if (_control[slot] != 0) {
+            _entries[_slots[slot]].value = std::move(value);
+            return;
+        }
+    }
+
+    if ((_entries.size() + 1) * 8 > _control.size() * 7) {
+        Grow();
+    }
+
+    size_t slot = Probe(*key, hash);
+    _control[slot] = Control(hash);
+    _slots[slot] = _entries.size();
+    _entries.push_back({hash, std::move(key), std::move(value)});
+}
+
+// entries keep their hash, so rebuilding the index never looks at a key
+void HashTable::Grow() {
+    size_t capacity = std::max(MIN_CAPACITY, _control.size() * 2);
+    _control.assign(capacity, 0);
+    _slots.assign(capacity, 0);
+
+    size_t mask = capacity - 1;
+    for (size_t i = 0; i < _entries.size(); i++) {
+        size_t slot = _entries[i].hash & mask;
+        while (_control[slot] != 0) {
+            slot = (slot + 1) & mask;
+        }
+
+        _control[slot] = Control(_entries[i].hash);
+        _slots[slot] = i;
+    }
+}
@@ -22,6 +22,12 @@ std::ostream& operator<<(std::ostream& stream, Token::Type type) {
     case Token::Type::INT:
         str = "INT";
         break;
+    case Token::Type::FLOAT:
+        str = "FLOAT";
+        break;
+    case Token::Type::STRING:
+        str = "STRING";
+        break;
     case Token::Type::ASSIGN:
         str = "=";
         break;
@@ -34,6 +40,12 @@ std::ostream& operator<<(std::ostream& stream, Token::Type type) {
     case Token::Type::SEMICOLON:
         str = ";";
         break;
+    case Token::Type::COLON:
+        str = ":";
+        break;
+    case Token::Type::DOT:
+        str = ".";
+        break;
     case Token::Type::LPAREN:
         str = "(";
         break;
@@ -103,6 +115,18 @@ std::ostream& operator<<(std::ostream& stream, Token::Type type) {
     case Token::Type::AND:
         str = "and";
         break;
+    case Token::Type::STRUCT:
+        str = "struct";
+        break;
+    case Token::Type::WHILE:
+        str = "while";
+        break;
+    case Token::Type::FOR:
+        str = "for";
+        break;
+    case Token::Type::YIELD:
+        str = "yield";
+        break;
     }
 
     return stream << str;
@@ -0,0 +1,139 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <unistd.h>
+
+struct TraceEvent {
+    std::string name;
+    const char* category;
+    uint64_t start;
+    uint64_t duration;
+    std::string detail;
+};
+
+// Owned by the registry below rather than the thread, so the events of threads that
+// already ended are still written.
+struct TraceBuffer {
+    size_t thread;
+    std::vector<TraceEvent> events;
+    // total recorded, the latest CAPACITY of them are kept
+    uint64_t recorded = 0;
+};
+
+static std::mutex buffers_mutex;
+static std::vector<std::unique_ptr<TraceBuffer>> buffers;
+static thread_local TraceBuffer* buffer = nullptr;
+
+void Trace::Start(std::chrono::nanoseconds call_threshold) {
+    _call_threshold = call_threshold;
+    _on.store(true, std::memory_order_relaxed);
+}
+
+uint64_t Trace::Now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+void Trace::Record(std::string name, const char* category, uint64_t start, uint64_t end,
+                   std::string detail) {
+    if (buffer == nullptr) {
+        std::lock_guard<std::mutex> lock(buffers_mutex);
+        buffers.push_back(std::make_unique<TraceBuffer>());
+        buffer = buffers.back().get();
+        buffer->thread = buffers.size();
+        buffer->events.reserve(CAPACITY);
+    }
+
+    TraceEvent event{std::move(name), category, start, end - start, std::move(detail)};
+    if (buffer->events.size() < CAPACITY) {
+        buffer->events.push_back(std::move(event));
+    } else {
+        buffer->events[buffer->recorded % CAPACITY] = std::move(event);
+    }
+    buffer->recorded++;
+}
+
+static void WriteString(std::ostream& stream, const std::string& value) {
+    stream << '"';
+    for (char c : value) {
+        switch (c) {
+        case '"':
+            stream << "\\\"";
+            break;
+        case '\\':
+            stream << "\\\\";
+            break;
+        case '\n':
+            stream << "\\n";
+            break;
+        case '\t':
+            stream << "\\t";
+            break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                static const char digits[] = "0123456789abcdef";
+                stream << "\\u00" << digits[c >> 4] << digits[c & 0xf];
+            } else {
+                stream << c;
+            }
+        }
+    }
+    stream << '"';
+}
+
+// trace_event timestamps are in microseconds, fractions keep the nanoseconds
+static void WriteMicroseconds(std::ostream& stream, uint64_t nanoseconds) {
+    stream << nanoseconds / 1000 << '.';
+    uint64_t fraction = nanoseconds % 1000;
+    stream << fraction / 100 << fraction / 10 % 10 << fraction % 10;
+}
+
+void Trace::Write(std::ostream& stream) {
+    _on.store(false, std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock(buffers_mutex);
+    uint64_t origin = UINT64_MAX;
+    for (const auto& thread : buffers) {
+        for (const TraceEvent& event : thread->events) {
+            origin = std::min(origin, event.start);
+        }
+    }
+
+    long pid = getpid();
+    const char* separator = "";
+    stream << "{\"traceEvents\":[";
+    for (const auto& thread : buffers) {
+        stream << separator << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid
+               << ",\"tid\":" << thread->thread << ",\"args\":{\"name\":\""
+               << (thread->thread == 1 ? "main" : "thread " + std::to_string(thread->thread))
+               << "\"}}";
+        separator = ",";
+
+        for (const TraceEvent& event : thread->events) {
+            stream << ",\n{\"name\":";
+            WriteString(stream, event.name);
+            stream << ",\"cat\":\"" << event.category << "\",\"ph\":\"X\",\"ts\":";
+            WriteMicroseconds(stream, event.start - origin);
+            stream << ",\"dur\":";
+            WriteMicroseconds(stream, event.duration);
+            stream << ",\"pid\":" << pid << ",\"tid\":" << thread->thread;
+            if (!event.detail.empty()) {
+                stream << ",\"args\":{\"detail\":";
+                WriteString(stream, event.detail);
+                stream << "}";
+            }
+            stream << "}";
+        }
+
+        if (thread->recorded > CAPACITY) {
+            stream << ",\n{\"name\":\"dropped\",\"ph\":\"i\",\"s\":\"t\",\"ts\":0,\"pid\":"
+                   << pid << ",\"tid\":" << thread->thread << ",\"args\":{\"events\":"
+                   << thread->recorded - CAPACITY << "}}";
+        }
+    }
+    stream << "\n],\"displayTimeUnit\":\"ms\"}\n";
+}